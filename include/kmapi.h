@@ -527,6 +527,39 @@ public:
     int sendData(const KMBuffer &buf);
     void reset(); // reset for connection reuse
     
+    /*
+     * HTTP/2 server push, push the resource added by addPushResource before sending response.
+     * a resource is pushed once on one HTTP/2 connection, ALREADY_EXIST is returned if
+     * it was pushed, AGAIN is returned if client's concurrent stream limit is reached
+     * @param path, the path of the resource, e.g. "/css/style.css"
+     */
+    KMError pushResource(const char *path);
+    
+    /*
+     * add the response to process-wide push cache, the body is shared by all the pushes.
+     * the resource added without authority is pushed for any host
+     * @param authority, the host the resource belongs to, e.g. "www.example.com"
+     */
+    static KMError addPushResource(const char *path, int status_code, const char *content_type, const KMBuffer &body);
+    static KMError addPushResource(const char *authority, const char *path, int status_code, const char *content_type, const KMBuffer &body);
+    static void removePushResource(const char *path);
+    static void removePushResource(const char *authority, const char *path);
+    
+    /*
+     * send the resource added by addStaticResource as the response, the variant that
+     * matches Accept-Encoding is sent from the shared storage without compression.
+     * NOT_EXIST is returned if the resource is not in the cache
+     */
+    KMError sendStaticResource(const char *path, int status_code = 200);
+    
+    /*
+     * add the resource to process-wide static response cache. the compressed variants
+     * are built once at the best compression level, in a background thread if async is
+     * true, and the identity body is served until they are ready
+     */
+    static KMError addStaticResource(const char *path, const char *content_type, const KMBuffer &body, bool async = false);
+    static void removeStaticResource(const char *path);
+    
     KMError close();
     
     const char* getMethod() const;
@@ -563,6 +596,32 @@ public:
     using HandshakeCallback = std::function<bool(KMError)>;
     using EnumerateCallback = HttpParser::EnumerateCallback;
     
+    /**
+     * PreparedMessage encodes a complete message frame once, the frame can be sent
+     * to many WebSocket connections, even on different event loops. copies of
+     * PreparedMessage share the same frame buffer
+     */
+    class KUMA_API PreparedMessage
+    {
+    public:
+        PreparedMessage(const void *data, size_t len, bool is_text);
+        PreparedMessage(const KMBuffer &buf, bool is_text);
+        PreparedMessage(const PreparedMessage &other);
+        PreparedMessage(PreparedMessage &&other);
+        ~PreparedMessage();
+        
+        PreparedMessage& operator=(const PreparedMessage &other);
+        PreparedMessage& operator=(PreparedMessage &&other);
+        
+        size_t size() const;
+        
+        class Impl;
+        Impl* pimpl() const;
+        
+    private:
+        Impl* pimpl_;
+    };
+    
     /*
      * @param ver, http version, "HTTP/2.0" for HTTP2, "HTTP/1.1"
      */
@@ -608,6 +667,24 @@ public:
      */
     int send(const void *data, size_t len, bool is_text, bool is_fin=true, uint32_t flags=0);
     int send(const KMBuffer &buf, bool is_text, bool is_fin=true, uint32_t flags=0);
+    /**
+     * send a prepared message, it can be called on any thread. the message is queued
+     * by reference if the connection cannot send data now, and it is sent uncompressed
+     * even if PMCE is negotiated
+     * @return the message size on success, 0 if too many messages are queued and the
+     *         message is not sent, wait for the write callback, -1 on error
+     */
+    int send(const PreparedMessage &msg);
+    /**
+     * send count complete messages by one vectored send, the frame headers and
+     * small payloads are encoded into pooled blocks, so that a batch of small
+     * messages goes out in one system call and as few TLS records as possible
+     * @param msgs  each iovec is the payload of a message
+     * @param flags  same as send
+     * @return total payload size of the messages, 0 if the connection cannot
+     *         send data now and nothing is sent, -1 on error
+     */
+    int sendBatch(const iovec *msgs, int count, bool is_text, uint32_t flags=0);
     
     KMError close();
     
@@ -620,6 +697,34 @@ public:
     void setWriteCallback(EventCallback cb);
     void setErrorCallback(EventCallback cb);
     
+    /**
+     * reassemble the fragments of a message into a chain of pooled blocks, the
+     * data callback is called once per message with is_fin true. by default each
+     * frame is delivered once it is received and decompressed, so a huge message
+     * doesn't have to be buffered in whole
+     */
+    void setMessageAggregation(bool enable);
+    /**
+     * the connection is closed with status 1009 and BUFFER_TOO_LONG is reported
+     * once a received message exceeds max_size bytes after decompression,
+     * 0 means no limit
+     */
+    void setMaxMessageSize(size_t max_size);
+    
+    /**
+     * permessage-deflate policy for the connections negotiated after this call
+     * @param max_window_bits  9 ~ 15, smaller window uses less memory per connection
+     * @param no_context_takeover  reset the compression context after each message,
+     *                             the zlib state of idle connections is returned to a pool
+     */
+    static KMError setDeflatePolicy(int max_window_bits, bool no_context_takeover);
+    /**
+     * preset permessage-deflate dictionary agreed out of band, e.g. the common
+     * JSON keys of the messages. it is used with the peers that set the same
+     * dictionary, null dict or 0 len removes it
+     */
+    static KMError setDeflateDictionary(const void *dict, size_t len);
+    
     class Impl;
     Impl* pimpl();
     
@@ -693,6 +798,12 @@ public:
     
     KMError close();
     
+    /*
+     * the receive window grows with the measured bandwidth-delay product up to
+     * max_window_size, default is 64 MB
+     */
+    void setMaxLocalWindowSize(uint32_t max_window_size);
+    
     void setAcceptCallback(AcceptCallback cb);
     void setErrorCallback(ErrorCallback cb);
     
@@ -707,6 +818,57 @@ private:
 KUMA_API void init(const char *path = nullptr);
 KUMA_API void fini();
 
+/*
+ * client TLS sessions are cached by host:port/SNI and resumed on reconnect.
+ * max_sessions 0 disables the cache, default is 1024 sessions and 3600 seconds
+ */
+KUMA_API void setSslSessionCache(size_t max_sessions, uint32_t timeout_secs);
+
+struct SslSessionStats
+{
+    uint64_t hits = 0;      // a cached session is offered to server
+    uint64_t misses = 0;    // no valid session is cached
+    uint64_t stores = 0;    // a new session or ticket is cached
+    uint64_t resumed = 0;   // the handshake resumed the offered session
+};
+KUMA_API void getSslSessionStats(SslSessionStats &stats);
+
+/*
+ * pooled HTTP/2 client connections are probed by PING every interval_ms. a connection
+ * is not reused if neither the PING ack nor any other frame is received in timeout_ms,
+ * its open streams are let to complete and it is closed then. interval_ms 0 disables
+ * the probe, default is 15000 and 5000 ms. it applies to the connections created afterwards
+ */
+KUMA_API void setH2PingPolicy(uint32_t interval_ms, uint32_t timeout_ms);
+
+struct H2RttStats
+{
+    uint32_t latest_us = 0;
+    uint32_t min_us = 0;
+    uint32_t smoothed_us = 0;   // RFC 6298 smoothed RTT
+    uint32_t variance_us = 0;
+    uint32_t samples = 0;
+};
+/*
+ * get the RTT measured by PING on the pooled HTTP/2 connection to host:port with the
+ * lowest smoothed RTT. return false if RTT is not measured on any connection to host:port
+ */
+KUMA_API bool getH2RttStats(const char *host, uint16_t port, bool secure, H2RttStats &stats);
+
+/*
+ * limit the receive windows granted by all the HTTP/2 connections and streams, that is
+ * the most data peers may send before it is consumed. the initial stream window is shrunk
+ * when 3/4 of limit is used, and grows back below 1/2. default is 1 GB
+ */
+KUMA_API void setH2WindowBudget(size_t limit);
+
+/*
+ * the receive window of pooled HTTP/2 client connections grows with the measured
+ * bandwidth-delay product up to max_window_size, default is 64 MB. it applies to
+ * the connections created afterwards
+ */
+KUMA_API void setH2MaxWindowSize(uint32_t max_window_size);
+
 // msg is null-terminated and msg_len doesn't include '\0'
 using LogCallback = void(*)(int level, const char* msg, size_t msg_len);
 KUMA_API void setLogCallback(LogCallback cb);
@@ -352,6 +352,12 @@ public:
     void* writePtr() const { return wr_ptr_; }
 
     bool isChained() const { return next_ != this; }
+    
+    /**
+     * return true if the data is reference counted, the subbuffer
+     * of a shared KMBuffer references the data instead of copying it
+     */
+    bool isShared() const { return shared_data_; }
 
     void bytesRead(size_t len)
     {
@@ -21,6 +21,7 @@
 
 #include "TcpConnection.h"
 #include "libkev/src/util/kmtrace.h"
+#include "compr/compr.h"
 
 #include <sstream>
 
@@ -228,6 +229,25 @@ void TcpConnection::onReceive(KMError err)
     }
     uint8_t buf[128*1024];
     do {
+        if (buffer_cb_) {
+            // a pooled block, it returns to the pool when the receiver drops the last reference
+            KMBuffer::Ptr block;
+            KMBuffer *tail = nullptr;
+            getCompressionBlock(block, tail);
+            int ret = tcp_.receive(tail->writePtr(), tail->space());
+            if (ret > 0) {
+                tail->bytesWritten(ret);
+                if (buffer_cb_(*block) != KMError::NOERR) {
+                    break;
+                }
+                continue;
+            } else if (0 == ret) {
+                break;
+            }
+            cleanup();
+            onError(KMError::SOCK_ERROR);
+            return;
+        }
         int ret = tcp_.receive(buf, sizeof(buf));
         if (ret > 0) {
             if (data_cb_(buf, ret) != KMError::NOERR) {
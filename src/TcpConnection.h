@@ -31,6 +31,7 @@ class TcpConnection
 public:
     using EventCallback = TcpSocket::EventCallback;
     using DataCallback = std::function<KMError(uint8_t*, size_t)>;
+    using BufferCallback = std::function<KMError(KMBuffer &)>;
 
     TcpConnection(const EventLoopPtr &loop);
 	virtual ~TcpConnection();
@@ -51,6 +52,12 @@ public:
     virtual void setDataCallback(DataCallback cb) { data_cb_ = std::move(cb); }
     virtual void setWriteCallback(EventCallback cb) { write_cb_ = std::move(cb); }
     virtual void setErrorCallback(EventCallback cb) { error_cb_ = std::move(cb); }
+    /*
+     * the data is received into reference counted blocks and delivered to cb instead
+     * of the data callback, the receiver can retain the slices of them without copy.
+     * set nullptr to switch back to the data callback
+     */
+    void setBufferCallback(BufferCallback cb) { buffer_cb_ = std::move(cb); }
 
     bool isServer() const { return isServer_; }
     bool isOpen() const { return tcp_.isReady(); }
@@ -93,6 +100,7 @@ private:
     bool                    isServer_{ false };
 
     DataCallback            data_cb_;
+    BufferCallback          buffer_cb_;
     EventCallback           write_cb_;
     EventCallback           error_cb_;
 };
@@ -128,6 +128,7 @@ TcpSocket::Impl& TcpSocket::Impl::operator= (Impl &&other)
         alpn_protos_ = std::move(other.alpn_protos_);
         ssl_server_name_ = std::move(other.ssl_server_name_);
         ssl_host_name_ = std::move(other.ssl_host_name_);
+        ssl_peer_ = std::move(other.ssl_peer_);
 #endif
         connect_cb_ = std::move(other.connect_cb_);
         read_cb_ = std::move(other.read_cb_);
@@ -187,6 +188,7 @@ KMError TcpSocket::Impl::connect(const std::string &host, uint16_t port, EventCa
     if (!kev::km_is_ip_address(host.c_str()) && sslEnabled()) {
         ssl_host_name_ = host;
     }
+    ssl_peer_ = host + ":" + std::to_string(port);
 #endif
     if (!socket_ && !createSocket()) {
         return KMError::INVALID_STATE;
@@ -368,14 +370,17 @@ KMError TcpSocket::Impl::startSslHandshake(SslRole ssl_role, EventCallback cb)
         if (!alpn_protos_.empty()) {
             ssl_handler_->setAlpnProtocols(alpn_protos_);
         }
-        if (!ssl_server_name_.empty()) {
-            ssl_handler_->setServerName(ssl_server_name_);
-        } else if (!ssl_host_name_.empty()) {
-            ssl_handler_->setServerName(ssl_host_name_);
+        auto const &server_name = !ssl_server_name_.empty() ? ssl_server_name_ : ssl_host_name_;
+        if (!server_name.empty()) {
+            ssl_handler_->setServerName(server_name);
         }
         if (!ssl_host_name_.empty() && (ssl_flags_ & SSL_VERIFY_HOST_NAME)) {
             ssl_handler_->setHostName(ssl_host_name_);
         }
+        if (!ssl_peer_.empty()) {
+            // certificate is not verified on resumption, so ssl flags are part of the key
+            ssl_handler_->setSessionKey(ssl_peer_ + "/" + server_name + "/" + std::to_string(ssl_flags_));
+        }
     }
 
     auto ssl_state = ssl_handler_->handshake();
@@ -120,6 +120,7 @@ private:
     AlpnProtos          alpn_protos_;
     std::string         ssl_server_name_;
     std::string         ssl_host_name_;
+    std::string         ssl_peer_; // host:port of connect, for session cache key
 #endif
     
     EventCallback       connect_cb_;
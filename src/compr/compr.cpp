@@ -15,7 +15,275 @@
 
 #include "compr.h"
 #include "compr_zlib.h"
+#include "compr_zstd.h"
+#include "compr_brotli.h"
 #include "libkev/src/util/util.h"
 
+#include <stdlib.h>
+#include <vector>
+
 using namespace kuma;
 
+namespace {
+    const size_t kMaxPooledBlocks = 64;
+    
+    class BlockPool
+    {
+    public:
+        ~BlockPool()
+        {
+            for (auto *block : blocks_) {
+                delete [] block;
+            }
+        }
+        
+        char* get(size_t size)
+        {
+            if (size == block_size_ && !blocks_.empty()) {
+                auto *block = blocks_.back();
+                blocks_.pop_back();
+                return block;
+            }
+            return new char[size];
+        }
+        
+        void put(char *block, size_t size)
+        {
+            if (block_size_ == 0) {
+                block_size_ = size;
+            }
+            if (size == block_size_ && blocks_.size() < kMaxPooledBlocks) {
+                blocks_.push_back(block);
+            } else {
+                delete [] block;
+            }
+        }
+        
+    private:
+        size_t block_size_ = 0;
+        std::vector<char*> blocks_;
+    };
+    
+    BlockPool& blockPool()
+    {
+        static thread_local BlockPool pool;
+        return pool;
+    }
+    
+    // a block is released to the pool of the thread that drops the last reference
+    struct BlockAllocator
+    {
+        using value_type = char;
+        
+        char* allocate(size_t n) { return blockPool().get(n); }
+        void deallocate(char *p, size_t n) { blockPool().put(p, n); }
+    };
+    
+    std::string trimSpaces(const std::string &str)
+    {
+        auto first = str.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            return "";
+        }
+        auto last = str.find_last_not_of(" \t");
+        return str.substr(first, last - first + 1);
+    }
+    
+    // parse the q parameter of a coding, such as "q=0.5", default is 1
+    double parseQValue(const std::string &params)
+    {
+        size_t pos = 0;
+        while (pos < params.size()) {
+            auto end = params.find(';', pos);
+            if (end == std::string::npos) {
+                end = params.size();
+            }
+            auto param = trimSpaces(params.substr(pos, end - pos));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+                return strtod(param.c_str() + 2, nullptr);
+            }
+            pos = end + 1;
+        }
+        return 1.0;
+    }
+}
+
+KMBuffer* kuma::getCompressionBlock(KMBuffer::Ptr &chain, KMBuffer *&tail)
+{
+    if (!tail && chain) {
+        for (auto it = chain->begin(); it != chain->end(); ++it) {
+            tail = const_cast<KMBuffer*>(&(*it));
+        }
+    }
+    if (tail && tail->space() > 0) {
+        return tail;
+    }
+    BlockAllocator a;
+    tail = new KMBuffer(kCompressionBlockSize, a);
+    if (chain) {
+        chain->append(tail);
+    } else {
+        chain.reset(tail);
+    }
+    return tail;
+}
+
+const std::vector<std::string>& kuma::getSupportedEncodings()
+{
+    static const std::vector<std::string> encodings {
+#ifdef KUMA_HAS_ZSTD
+        "zstd",
+#endif
+#ifdef KUMA_HAS_BROTLI
+        "br",
+#endif
+        "gzip",
+        "deflate"
+    };
+    return encodings;
+}
+
+const std::vector<std::string>& kuma::getSupportedTransferCodings()
+{
+    static const std::vector<std::string> encodings {
+        "gzip",
+        "deflate"
+    };
+    return encodings;
+}
+
+const std::string& kuma::getAcceptEncodings()
+{
+    static const std::string accept_encodings = [] {
+        std::string str;
+        for (auto &encoding : getSupportedEncodings()) {
+            if (!str.empty()) {
+                str += ", ";
+            }
+            str += encoding;
+        }
+        return str;
+    }();
+    return accept_encodings;
+}
+
+bool kuma::isEncodingSupported(const std::string &encoding)
+{
+    for (auto &e : getSupportedEncodings()) {
+        if (kev::is_equal(e, encoding)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string kuma::negotiateEncoding(const std::string &accept_encodings)
+{
+    return negotiateEncoding(accept_encodings, getSupportedEncodings());
+}
+
+std::string kuma::negotiateEncoding(const std::string &accept_encodings, const std::vector<std::string> &encodings)
+{
+    // q value of each supported coding, negative if it is not listed
+    std::vector<double> qvalues(encodings.size(), -1);
+    double wildcard_q = -1;
+    size_t pos = 0;
+    while (pos < accept_encodings.size()) {
+        auto end = accept_encodings.find(',', pos);
+        if (end == std::string::npos) {
+            end = accept_encodings.size();
+        }
+        auto token = accept_encodings.substr(pos, end - pos);
+        pos = end + 1;
+        double q = 1.0;
+        auto semi = token.find(';');
+        if (semi != std::string::npos) {
+            q = parseQValue(token.substr(semi + 1));
+            token.resize(semi);
+        }
+        token = trimSpaces(token);
+        if (token == "*") {
+            wildcard_q = q;
+            continue;
+        }
+        for (size_t i = 0; i < encodings.size(); ++i) {
+            if (kev::is_equal(token, encodings[i])) {
+                qvalues[i] = q;
+                break;
+            }
+        }
+    }
+    
+    std::string best;
+    double best_q = 0;
+    for (size_t i = 0; i < encodings.size(); ++i) {
+        auto q = qvalues[i] < 0 ? wildcard_q : qvalues[i];
+        if (q > best_q) {
+            best_q = q;
+            best = encodings[i];
+        }
+    }
+    return best;
+}
+
+std::unique_ptr<Compressor> kuma::createCompressor(const std::string &encoding, CompressionLevel level)
+{
+#ifdef KUMA_HAS_ZSTD
+    if (kev::is_equal(encoding, "zstd")) {
+        std::unique_ptr<ZStdCompressor> compr(new ZStdCompressor());
+        if (compr->init(level) != KMError::NOERR) {
+            return nullptr;
+        }
+        return compr;
+    }
+#endif
+#ifdef KUMA_HAS_BROTLI
+    if (kev::is_equal(encoding, "br")) {
+        std::unique_ptr<BrotliCompressor> compr(new BrotliCompressor());
+        if (compr->init(level) != KMError::NOERR) {
+            return nullptr;
+        }
+        return compr;
+    }
+#endif
+    if (kev::is_equal(encoding, "gzip") || kev::is_equal(encoding, "deflate")) {
+        std::unique_ptr<ZLibCompressor> compr(new ZLibCompressor());
+        compr->setFlushFlag(Z_NO_FLUSH);
+        if (compr->init(encoding, 15, level) != KMError::NOERR) {
+            return nullptr;
+        }
+        return compr;
+    }
+    return nullptr;
+}
+
+std::unique_ptr<Decompressor> kuma::createDecompressor(const std::string &encoding)
+{
+#ifdef KUMA_HAS_ZSTD
+    if (kev::is_equal(encoding, "zstd")) {
+        std::unique_ptr<ZStdDecompressor> decompr(new ZStdDecompressor());
+        if (decompr->init() != KMError::NOERR) {
+            return nullptr;
+        }
+        return decompr;
+    }
+#endif
+#ifdef KUMA_HAS_BROTLI
+    if (kev::is_equal(encoding, "br")) {
+        std::unique_ptr<BrotliDecompressor> decompr(new BrotliDecompressor());
+        if (decompr->init() != KMError::NOERR) {
+            return nullptr;
+        }
+        return decompr;
+    }
+#endif
+    if (kev::is_equal(encoding, "gzip") || kev::is_equal(encoding, "deflate")) {
+        std::unique_ptr<ZLibDecompressor> decompr(new ZLibDecompressor());
+        decompr->setFlushFlag(Z_SYNC_FLUSH);
+        if (decompr->init(encoding, 15) != KMError::NOERR) {
+            return nullptr;
+        }
+        return decompr;
+    }
+    return nullptr;
+}
@@ -18,28 +18,113 @@
 #include "kmdefs.h"
 #include "kmbuffer.h"
 
+#include <memory>
+#include <string>
 #include <vector>
 
 KUMA_NS_BEGIN
 
+/**
+ * the output of compressor and decompressor is a chain of fixed size blocks,
+ * free blocks are kept in a per thread pool
+ */
+const size_t kCompressionBlockSize = 16*1024;
+
+/**
+ * return tail if it has space, otherwise append a new block to chain and update tail,
+ * the chain is created if it is empty. tail is the last block of chain, it is looked
+ * up once if it is null, so keep it across the calls to avoid walking the chain
+ */
+KMBuffer* getCompressionBlock(KMBuffer::Ptr &chain, KMBuffer *&tail);
+
+enum class CompressionLevel {
+    NONE,       // no compression, the data is stored in the format of the coding
+    FAST,       // least CPU, used while the event loop is busy
+    DEFAULT,    // balance of ratio and CPU for the content compressed per response
+    BEST        // highest ratio, for the content compressed once and served many times
+};
+
+/**
+ * preset dictionary agreed out of band, it is shared by all the streams using it
+ */
+using CompressionDictionary = std::shared_ptr<const std::string>;
+
 class Compressor
 {
 public:
-    using DataBuffer = std::vector<uint8_t>;
-    
     virtual ~Compressor() {}
-    virtual KMError compress(const void *ibuf, size_t ilen, DataBuffer &obuf) = 0;
-    virtual KMError compress(const KMBuffer &ibuf, DataBuffer &obuf) = 0;
+    /**
+     * compress ibuf and append the output to obuf, null ibuf or 0 ilen finishes the stream
+     */
+    virtual KMError compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) = 0;
+    virtual KMError compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) = 0;
+    /**
+     * flush the pending output, so the data compressed so far can be decompressed
+     */
+    virtual KMError flush(KMBuffer::Ptr &obuf) = 0;
+    /**
+     * change the level of the following data, it takes effect immediately before
+     * the first compress, a codec that can't change the level in the middle of
+     * a stream applies it to the next stream
+     */
+    virtual KMError setLevel(CompressionLevel level) { return KMError::NOT_SUPPORTED; }
+    /**
+     * set before the first compress, the dictionary is loaded into every new
+     * stream, including the one created after releaseContext
+     */
+    virtual KMError setDictionary(CompressionDictionary dict) { return KMError::NOT_SUPPORTED; }
+    /**
+     * release the compression context while the stream is idle,
+     * a new context is created by next compress
+     */
+    virtual void releaseContext() {}
 };
 
 class Decompressor
 {
 public:
-    using DataBuffer = std::vector<uint8_t>;
-    
     virtual ~Decompressor() {}
-    virtual KMError decompress(const void *ibuf, size_t ilen, DataBuffer &obuf) = 0;
-    virtual KMError decompress(const KMBuffer &ibuf, DataBuffer &obuf) = 0;
+    virtual KMError decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) = 0;
+    virtual KMError decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) = 0;
+    /**
+     * the dictionary must be the one used by the compressor
+     */
+    virtual KMError setDictionary(CompressionDictionary dict) { return KMError::NOT_SUPPORTED; }
+    /**
+     * release the decompression context while the stream is idle,
+     * a new context is created by next decompress
+     */
+    virtual void releaseContext() {}
 };
 
+/**
+ * supported HTTP content codings in order of preference, used as Accept-Encoding
+ */
+const std::vector<std::string>& getSupportedEncodings();
+const std::string& getAcceptEncodings();
+bool isEncodingSupported(const std::string &encoding);
+/**
+ * supported transfer codings used with TE, zstd and br are registered as content codings only
+ */
+const std::vector<std::string>& getSupportedTransferCodings();
+
+/**
+ * pick the best supported content coding from an Accept-Encoding value,
+ * the highest q wins and ties are broken by the order of getAcceptEncodings,
+ * return empty string if none is acceptable
+ */
+std::string negotiateEncoding(const std::string &accept_encodings);
+/**
+ * same as above, but only the codings in encodings are considered,
+ * ties are broken by the order of encodings
+ */
+std::string negotiateEncoding(const std::string &accept_encodings, const std::vector<std::string> &encodings);
+
+/**
+ * create the compressor of an HTTP content coding, the output is buffered
+ * until flush or finish, return nullptr if the coding is not supported
+ */
+std::unique_ptr<Compressor> createCompressor(const std::string &encoding, CompressionLevel level = CompressionLevel::DEFAULT);
+std::unique_ptr<Decompressor> createDecompressor(const std::string &encoding);
+
 KUMA_NS_END
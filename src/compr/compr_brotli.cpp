@@ -0,0 +1,219 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef KUMA_HAS_BROTLI
+
+#include "compr_brotli.h"
+
+using namespace kuma;
+
+namespace {
+    int toBrotliQuality(CompressionLevel level)
+    {
+        switch (level) {
+            case CompressionLevel::NONE:
+                return BROTLI_MIN_QUALITY;
+            case CompressionLevel::FAST:
+                return 1;
+            case CompressionLevel::BEST:
+                return BROTLI_MAX_QUALITY;
+            default:
+                // quality above 5 costs too much CPU for dynamic content
+                return 5;
+        }
+    }
+}
+
+BrotliCompressor::BrotliCompressor()
+{
+    
+}
+
+BrotliCompressor::~BrotliCompressor()
+{
+    releaseContext();
+}
+
+KMError BrotliCompressor::init(CompressionLevel level, int window_bits)
+{
+    if (window_bits < BROTLI_MIN_WINDOW_BITS || window_bits > BROTLI_MAX_WINDOW_BITS) {
+        return KMError::INVALID_PARAM;
+    }
+    releaseContext();
+    c_quality = toBrotliQuality(level);
+    c_window_bits = window_bits;
+    return acquireContext();
+}
+
+KMError BrotliCompressor::acquireContext()
+{
+    if (c_state) {
+        return KMError::NOERR;
+    }
+    c_state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!c_state) {
+        return KMError::FAILED;
+    }
+    BrotliEncoderSetParameter(c_state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(c_quality));
+    BrotliEncoderSetParameter(c_state, BROTLI_PARAM_LGWIN, static_cast<uint32_t>(c_window_bits));
+    return KMError::NOERR;
+}
+
+KMError BrotliCompressor::setLevel(CompressionLevel level)
+{
+    c_quality = toBrotliQuality(level);
+    if (c_state) {
+        // it fails once the stream is started, then the quality applies to next stream
+        BrotliEncoderSetParameter(c_state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(c_quality));
+    }
+    return KMError::NOERR;
+}
+
+void BrotliCompressor::releaseContext()
+{
+    // brotli state cannot be reset, a new one is created by next compress
+    if (c_state) {
+        BrotliEncoderDestroyInstance(c_state);
+        c_state = nullptr;
+    }
+}
+
+KMError BrotliCompressor::compressToChain(const void *ibuf, size_t ilen, BrotliEncoderOperation op, KMBuffer::Ptr &obuf)
+{
+    auto err = acquireContext();
+    if (err != KMError::NOERR) {
+        return err;
+    }
+    size_t avail_in = ilen;
+    auto *next_in = static_cast<const uint8_t*>(ibuf);
+    bool done = false;
+    KMBuffer *tail = nullptr;
+    do {
+        auto *block = getCompressionBlock(obuf, tail);
+        size_t space = block->space();
+        size_t avail_out = space;
+        auto *next_out = static_cast<uint8_t*>(block->writePtr());
+        if (!BrotliEncoderCompressStream(c_state, op, &avail_in, &next_in, &avail_out, &next_out, nullptr)) {
+            return KMError::FAILED;
+        }
+        block->bytesWritten(space - avail_out);
+        done = avail_in == 0 && !BrotliEncoderHasMoreOutput(c_state);
+        if (op == BROTLI_OPERATION_FINISH) {
+            done = BrotliEncoderIsFinished(c_state);
+        }
+    } while (!done);
+    
+    return KMError::NOERR;
+}
+
+KMError BrotliCompressor::compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
+{
+    bool finish = !ibuf || ilen == 0;
+    return compressToChain(ibuf, ilen, finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS, obuf);
+}
+
+KMError BrotliCompressor::compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
+{
+    for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
+        if (it->length() > 0) {
+            auto ret = compressToChain(it->readPtr(), it->length(), BROTLI_OPERATION_PROCESS, obuf);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+    }
+    
+    return KMError::NOERR;
+}
+
+KMError BrotliCompressor::flush(KMBuffer::Ptr &obuf)
+{
+    return compressToChain(nullptr, 0, BROTLI_OPERATION_FLUSH, obuf);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+BrotliDecompressor::BrotliDecompressor()
+{
+    
+}
+
+BrotliDecompressor::~BrotliDecompressor()
+{
+    releaseContext();
+}
+
+KMError BrotliDecompressor::init()
+{
+    releaseContext();
+    return acquireContext();
+}
+
+KMError BrotliDecompressor::acquireContext()
+{
+    if (d_state) {
+        return KMError::NOERR;
+    }
+    d_state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    return d_state ? KMError::NOERR : KMError::FAILED;
+}
+
+void BrotliDecompressor::releaseContext()
+{
+    if (d_state) {
+        BrotliDecoderDestroyInstance(d_state);
+        d_state = nullptr;
+    }
+}
+
+KMError BrotliDecompressor::decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
+{
+    auto err = acquireContext();
+    if (err != KMError::NOERR) {
+        return err;
+    }
+    size_t avail_in = ilen;
+    auto *next_in = static_cast<const uint8_t*>(ibuf);
+    BrotliDecoderResult ret;
+    KMBuffer *tail = nullptr;
+    do {
+        auto *block = getCompressionBlock(obuf, tail);
+        size_t space = block->space();
+        size_t avail_out = space;
+        auto *next_out = static_cast<uint8_t*>(block->writePtr());
+        ret = BrotliDecoderDecompressStream(d_state, &avail_in, &next_in, &avail_out, &next_out, nullptr);
+        if (ret == BROTLI_DECODER_RESULT_ERROR) {
+            return KMError::FAILED;
+        }
+        block->bytesWritten(space - avail_out);
+    } while (ret == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+    
+    return KMError::NOERR;
+}
+
+KMError BrotliDecompressor::decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
+{
+    for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
+        if (it->length() > 0) {
+            auto ret = decompress(it->readPtr(), it->length(), obuf);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+    }
+    
+    return KMError::NOERR;
+}
+
+#endif // KUMA_HAS_BROTLI
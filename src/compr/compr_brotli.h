@@ -0,0 +1,72 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef KUMA_HAS_BROTLI
+
+#include "compr.h"
+#include <brotli/encode.h>
+#include <brotli/decode.h>
+
+KUMA_NS_BEGIN
+
+/**
+ * brotli content coding, the output is buffered until flush or finish
+ */
+class BrotliCompressor : public Compressor
+{
+public:
+    BrotliCompressor();
+    virtual ~BrotliCompressor();
+    
+    KMError init(CompressionLevel level = CompressionLevel::DEFAULT, int window_bits = BROTLI_DEFAULT_WINDOW);
+    KMError compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    KMError flush(KMBuffer::Ptr &obuf) override;
+    KMError setLevel(CompressionLevel level) override;
+    void releaseContext() override;
+    
+protected:
+    KMError compressToChain(const void *ibuf, size_t ilen, BrotliEncoderOperation op, KMBuffer::Ptr &obuf);
+    KMError acquireContext();
+    
+protected:
+    BrotliEncoderState* c_state = nullptr;
+    int                 c_quality = 5;
+    int                 c_window_bits = BROTLI_DEFAULT_WINDOW;
+};
+
+class BrotliDecompressor : public Decompressor
+{
+public:
+    BrotliDecompressor();
+    virtual ~BrotliDecompressor();
+    
+    KMError init();
+    KMError decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    void releaseContext() override;
+    
+protected:
+    KMError acquireContext();
+    
+protected:
+    BrotliDecoderState* d_state = nullptr;
+};
+
+KUMA_NS_END
+
+#endif // KUMA_HAS_BROTLI
@@ -0,0 +1,122 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "compr_policy.h"
+
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace kuma;
+
+namespace {
+    // entropy in bits per byte, compressed data is close to 8
+    const double kMaxCompressibleEntropy = 7.5;
+    
+    const auto kLagProbeInterval = std::chrono::milliseconds(100);
+    // a probe is regarded as lost if it doesn't run in time, e.g. the loop is stopped
+    const auto kLagProbeTimeout = std::chrono::seconds(5);
+    const int64_t kFastLevelLagMs = 20;
+    const int64_t kNoneLevelLagMs = 100;
+    
+    struct LagProbe
+    {
+        bool pending = false;
+        std::chrono::steady_clock::time_point last_probe;
+        int64_t lag_ms = 0; // smoothed
+    };
+    
+    class EntropySampler
+    {
+    public:
+        void update(const void *data, size_t len)
+        {
+            auto *p = static_cast<const uint8_t*>(data);
+            len = std::min(len, kCompressionSampleSize - total_);
+            for (size_t i = 0; i < len; ++i) {
+                ++counts_[p[i]];
+            }
+            total_ += len;
+        }
+        
+        bool full() const { return total_ >= kCompressionSampleSize; }
+        
+        double entropy() const
+        {
+            double e = 0;
+            for (auto c : counts_) {
+                if (c > 0) {
+                    double p = double(c) / total_;
+                    e -= p * log2(p);
+                }
+            }
+            return e;
+        }
+        
+    private:
+        size_t counts_[256] = {0};
+        size_t total_ = 0;
+    };
+}
+
+bool kuma::isCompressible(const void *data, size_t len)
+{
+    if (!data || len == 0) {
+        return true;
+    }
+    EntropySampler sampler;
+    sampler.update(data, len);
+    return sampler.entropy() <= kMaxCompressibleEntropy;
+}
+
+bool kuma::isCompressible(const KMBuffer &buf)
+{
+    EntropySampler sampler;
+    for (auto it = buf.begin(); it != buf.end() && !sampler.full(); ++it) {
+        sampler.update(it->readPtr(), it->length());
+    }
+    return sampler.entropy() <= kMaxCompressibleEntropy;
+}
+
+CompressionLevel kuma::getAdaptiveLevel(const EventLoopPtr &loop)
+{
+    if (!loop || !loop->inSameThread()) {
+        return CompressionLevel::DEFAULT;
+    }
+    // the probe task runs on this thread, so no lock is needed
+    static thread_local LagProbe probe;
+    auto now = std::chrono::steady_clock::now();
+    if (probe.pending && now - probe.last_probe >= kLagProbeTimeout) {
+        probe.pending = false;
+    }
+    if (!probe.pending && now - probe.last_probe >= kLagProbeInterval) {
+        auto *p = &probe;
+        auto ret = loop->post([p, now] {
+            auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - now).count();
+            p->lag_ms = (p->lag_ms * 3 + lag) / 4;
+            p->pending = false;
+        });
+        probe.pending = ret == kev::Result::OK;
+        probe.last_probe = now;
+    }
+    
+    if (probe.lag_ms >= kNoneLevelLagMs) {
+        return CompressionLevel::NONE;
+    } else if (probe.lag_ms >= kFastLevelLagMs) {
+        return CompressionLevel::FAST;
+    }
+    return CompressionLevel::DEFAULT;
+}
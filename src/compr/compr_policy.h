@@ -0,0 +1,43 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "compr.h"
+#include "EventLoopImpl.h"
+
+KUMA_NS_BEGIN
+
+/**
+ * the bytes sampled from the head of a body or message to estimate its compressibility
+ */
+const size_t kCompressionSampleSize = 4*1024;
+
+/**
+ * estimate by the byte entropy of the first kCompressionSampleSize bytes,
+ * the data of high entropy, such as compressed or encrypted data, is not
+ * worth compressing
+ */
+bool isCompressible(const void *data, size_t len);
+bool isCompressible(const KMBuffer &buf);
+
+/**
+ * the compression level of the data sent on loop, stepped down from DEFAULT
+ * while the loop lags. the lag is measured by a task posted to the loop, the
+ * loop must be the one of current thread, otherwise DEFAULT is returned
+ */
+CompressionLevel getAdaptiveLevel(const EventLoopPtr &loop);
+
+KUMA_NS_END
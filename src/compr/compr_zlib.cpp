@@ -16,8 +16,84 @@
 #include "compr_zlib.h"
 #include "libkev/src/util/util.h"
 
+#include <algorithm>
+
 using namespace kuma;
 
+namespace {
+    const size_t kMaxPooledStreams = 32;
+    
+    // idle z_streams are pooled per thread, that is per event loop, keyed by
+    // window bits and level, a stream is reset before it is returned to the pool
+    class ZStreamPool
+    {
+    public:
+        using EndFunc = void(*)(z_stream*);
+        
+        explicit ZStreamPool(EndFunc end) : end_(end) {}
+        ~ZStreamPool()
+        {
+            for (auto &s : streams_) {
+                end_(s.second);
+                delete s.second;
+            }
+        }
+        
+        z_stream* get(int window_bits, int level = 0)
+        {
+            auto key = std::make_pair(window_bits, level);
+            for (auto it = streams_.rbegin(); it != streams_.rend(); ++it) {
+                if (it->first == key) {
+                    auto *strm = it->second;
+                    streams_.erase(std::next(it).base());
+                    return strm;
+                }
+            }
+            return nullptr;
+        }
+        
+        void put(z_stream *strm, int window_bits, int level = 0)
+        {
+            if (streams_.size() < kMaxPooledStreams) {
+                streams_.emplace_back(std::make_pair(window_bits, level), strm);
+            } else {
+                end_(strm);
+                delete strm;
+            }
+        }
+        
+    private:
+        EndFunc end_;
+        std::vector<std::pair<std::pair<int, int>, z_stream*>> streams_;
+    };
+    
+    ZStreamPool& deflatePool()
+    {
+        static thread_local ZStreamPool pool([] (z_stream *strm) { deflateEnd(strm); });
+        return pool;
+    }
+    
+    ZStreamPool& inflatePool()
+    {
+        static thread_local ZStreamPool pool([] (z_stream *strm) { inflateEnd(strm); });
+        return pool;
+    }
+    
+    int toZLibLevel(CompressionLevel level)
+    {
+        switch (level) {
+            case CompressionLevel::NONE:
+                return Z_NO_COMPRESSION;
+            case CompressionLevel::FAST:
+                return Z_BEST_SPEED;
+            case CompressionLevel::BEST:
+                return Z_BEST_COMPRESSION;
+            default:
+                return Z_DEFAULT_COMPRESSION;
+        }
+    }
+}
+
 ZLibCompressor::ZLibCompressor()
 {
     
@@ -25,21 +101,17 @@ ZLibCompressor::ZLibCompressor()
 
 ZLibCompressor::~ZLibCompressor()
 {
-    if (initizlized_) {
-        deflateEnd(&c_stream);
-        initizlized_ = false;
-    }
+    releaseContext();
+    initizlized_ = false;
 }
 
-KMError ZLibCompressor::init(const std::string &type, int max_window_bits)
+KMError ZLibCompressor::init(const std::string &type, int max_window_bits, CompressionLevel level)
 {
     if (max_window_bits > 15 || max_window_bits < 8) {
         return KMError::INVALID_PARAM;
     }
-    if (initizlized_) {
-        deflateEnd(&c_stream);
-        initizlized_ = false;
-    }
+    releaseContext();
+    initizlized_ = false;
     if (kev::is_equal(type, "gzip")) {
         c_max_window_bits = max_window_bits + 16;
     } else if (kev::is_equal(type, "raw-deflate")) {
@@ -49,17 +121,63 @@ KMError ZLibCompressor::init(const std::string &type, int max_window_bits)
     } else {
         return KMError::INVALID_PARAM;
     }
-    auto ret = deflateInit2(&c_stream,
-                            Z_DEFAULT_COMPRESSION,
-                            Z_DEFLATED,
-                            c_max_window_bits,
-                            c_memory_level,
-                            Z_DEFAULT_STRATEGY);
-    if (ret != Z_OK) {
-        return KMError::FAILED;
-    }
+    // scale the hash table with the window, 15 bits window uses the default level 8
+    c_memory_level = std::min(8, max_window_bits - 7);
+    c_target_level = toZLibLevel(level);
     initizlized_ = true;
-    return KMError::NOERR;
+    return acquireStream();
+}
+
+KMError ZLibCompressor::acquireStream()
+{
+    if (c_stream) {
+        return KMError::NOERR;
+    }
+    if (!initizlized_) {
+        return KMError::INVALID_STATE;
+    }
+    c_level = c_target_level;
+    c_stream = deflatePool().get(c_max_window_bits, c_level);
+    if (!c_stream) {
+        c_stream = new z_stream();
+        auto ret = deflateInit2(c_stream,
+                                c_level,
+                                Z_DEFLATED,
+                                c_max_window_bits,
+                                c_memory_level,
+                                Z_DEFAULT_STRATEGY);
+        if (ret != Z_OK) {
+            delete c_stream;
+            c_stream = nullptr;
+            return KMError::FAILED;
+        }
+    }
+    return loadDictionary();
+}
+
+KMError ZLibCompressor::loadDictionary()
+{
+    if (!c_dictionary) {
+        return KMError::NOERR;
+    }
+    // the stream is new or reset, deflate only keeps the last window size bytes
+    auto ret = deflateSetDictionary(c_stream,
+                                    (const Bytef*)c_dictionary->data(),
+                                    static_cast<uInt>(c_dictionary->size()));
+    return ret == Z_OK ? KMError::NOERR : KMError::FAILED;
+}
+
+void ZLibCompressor::releaseContext()
+{
+    if (c_stream) {
+        if (deflateReset(c_stream) == Z_OK) {
+            deflatePool().put(c_stream, c_max_window_bits, c_level);
+        } else {
+            deflateEnd(c_stream);
+            delete c_stream;
+        }
+        c_stream = nullptr;
+    }
 }
 
 void ZLibCompressor::setFlushFlag(int flush)
@@ -67,67 +185,91 @@ void ZLibCompressor::setFlushFlag(int flush)
     c_flush = flush;
 }
 
-KMError ZLibCompressor::compress2(const void *ibuf, size_t ilen, DataBuffer &obuf)
+KMError ZLibCompressor::setLevel(CompressionLevel level)
 {
-    uint8_t cbuf[4096];
-    c_stream.avail_in = static_cast<uInt>(ilen);
-    c_stream.next_in = const_cast<Bytef *>((const Bytef*)ibuf);
-    
+    c_target_level = toZLibLevel(level);
+    return KMError::NOERR;
+}
+
+KMError ZLibCompressor::setDictionary(CompressionDictionary dict)
+{
+    if (c_max_window_bits > 15) { // gzip has no preset dictionary
+        return KMError::NOT_SUPPORTED;
+    }
+    if (dict && !dict->empty()) {
+        c_dictionary = std::move(dict);
+    } else {
+        c_dictionary.reset();
+    }
+    // the dictionary is loaded into the stream acquired by next compress
+    releaseContext();
+    return KMError::NOERR;
+}
+
+KMError ZLibCompressor::applyLevel(KMBuffer::Ptr &obuf, KMBuffer *&tail)
+{
+    // deflateParams compresses the pending data with the old level first
+    c_stream->avail_in = 0;
+    auto ret = Z_OK;
     do {
-        c_stream.avail_out = sizeof(cbuf);
-        c_stream.next_out = cbuf;
-        auto ret = deflate(&c_stream, c_flush);
-        if (ret < 0) {
-            return KMError::FAILED;
-        }
-        auto clen = sizeof(cbuf) - c_stream.avail_out;
-        obuf.insert(obuf.end(), cbuf, cbuf + clen);
-    } while (c_stream.avail_out == 0);
+        auto *block = getCompressionBlock(obuf, tail);
+        auto space = block->space();
+        c_stream->avail_out = static_cast<uInt>(space);
+        c_stream->next_out = static_cast<Bytef *>(block->writePtr());
+        ret = deflateParams(c_stream, c_target_level, Z_DEFAULT_STRATEGY);
+        block->bytesWritten(space - c_stream->avail_out);
+    } while (ret == Z_BUF_ERROR && c_stream->avail_out == 0);
     
+    if (ret == Z_OK) {
+        c_level = c_target_level;
+    } else if (ret != Z_BUF_ERROR) {
+        return KMError::FAILED;
+    } // else try again with next data
     return KMError::NOERR;
 }
 
-KMError ZLibCompressor::compress(const void *ibuf, size_t ilen, DataBuffer &obuf)
+KMError ZLibCompressor::deflateToChain(const void *ibuf, size_t ilen, int flush, KMBuffer::Ptr &obuf)
 {
-    bool finish = !ibuf || ilen == 0;
-    
-    size_t ioffset {0};
-    uint8_t cbuf[300];
+    auto err = acquireStream();
+    if (err != KMError::NOERR) {
+        return err;
+    }
+    KMBuffer *tail = nullptr;
+    if (c_level != c_target_level) {
+        err = applyLevel(obuf, tail);
+        if (err != KMError::NOERR) {
+            return err;
+        }
+    }
+    c_stream->avail_in = static_cast<uInt>(ilen);
+    c_stream->next_in = const_cast<Bytef *>((const Bytef*)ibuf);
     
-    int flush = c_flush;
-    auto iavail = ilen - ioffset;
     do {
-        if (iavail == 0 && finish) {
-            flush = Z_FINISH;
+        auto *block = getCompressionBlock(obuf, tail);
+        auto space = block->space();
+        c_stream->avail_out = static_cast<uInt>(space);
+        c_stream->next_out = static_cast<Bytef *>(block->writePtr());
+        auto ret = deflate(c_stream, flush);
+        if (ret < 0 && ret != Z_BUF_ERROR) {
+            return KMError::FAILED;
         }
-        
-        c_stream.avail_in = static_cast<uInt>(iavail);
-        c_stream.next_in = const_cast<Bytef *>((const Bytef*)ibuf + ioffset);
-        
-        do {
-            c_stream.avail_out = sizeof(cbuf);
-            c_stream.next_out = cbuf;
-            auto ret = deflate(&c_stream, flush);
-            if (ret < 0) {
-                return KMError::FAILED;
-            }
-            auto clen = sizeof(cbuf) - c_stream.avail_out;
-            obuf.insert(obuf.end(), cbuf, cbuf + clen);
-        } while (c_stream.avail_out == 0);
-        
-        ioffset += iavail - c_stream.avail_in;
-        iavail = ilen - ioffset;
-    } while (iavail > 0);
+        block->bytesWritten(space - c_stream->avail_out);
+    } while (c_stream->avail_out == 0);
     
     return KMError::NOERR;
 }
 
-KMError ZLibCompressor::compress(const KMBuffer &ibuf, DataBuffer &obuf)
+KMError ZLibCompressor::compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
+{
+    bool finish = !ibuf || ilen == 0;
+    return deflateToChain(ibuf, ilen, finish ? Z_FINISH : c_flush, obuf);
+}
+
+KMError ZLibCompressor::compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
 {
     for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
         if (it->length() > 0) {
-            auto *cbuf = static_cast<uint8_t *>(it->readPtr());
-            auto ret = compress(cbuf, it->length(), obuf);
+            auto ret = deflateToChain(it->readPtr(), it->length(), c_flush, obuf);
             if (ret != KMError::NOERR) {
                 return ret;
             }
@@ -137,6 +279,11 @@ KMError ZLibCompressor::compress(const KMBuffer &ibuf, DataBuffer &obuf)
     return KMError::NOERR;
 }
 
+KMError ZLibCompressor::flush(KMBuffer::Ptr &obuf)
+{
+    return deflateToChain(nullptr, 0, Z_SYNC_FLUSH, obuf);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 ZLibDecompressor::ZLibDecompressor()
 {
@@ -145,10 +292,8 @@ ZLibDecompressor::ZLibDecompressor()
 
 ZLibDecompressor::~ZLibDecompressor()
 {
-    if (initizlized_) {
-        inflateEnd(&d_stream);
-        initizlized_ = false;
-    }
+    releaseContext();
+    initizlized_ = false;
 }
 
 KMError ZLibDecompressor::init(const std::string &type, int max_window_bits)
@@ -156,10 +301,8 @@ KMError ZLibDecompressor::init(const std::string &type, int max_window_bits)
     if (max_window_bits > 15 || max_window_bits < 8) {
         return KMError::INVALID_PARAM;
     }
-    if (initizlized_) {
-        inflateEnd(&d_stream);
-        initizlized_ = false;
-    }
+    releaseContext();
+    initizlized_ = false;
     if (kev::is_equal(type, "gzip")) {
         d_max_window_bits = max_window_bits + 16;
     } else if (kev::is_equal(type, "raw-deflate")) {
@@ -169,45 +312,112 @@ KMError ZLibDecompressor::init(const std::string &type, int max_window_bits)
     } else {
         return KMError::INVALID_PARAM;
     }
-    auto ret = inflateInit2(&d_stream, d_max_window_bits);
-    if (ret != Z_OK) {
+    initizlized_ = true;
+    return acquireStream();
+}
+
+KMError ZLibDecompressor::acquireStream()
+{
+    if (d_stream) {
+        return KMError::NOERR;
+    }
+    if (!initizlized_) {
+        return KMError::INVALID_STATE;
+    }
+    d_stream = inflatePool().get(d_max_window_bits);
+    if (!d_stream) {
+        d_stream = new z_stream();
+        auto ret = inflateInit2(d_stream, d_max_window_bits);
+        if (ret != Z_OK) {
+            delete d_stream;
+            d_stream = nullptr;
+            return KMError::FAILED;
+        }
+    }
+    if (d_max_window_bits < 0 && d_dictionary) {
+        // raw deflate has no header, the dictionary is loaded before inflating,
+        // the zlib format asks for it by Z_NEED_DICT
+        return loadDictionary();
+    }
+    return KMError::NOERR;
+}
+
+KMError ZLibDecompressor::loadDictionary()
+{
+    if (!d_dictionary) {
         return KMError::FAILED;
     }
-    initizlized_ = true;
+    auto ret = inflateSetDictionary(d_stream,
+                                    (const Bytef*)d_dictionary->data(),
+                                    static_cast<uInt>(d_dictionary->size()));
+    return ret == Z_OK ? KMError::NOERR : KMError::FAILED;
+}
+
+KMError ZLibDecompressor::setDictionary(CompressionDictionary dict)
+{
+    if (d_max_window_bits > 15) { // gzip has no preset dictionary
+        return KMError::NOT_SUPPORTED;
+    }
+    if (dict && !dict->empty()) {
+        d_dictionary = std::move(dict);
+    } else {
+        d_dictionary.reset();
+    }
+    releaseContext();
     return KMError::NOERR;
 }
 
+void ZLibDecompressor::releaseContext()
+{
+    if (d_stream) {
+        if (inflateReset(d_stream) == Z_OK) {
+            inflatePool().put(d_stream, d_max_window_bits);
+        } else {
+            inflateEnd(d_stream);
+            delete d_stream;
+        }
+        d_stream = nullptr;
+    }
+}
+
 void ZLibDecompressor::setFlushFlag(int flush)
 {
     d_flush = flush;
 }
 
-KMError ZLibDecompressor::decompress(const void *ibuf, size_t ilen, DataBuffer &obuf)
+KMError ZLibDecompressor::decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
 {
-    uint8_t dbuf[300];
-    d_stream.avail_in = static_cast<uInt>(ilen);
-    d_stream.next_in = const_cast<Bytef *>((const Bytef*)ibuf);
+    auto err = acquireStream();
+    if (err != KMError::NOERR) {
+        return err;
+    }
+    d_stream->avail_in = static_cast<uInt>(ilen);
+    d_stream->next_in = const_cast<Bytef *>((const Bytef*)ibuf);
     
+    KMBuffer *tail = nullptr;
     do {
-        d_stream.avail_out = sizeof(dbuf);
-        d_stream.next_out = dbuf;
-        auto ret = inflate(&d_stream, d_flush);
-        if (ret != Z_OK && ret != Z_STREAM_END) {
+        auto *block = getCompressionBlock(obuf, tail);
+        auto space = block->space();
+        d_stream->avail_out = static_cast<uInt>(space);
+        d_stream->next_out = static_cast<Bytef *>(block->writePtr());
+        auto ret = inflate(d_stream, d_flush);
+        if (ret == Z_NEED_DICT && loadDictionary() == KMError::NOERR) {
+            ret = inflate(d_stream, d_flush);
+        }
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
             return KMError::FAILED;
         }
-        auto dlen = sizeof(dbuf) - d_stream.avail_out;
-        obuf.insert(obuf.end(), dbuf, dbuf + dlen);
-    } while (d_stream.avail_out == 0);
+        block->bytesWritten(space - d_stream->avail_out);
+    } while (d_stream->avail_out == 0);
     
     return KMError::NOERR;
 }
 
-KMError ZLibDecompressor::decompress(const KMBuffer &ibuf, DataBuffer &obuf)
+KMError ZLibDecompressor::decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
 {
     for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
         if (it->length() > 0) {
-            auto *dbuf = static_cast<uint8_t *>(it->readPtr());
-            auto ret = decompress(dbuf, it->length(), obuf);
+            auto ret = decompress(it->readPtr(), it->length(), obuf);
             if (ret != KMError::NOERR) {
                 return ret;
             }
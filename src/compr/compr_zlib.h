@@ -28,20 +28,30 @@ public:
     ZLibCompressor();
     virtual ~ZLibCompressor();
     
-    KMError init(const std::string &type, int max_window_bits);
+    KMError init(const std::string &type, int max_window_bits, CompressionLevel level = CompressionLevel::DEFAULT);
     void setFlushFlag(int flush);
-    KMError compress(const void *ibuf, size_t ilen, DataBuffer &obuf) override;
-    KMError compress(const KMBuffer &ibuf, DataBuffer &obuf) override;
+    KMError compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    KMError flush(KMBuffer::Ptr &obuf) override;
+    KMError setLevel(CompressionLevel level) override;
+    KMError setDictionary(CompressionDictionary dict) override;
+    void releaseContext() override;
     
 protected:
-    KMError compress2(const void *ibuf, size_t ilen, DataBuffer &obuf);
+    KMError deflateToChain(const void *ibuf, size_t ilen, int flush, KMBuffer::Ptr &obuf);
+    KMError applyLevel(KMBuffer::Ptr &obuf, KMBuffer *&tail);
+    KMError acquireStream();
+    KMError loadDictionary();
     
 protected:
     bool        initizlized_ = false;
-    z_stream    c_stream {0};
+    z_stream*   c_stream = nullptr;
     int         c_flush = Z_SYNC_FLUSH;
     int         c_max_window_bits = 15;
     int         c_memory_level = 8;
+    int         c_level = Z_DEFAULT_COMPRESSION; // level of c_stream
+    int         c_target_level = Z_DEFAULT_COMPRESSION;
+    CompressionDictionary c_dictionary;
 };
 
 class ZLibDecompressor : public Decompressor
@@ -52,14 +62,21 @@ public:
     
     KMError init(const std::string &type, int max_window_bits);
     void setFlushFlag(int flush);
-    KMError decompress(const void *ibuf, size_t ilen, DataBuffer &obuf) override;
-    KMError decompress(const KMBuffer &ibuf, DataBuffer &obuf) override;
+    KMError decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    KMError setDictionary(CompressionDictionary dict) override;
+    void releaseContext() override;
+    
+protected:
+    KMError acquireStream();
+    KMError loadDictionary();
     
 protected:
     bool        initizlized_ = false;
-    z_stream    d_stream {0};
+    z_stream*   d_stream = nullptr;
     int         d_flush = Z_SYNC_FLUSH;
     int         d_max_window_bits = 15;
+    CompressionDictionary d_dictionary;
 };
 
 KUMA_NS_END
@@ -0,0 +1,242 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef KUMA_HAS_ZSTD
+
+#include "compr_zstd.h"
+
+using namespace kuma;
+
+namespace {
+    // RFC 8878, 3.1.1.1.2, decoder needs no more than 8 MB window
+    const int kZStdMaxWindowLog = 23;
+    
+    int toZStdLevel(CompressionLevel level)
+    {
+        switch (level) {
+            case CompressionLevel::NONE:
+                return ZSTD_minCLevel();
+            case CompressionLevel::FAST:
+                return 1;
+            case CompressionLevel::BEST:
+                return 19;
+            default:
+                return 3;
+        }
+    }
+}
+
+ZStdCompressor::ZStdCompressor()
+{
+    
+}
+
+ZStdCompressor::~ZStdCompressor()
+{
+    if (c_ctx) {
+        ZSTD_freeCCtx(c_ctx);
+        c_ctx = nullptr;
+    }
+}
+
+KMError ZStdCompressor::init(CompressionLevel level)
+{
+    c_level = toZStdLevel(level);
+    releaseContext();
+    return acquireContext();
+}
+
+KMError ZStdCompressor::setLevel(CompressionLevel level)
+{
+    // the parameters can only be changed between frames
+    c_level = toZStdLevel(level);
+    if (c_ctx && !c_in_frame) {
+        auto ret = ZSTD_CCtx_setParameter(c_ctx, ZSTD_c_compressionLevel, c_level);
+        if (ZSTD_isError(ret)) {
+            return KMError::FAILED;
+        }
+    }
+    return KMError::NOERR;
+}
+
+KMError ZStdCompressor::acquireContext()
+{
+    if (!c_ctx) {
+        c_ctx = ZSTD_createCCtx();
+        if (!c_ctx) {
+            return KMError::FAILED;
+        }
+    }
+    auto ret = ZSTD_CCtx_setParameter(c_ctx, ZSTD_c_compressionLevel, c_level);
+    if (ZSTD_isError(ret)) {
+        return KMError::FAILED;
+    }
+    return KMError::NOERR;
+}
+
+void ZStdCompressor::releaseContext()
+{
+    if (c_ctx) {
+        // drop the current frame, the context and its parameters are kept for reuse
+        ZSTD_CCtx_reset(c_ctx, ZSTD_reset_session_only);
+        ZSTD_CCtx_setParameter(c_ctx, ZSTD_c_compressionLevel, c_level);
+        c_in_frame = false;
+    }
+}
+
+KMError ZStdCompressor::compressToChain(const void *ibuf, size_t ilen, ZSTD_EndDirective mode, KMBuffer::Ptr &obuf)
+{
+    if (!c_ctx) {
+        auto err = acquireContext();
+        if (err != KMError::NOERR) {
+            return err;
+        }
+    }
+    if (!c_in_frame) {
+        // apply the level changed in the last frame
+        auto ret = ZSTD_CCtx_setParameter(c_ctx, ZSTD_c_compressionLevel, c_level);
+        if (ZSTD_isError(ret)) {
+            return KMError::FAILED;
+        }
+    }
+    c_in_frame = mode != ZSTD_e_end;
+    ZSTD_inBuffer input = { ibuf, ilen, 0 };
+    bool done = false;
+    KMBuffer *tail = nullptr;
+    do {
+        auto *block = getCompressionBlock(obuf, tail);
+        ZSTD_outBuffer output = { block->writePtr(), block->space(), 0 };
+        auto ret = ZSTD_compressStream2(c_ctx, &output, &input, mode);
+        if (ZSTD_isError(ret)) {
+            return KMError::FAILED;
+        }
+        block->bytesWritten(output.pos);
+        // ZSTD_e_continue is done when input is consumed,
+        // flush and end are done when nothing is left in the context
+        done = mode == ZSTD_e_continue ? input.pos == input.size : ret == 0;
+    } while (!done);
+    
+    return KMError::NOERR;
+}
+
+KMError ZStdCompressor::compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
+{
+    bool finish = !ibuf || ilen == 0;
+    return compressToChain(ibuf, ilen, finish ? ZSTD_e_end : ZSTD_e_continue, obuf);
+}
+
+KMError ZStdCompressor::compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
+{
+    for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
+        if (it->length() > 0) {
+            auto ret = compressToChain(it->readPtr(), it->length(), ZSTD_e_continue, obuf);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+    }
+    
+    return KMError::NOERR;
+}
+
+KMError ZStdCompressor::flush(KMBuffer::Ptr &obuf)
+{
+    return compressToChain(nullptr, 0, ZSTD_e_flush, obuf);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+ZStdDecompressor::ZStdDecompressor()
+{
+    
+}
+
+ZStdDecompressor::~ZStdDecompressor()
+{
+    if (d_ctx) {
+        ZSTD_freeDCtx(d_ctx);
+        d_ctx = nullptr;
+    }
+}
+
+KMError ZStdDecompressor::init()
+{
+    releaseContext();
+    return acquireContext();
+}
+
+KMError ZStdDecompressor::acquireContext()
+{
+    if (!d_ctx) {
+        d_ctx = ZSTD_createDCtx();
+        if (!d_ctx) {
+            return KMError::FAILED;
+        }
+        // the window is allocated by the size declared in frame, limit it against malicious peers
+        auto ret = ZSTD_DCtx_setParameter(d_ctx, ZSTD_d_windowLogMax, kZStdMaxWindowLog);
+        if (ZSTD_isError(ret)) {
+            ZSTD_freeDCtx(d_ctx);
+            d_ctx = nullptr;
+            return KMError::FAILED;
+        }
+    }
+    return KMError::NOERR;
+}
+
+void ZStdDecompressor::releaseContext()
+{
+    if (d_ctx) {
+        ZSTD_DCtx_reset(d_ctx, ZSTD_reset_session_only);
+    }
+}
+
+KMError ZStdDecompressor::decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf)
+{
+    auto err = acquireContext();
+    if (err != KMError::NOERR) {
+        return err;
+    }
+    ZSTD_inBuffer input = { ibuf, ilen, 0 };
+    bool full = false;
+    KMBuffer *tail = nullptr;
+    do {
+        auto *block = getCompressionBlock(obuf, tail);
+        ZSTD_outBuffer output = { block->writePtr(), block->space(), 0 };
+        auto ret = ZSTD_decompressStream(d_ctx, &output, &input);
+        if (ZSTD_isError(ret)) {
+            return KMError::FAILED;
+        }
+        block->bytesWritten(output.pos);
+        // the decoder may hold more output when the block is full
+        full = output.pos == output.size;
+    } while (input.pos < input.size || full);
+    
+    return KMError::NOERR;
+}
+
+KMError ZStdDecompressor::decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf)
+{
+    for (auto it = ibuf.begin(); it != ibuf.end(); ++it) {
+        if (it->length() > 0) {
+            auto ret = decompress(it->readPtr(), it->length(), obuf);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+    }
+    
+    return KMError::NOERR;
+}
+
+#endif // KUMA_HAS_ZSTD
@@ -0,0 +1,71 @@
+/* Copyright (c) 2014 - 2019, Fengping Bao <jamol@live.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#ifdef KUMA_HAS_ZSTD
+
+#include "compr.h"
+#include <zstd.h>
+
+KUMA_NS_BEGIN
+
+/**
+ * zstd content coding, the output is buffered until flush or finish
+ */
+class ZStdCompressor : public Compressor
+{
+public:
+    ZStdCompressor();
+    virtual ~ZStdCompressor();
+    
+    KMError init(CompressionLevel level = CompressionLevel::DEFAULT);
+    KMError compress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError compress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    KMError flush(KMBuffer::Ptr &obuf) override;
+    KMError setLevel(CompressionLevel level) override;
+    void releaseContext() override;
+    
+protected:
+    KMError compressToChain(const void *ibuf, size_t ilen, ZSTD_EndDirective mode, KMBuffer::Ptr &obuf);
+    KMError acquireContext();
+    
+protected:
+    ZSTD_CCtx*  c_ctx = nullptr;
+    int         c_level = 3;
+    bool        c_in_frame = false;
+};
+
+class ZStdDecompressor : public Decompressor
+{
+public:
+    ZStdDecompressor();
+    virtual ~ZStdDecompressor();
+    
+    KMError init();
+    KMError decompress(const void *ibuf, size_t ilen, KMBuffer::Ptr &obuf) override;
+    KMError decompress(const KMBuffer &ibuf, KMBuffer::Ptr &obuf) override;
+    void releaseContext() override;
+    
+protected:
+    KMError acquireContext();
+    
+protected:
+    ZSTD_DCtx*  d_ctx = nullptr;
+};
+
+KUMA_NS_END
+
+#endif // KUMA_HAS_ZSTD
@@ -175,6 +175,9 @@ KMError H1xStream::sendHeaders(const std::string &headers)
         if (outgoing_message_.isComplete()) {
             if (tcp_conn_.isServer()) {
                 is_stream_upgraded_ = outgoing_message_.isUpgradeHeader();
+                if (is_stream_upgraded_) {
+                    onStreamUpgraded();
+                }
             }
             if (tcp_conn_.sendBufferEmpty()) {
                 if (tcp_conn_.isServer()) {
@@ -341,10 +344,25 @@ void H1xStream::onIncomingComplete()
 {
     if (!tcp_conn_.isServer()) {
         is_stream_upgraded_ = incoming_parser_.getStatusCode() == 101 && incoming_parser_.isUpgradeHeader();
+        if (is_stream_upgraded_) {
+            onStreamUpgraded();
+        }
     }
     if (incoming_complete_cb_) incoming_complete_cb_();
 }
 
+void H1xStream::onStreamUpgraded()
+{
+    // the upgraded stream bypasses the HTTP parser and receives into reference
+    // counted blocks, so the receiver can retain the data without copy
+    tcp_conn_.setBufferCallback([this] (KMBuffer &buf) {
+        DESTROY_DETECTOR_SETUP();
+        onStreamData(buf);
+        DESTROY_DETECTOR_CHECK(KMError::DESTROYED);
+        return KMError::NOERR;
+    });
+}
+
 void H1xStream::onStreamError(KMError err)
 {
     if(error_cb_) error_cb_(err);
@@ -353,6 +371,7 @@ void H1xStream::onStreamError(KMError err)
 void H1xStream::reset()
 {
     tcp_conn_.reset();
+    tcp_conn_.setBufferCallback(nullptr);
     outgoing_message_.reset();
     wait_outgoing_complete_ = false;
     incoming_parser_.reset();
@@ -118,6 +118,7 @@ protected:
     void onStreamData(KMBuffer &buf);
     void onOutgoingComplete();
     void onIncomingComplete();
+    void onStreamUpgraded();
     void onStreamError(KMError err);
     
     void onHttpData(KMBuffer &buf);
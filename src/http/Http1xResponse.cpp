@@ -29,7 +29,7 @@ using namespace kuma;
 
 //////////////////////////////////////////////////////////////////////////
 Http1xResponse::Http1xResponse(const EventLoopPtr &loop, std::string ver)
-: HttpResponse::Impl(std::move(ver)), stream_(new H1xStream(loop))
+: HttpResponse::Impl(loop, std::move(ver)), stream_(new H1xStream(loop))
 {
     stream_->setHeaderCallback([this] () {
         onRequestHeaderComplete();
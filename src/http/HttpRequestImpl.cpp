@@ -23,7 +23,6 @@
 #include "httputils.h"
 #include "libkev/src/util/kmtrace.h"
 #include "libkev/src/util/util.h"
-#include "compr/compr_zlib.h"
 
 #include <sstream>
 #include <iterator>
@@ -61,11 +60,8 @@ KMError HttpRequest::Impl::sendRequest(std::string method, std::string url)
     checkRequestHeaders();
     
     if (compression_enable_ && !req_encoding_type_.empty()) {
-        auto *compr = new ZLibCompressor();
-        compressor_.reset(compr);
-        compr->setFlushFlag(Z_NO_FLUSH);
-        if (compr->init(req_encoding_type_, 15) != KMError::NOERR) {
-            compressor_.reset();
+        compressor_ = createCompressor(req_encoding_type_);
+        if (!compressor_) {
             auto &req_header = getRequestHeader();
             req_header.removeHeader(strContentEncoding);
             req_header.removeHeaderValue(strTransferEncoding, req_encoding_type_);
@@ -109,7 +105,7 @@ void HttpRequest::Impl::checkRequestHeaders()
         addHeader("Pragma", "no-cache");
     }
     if (!req_header.hasHeader(strAcceptEncoding)) {
-        addHeader(strAcceptEncoding, "gzip, deflate");
+        addHeader(strAcceptEncoding, getAcceptEncodings());
     }
     /*if (!isHttp2() && !req_header.hasHeader("TE")) {
      addHeader("TE", "gzip, deflate");
@@ -138,10 +134,7 @@ void HttpRequest::Impl::checkRequestHeaders()
     }
     
     if (compression_enable_) {
-        if ((!kev::is_equal(rsp_encoding_type_, "gzip") &&
-             !kev::is_equal(rsp_encoding_type_, "deflate")) ||
-            isContentCompressed(content_type))
-        {
+        if (!isEncodingSupported(req_encoding_type_) || isContentCompressed(content_type)) {
             compression_enable_ = false;
         }
     }
@@ -209,11 +202,11 @@ int HttpRequest::Impl::sendData(const void* data, size_t len)
     }
     
     if (compressor_) {
-        if (!compression_buffer_.empty()) {
+        if (compression_buffer_) {
             return 0;
         }
         
-        Compressor::DataBuffer cbuf;
+        KMBuffer::Ptr cbuf;
         if (data && send_len > 0) {
             auto compr_ret = compressor_->compress(data, send_len, cbuf);
             if (compr_ret != KMError::NOERR) {
@@ -231,8 +224,8 @@ int HttpRequest::Impl::sendData(const void* data, size_t len)
         }
         
         raw_bytes_sent_ += send_len;
-        if (!cbuf.empty()) {
-            auto ret = sendBody(&cbuf[0], cbuf.size());
+        if (cbuf && !cbuf->empty()) {
+            auto ret = sendBody(*cbuf);
             if (ret < 0) {
                 return ret;
             } else if (ret == 0) {
@@ -282,7 +275,7 @@ int HttpRequest::Impl::sendData(const KMBuffer &buf)
     }
     
     if (compressor_) {
-        if (!compression_buffer_.empty()) {
+        if (compression_buffer_) {
             return 0;
         }
         
@@ -291,7 +284,7 @@ int HttpRequest::Impl::sendData(const KMBuffer &buf)
             send_buf = buf.subbuffer(0, send_len);
         }
         
-        Compressor::DataBuffer cbuf;
+        KMBuffer::Ptr cbuf;
         if (send_len > 0) {
             auto ret = compressor_->compress(*send_buf, cbuf);
             if (send_buf != &buf) {
@@ -312,8 +305,8 @@ int HttpRequest::Impl::sendData(const KMBuffer &buf)
         }
         
         raw_bytes_sent_ += send_len;
-        if (!cbuf.empty()) {
-            auto ret = sendBody(&cbuf[0], cbuf.size());
+        if (cbuf && !cbuf->empty()) {
+            auto ret = sendBody(*cbuf);
             if (ret < 0) {
                 return ret;
             } else if (ret == 0) {
@@ -367,7 +360,7 @@ void HttpRequest::Impl::reset()
     decompressor_.reset();
     compression_enable_ = true;
     compression_finish_ = false;
-    compression_buffer_.clear();
+    compression_buffer_.reset();
     if (getState() == State::COMPLETE) {
         setState(State::WAIT_FOR_REUSE);
     }
@@ -378,14 +371,9 @@ void HttpRequest::Impl::onResponseHeaderComplete()
     checkResponseHeaders();
     
     if (!rsp_encoding_type_.empty()) {
-        if (kev::is_equal(rsp_encoding_type_, "gzip") ||
-            kev::is_equal(rsp_encoding_type_, "deflate"))
-        {
-            auto *decompr = new ZLibDecompressor();
-            decompressor_.reset(decompr);
-            decompr->setFlushFlag(Z_SYNC_FLUSH);
-            if (decompr->init(rsp_encoding_type_, 15) != KMError::NOERR) {
-                decompressor_.reset();
+        if (isEncodingSupported(rsp_encoding_type_)) {
+            decompressor_ = createDecompressor(rsp_encoding_type_);
+            if (!decompressor_) {
                 KM_ERRXTRACE("onResponseHeaderComplete, failed to init decompressor, type=" << rsp_encoding_type_);
             }
         } else {
@@ -399,14 +387,13 @@ void HttpRequest::Impl::onResponseData(KMBuffer &buf)
 {
     if(data_cb_) {
         if (decompressor_) {
-            Decompressor::DataBuffer dbuf;
+            KMBuffer::Ptr dbuf;
             auto decompr_ret = decompressor_->decompress(buf, dbuf);
             if (decompr_ret != KMError::NOERR) {
                 return ;
             }
-            if (!dbuf.empty()) {
-                KMBuffer buf(&dbuf[0], dbuf.size(), dbuf.size());
-                data_cb_(buf);
+            if (dbuf && !dbuf->empty()) {
+                data_cb_(*dbuf);
             }
         } else {
             data_cb_(buf);
@@ -422,15 +409,15 @@ void HttpRequest::Impl::onResponseComplete()
 
 void HttpRequest::Impl::onSendReady()
 {
-    if (!compression_buffer_.empty()) {
-        auto ret = sendBody(&compression_buffer_[0], compression_buffer_.size());
+    if (compression_buffer_) {
+        auto ret = sendBody(*compression_buffer_);
         if (ret <= 0) {
             return ;
         }
         if (compression_finish_) {
             sendBody(nullptr, 0);
         }
-        compression_buffer_.clear();
+        compression_buffer_.reset();
     }
     if (write_cb_) write_cb_(KMError::NOERR);
 }
@@ -35,8 +35,6 @@
 
 KUMA_NS_BEGIN
 
-const std::string kAcceptableEncodings = "gzip, deflate";
-
 class HttpRequest::Impl : public kev::KMObject
 {
 public:
@@ -138,7 +136,7 @@ protected:
     
     bool                    compression_enable_ = true;
     bool                    compression_finish_ = false;
-    Compressor::DataBuffer  compression_buffer_;
+    KMBuffer::Ptr           compression_buffer_;
 };
 
 KUMA_NS_END
@@ -22,17 +22,18 @@
 #include "HttpResponseImpl.h"
 #include "EventLoopImpl.h"
 #include "httputils.h"
+#include "StaticResourceCache.h"
+#include "compr/compr_policy.h"
 #include "libkev/src/util/kmtrace.h"
 #include "libkev/src/util/util.h"
-#include "compr/compr_zlib.h"
 
 #include <iterator>
 
 using namespace kuma;
 
 //////////////////////////////////////////////////////////////////////////
-HttpResponse::Impl::Impl(std::string ver)
-: version_(std::move(ver))
+HttpResponse::Impl::Impl(const EventLoopPtr &loop, std::string ver)
+: loop_(loop), version_(std::move(ver))
 {
     
 }
@@ -52,14 +53,19 @@ KMError HttpResponse::Impl::sendResponse(int status_code, const std::string& des
     if (getState() != State::WAIT_FOR_RESPONSE) {
         return KMError::INVALID_STATE;
     }
+    auto level = CompressionLevel::DEFAULT;
+    if (compression_enable_ && !rsp_encoding_type_.empty()) {
+        level = getAdaptiveLevel(loop_.lock());
+        if (level == CompressionLevel::NONE) {
+            KM_INFOXTRACE("sendResponse, loop is busy, compression disabled");
+            compression_enable_ = false;
+        }
+    }
     checkResponseHeaders();
     
     if (compression_enable_ && !rsp_encoding_type_.empty()) {
-        auto *compr = new ZLibCompressor();
-        compressor_.reset(compr);
-        compr->setFlushFlag(Z_NO_FLUSH);
-        if (compr->init(rsp_encoding_type_, 15) != KMError::NOERR) {
-            compressor_.reset();
+        compressor_ = createCompressor(rsp_encoding_type_, level);
+        if (!compressor_) {
             auto &rsp_header = getResponseHeader();
             rsp_header.removeHeader(strContentEncoding);
             rsp_header.removeHeaderValue(strTransferEncoding, rsp_encoding_type_);
@@ -71,6 +77,60 @@ KMError HttpResponse::Impl::sendResponse(int status_code, const std::string& des
     return sendResponse(status_code, desc, version_);
 }
 
+KMError HttpResponse::Impl::sendStaticResource(const std::string &path, int status_code)
+{
+    if (getState() != State::WAIT_FOR_RESPONSE) {
+        return KMError::INVALID_STATE;
+    }
+    auto resource = StaticResourceCache::instance().getResource(path);
+    if (!resource) {
+        return KMError::NOT_EXIST;
+    }
+    auto &variant = resource->getVariant(getRequestHeader().getHeader(strAcceptEncoding));
+    auto body_size = variant.body.chainLength();
+    if (!resource->content_type.empty()) {
+        addHeader(strContentType, resource->content_type);
+    }
+    if (resource->vary) {
+        addVaryAcceptEncoding();
+    }
+    if (!variant.encoding.empty()) {
+        addHeader(strContentEncoding, variant.encoding);
+    }
+    addHeader(strContentLength, static_cast<uint32_t>(body_size));
+    // the variant is sent as it is
+    compression_enable_ = false;
+    auto ret = sendResponse(status_code, "");
+    if (ret != KMError::NOERR || body_size == 0) {
+        return ret;
+    }
+    KM_INFOXTRACE("sendStaticResource, path=" << path << ", encoding=" << variant.encoding << ", size=" << body_size);
+    static_body_.reset(variant.body.clone());
+    sendStaticBody();
+    return KMError::NOERR;
+}
+
+int HttpResponse::Impl::sendStaticBody()
+{
+    while (static_body_) {
+        auto ret = sendData(*static_body_);
+        if (ret < 0) {
+            static_body_.reset();
+            return ret;
+        } else if (ret == 0) {
+            return 0; // wait for onSendReady
+        }
+        auto remain = static_body_->chainLength() - ret;
+        if (remain > 0) {
+            // the remaining part still references the shared storage
+            static_body_.reset(static_body_->subbuffer(ret, remain));
+        } else {
+            static_body_.reset();
+        }
+    }
+    return 0;
+}
+
 void HttpResponse::Impl::checkRequestHeaders()
 {
     rsp_encoding_type_.clear();
@@ -79,18 +139,13 @@ void HttpResponse::Impl::checkRequestHeaders()
     auto encodings = req_header.getHeader(strAcceptEncoding);
     if (encodings.empty() && !isHttp2()) {
         encodings = req_header.getHeader("TE");
-        is_content_encoding_ = !encodings.empty();
+        is_content_encoding_ = encodings.empty();
+    }
+    if (is_content_encoding_) {
+        rsp_encoding_type_ = negotiateEncoding(encodings);
+    } else {
+        rsp_encoding_type_ = negotiateEncoding(encodings, getSupportedTransferCodings());
     }
-    kev::for_each_token(encodings, ',', [this] (const std::string &str) {
-        if (kev::is_equal(str, "gzip")) {
-            rsp_encoding_type_ = "gzip";
-            return false;
-        } else if (kev::is_equal(str, "deflate")) {
-            rsp_encoding_type_ = "deflate";
-            return false;
-        }
-        return true;
-    });
     
     req_encoding_type_ = req_header.getHeader(strContentEncoding);
     if (req_encoding_type_.empty() && !isHttp2()) {
@@ -108,6 +163,26 @@ void HttpResponse::Impl::checkRequestHeaders()
     }
 }
 
+void HttpResponse::Impl::addVaryAcceptEncoding()
+{
+    auto &rsp_header = getResponseHeader();
+    for (auto &kv : rsp_header.getHeaders()) {
+        if (kev::is_equal(kv.first, strVary)) {
+            // append to the Vary set by caller, "*" covers any header already
+            if (kev::contains_token(kv.second, "*", ',') ||
+                kev::contains_token(kv.second, strAcceptEncoding, ',')) {
+                return;
+            }
+            if (!kv.second.empty()) {
+                kv.second += ", ";
+            }
+            kv.second += strAcceptEncoding;
+            return;
+        }
+    }
+    addHeader(strVary, strAcceptEncoding);
+}
+
 void HttpResponse::Impl::checkResponseHeaders()
 {
     auto &rsp_header = getResponseHeader();
@@ -139,13 +214,15 @@ void HttpResponse::Impl::checkResponseHeaders()
         compression_enable_ = false;
     }
     
-    if (compression_enable_) {
-        if ((!kev::is_equal(rsp_encoding_type_, "gzip") &&
-             !kev::is_equal(rsp_encoding_type_, "deflate")) ||
-            isContentCompressed(content_type))
-        {
-            compression_enable_ = false;
-        }
+    if (compression_enable_ && isContentCompressed(content_type)) {
+        compression_enable_ = false;
+    }
+    if (compression_enable_ && is_content_encoding_) {
+        // the body is compressed or not depending on Accept-Encoding
+        addVaryAcceptEncoding();
+    }
+    if (compression_enable_ && !isEncodingSupported(rsp_encoding_type_)) {
+        compression_enable_ = false;
     }
     
     if (compression_enable_ && !rsp_encoding_type_.empty()) {
@@ -190,16 +267,32 @@ int HttpResponse::Impl::sendData(const void* data, size_t len)
     }
     
     if (compressor_) {
-        if (!compression_buffer_.empty()) {
+        if (compression_buffer_) {
             return 0;
         }
         
-        Compressor::DataBuffer cbuf;
+        if (data && send_len > 0 && !compression_sampled_) {
+            compression_sampled_ = true;
+            if (!isCompressible(data, send_len)) {
+                // the coding is already in the headers, store the data with least CPU
+                KM_INFOXTRACE("sendData, body is incompressible");
+                compressor_->setLevel(CompressionLevel::NONE);
+            }
+        }
+        
+        KMBuffer::Ptr cbuf;
         if (data && send_len > 0) {
             auto compr_ret = compressor_->compress(data, send_len, cbuf);
             if (compr_ret != KMError::NOERR) {
                 return -1;
             }
+            if (!finish) {
+                // the body is streamed, the client can decode the data sent so far
+                compr_ret = compressor_->flush(cbuf);
+                if (compr_ret != KMError::NOERR) {
+                    return -1;
+                }
+            }
         }
         
         if (finish) {
@@ -212,8 +305,8 @@ int HttpResponse::Impl::sendData(const void* data, size_t len)
         }
         
         raw_bytes_sent_ += send_len;
-        if (!cbuf.empty()) {
-            auto ret = sendBody(&cbuf[0], cbuf.size());
+        if (cbuf && !cbuf->empty()) {
+            auto ret = sendBody(*cbuf);
             if (ret < 0) {
                 return ret;
             } else if (ret == 0) {
@@ -263,7 +356,7 @@ int HttpResponse::Impl::sendData(const KMBuffer &buf)
     }
     
     if (compressor_) {
-        if (!compression_buffer_.empty()) {
+        if (compression_buffer_) {
             return 0;
         }
         
@@ -272,12 +365,25 @@ int HttpResponse::Impl::sendData(const KMBuffer &buf)
             send_buf = buf.subbuffer(0, send_len);
         }
         
-        Compressor::DataBuffer cbuf;
+        if (send_len > 0 && !compression_sampled_) {
+            compression_sampled_ = true;
+            if (!isCompressible(*send_buf)) {
+                // the coding is already in the headers, store the data with least CPU
+                KM_INFOXTRACE("sendData, body is incompressible");
+                compressor_->setLevel(CompressionLevel::NONE);
+            }
+        }
+        
+        KMBuffer::Ptr cbuf;
         if (send_len > 0) {
             auto ret = compressor_->compress(*send_buf, cbuf);
             if (send_buf != &buf) {
                 const_cast<KMBuffer*>(send_buf)->destroy();
             }
+            if (ret == KMError::NOERR && !finish) {
+                // the body is streamed, the client can decode the data sent so far
+                ret = compressor_->flush(cbuf);
+            }
             if (ret != KMError::NOERR) {
                 return -1;
             }
@@ -293,8 +399,8 @@ int HttpResponse::Impl::sendData(const KMBuffer &buf)
         }
         
         raw_bytes_sent_ += send_len;
-        if (!cbuf.empty()) {
-            auto ret = sendBody(&cbuf[0], cbuf.size());
+        if (cbuf && !cbuf->empty()) {
+            auto ret = sendBody(*cbuf);
             if (ret < 0) {
                 return ret;
             } else if (ret == 0) {
@@ -338,7 +444,9 @@ void HttpResponse::Impl::reset()
     decompressor_.reset();
     compression_enable_ = true;
     compression_finish_ = false;
-    compression_buffer_.clear();
+    compression_sampled_ = false;
+    compression_buffer_.reset();
+    static_body_.reset();
     setState(State::RECVING_REQUEST);
 }
 
@@ -347,14 +455,9 @@ void HttpResponse::Impl::onRequestHeaderComplete()
     checkRequestHeaders();
     
     if (!req_encoding_type_.empty()) {
-        if (kev::is_equal(req_encoding_type_, "gzip") ||
-            kev::is_equal(req_encoding_type_, "deflate"))
-        {
-            auto *decompr = new ZLibDecompressor();
-            decompressor_.reset(decompr);
-            decompr->setFlushFlag(Z_SYNC_FLUSH);
-            if (decompr->init(req_encoding_type_, 15) != KMError::NOERR) {
-                decompressor_.reset();
+        if (isEncodingSupported(req_encoding_type_)) {
+            decompressor_ = createDecompressor(req_encoding_type_);
+            if (!decompressor_) {
                 KM_ERRXTRACE("onRequestHeaderComplete, failed to init decompressor, type=" << req_encoding_type_);
             }
         } else {
@@ -368,14 +471,13 @@ void HttpResponse::Impl::onRequestData(KMBuffer &buf)
 {
     if(data_cb_) {
         if (decompressor_) {
-            Decompressor::DataBuffer dbuf;
+            KMBuffer::Ptr dbuf;
             auto decompr_ret = decompressor_->decompress(buf, dbuf);
             if (decompr_ret != KMError::NOERR) {
                 return ;
             }
-            if (!dbuf.empty()) {
-                KMBuffer buf(&dbuf[0], dbuf.size(), dbuf.size());
-                data_cb_(buf);
+            if (dbuf && !dbuf->empty()) {
+                data_cb_(*dbuf);
             }
         } else {
             data_cb_(buf);
@@ -398,15 +500,21 @@ void HttpResponse::Impl::notifyComplete()
 
 void HttpResponse::Impl::onSendReady()
 {
-    if (!compression_buffer_.empty()) {
-        auto ret = sendBody(&compression_buffer_[0], compression_buffer_.size());
+    if (static_body_) {
+        sendStaticBody();
+        if (static_body_) {
+            return;
+        }
+    }
+    if (compression_buffer_) {
+        auto ret = sendBody(*compression_buffer_);
         if (ret <= 0) {
             return ;
         }
         if (compression_finish_) {
             sendBody(nullptr, 0);
         }
-        compression_buffer_.clear();
+        compression_buffer_.reset();
     }
     if (write_cb_) write_cb_(KMError::NOERR);
 }
@@ -40,7 +40,7 @@ public:
     using HttpEventCallback = HttpResponse::HttpEventCallback;
     using EnumerateCallback = HttpParser::Impl::EnumerateCallback;
     
-    Impl(std::string ver);
+    Impl(const EventLoopPtr &loop, std::string ver);
     virtual ~Impl();
     
     virtual KMError setSslFlags(uint32_t ssl_flags) { return KMError::NOT_SUPPORTED; }
@@ -50,6 +50,8 @@ public:
     virtual KMError addHeader(std::string name, std::string value) = 0;
     virtual KMError addHeader(std::string name, uint32_t value);
     KMError sendResponse(int status_code, const std::string& desc);
+    KMError sendStaticResource(const std::string &path, int status_code);
+    virtual KMError pushResource(const std::string &path) { return KMError::NOT_SUPPORTED; }
     int sendData(const void* data, size_t len);
     int sendData(const KMBuffer &buf);
     virtual void reset();
@@ -89,6 +91,7 @@ protected:
     virtual int sendBody(const KMBuffer &buf) = 0;
     virtual void checkRequestHeaders();
     virtual void checkResponseHeaders();
+    void addVaryAcceptEncoding();
     virtual HttpHeader& getRequestHeader() = 0;
     virtual const HttpHeader& getRequestHeader() const = 0;
     virtual HttpHeader& getResponseHeader() = 0;
@@ -112,9 +115,11 @@ protected:
     void onRequestComplete();
     void notifyComplete();
     void onSendReady();
+    int sendStaticBody();
     
 protected:
     State                   state_ = State::IDLE;
+    EventLoopWeakPtr        loop_;
     
     std::string             version_;
     
@@ -135,7 +140,9 @@ protected:
     std::string             rsp_encoding_type_;
     bool                    compression_enable_ = true;
     bool                    compression_finish_ = false;
-    Compressor::DataBuffer  compression_buffer_;
+    bool                    compression_sampled_ = false;
+    KMBuffer::Ptr           compression_buffer_;
+    KMBuffer::Ptr           static_body_; // the unsent part of the static resource
 };
 
 KUMA_NS_END
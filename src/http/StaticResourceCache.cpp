@@ -0,0 +1,163 @@
+/* Copyright (c) 2016, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "StaticResourceCache.h"
+#include "httpdefs.h"
+#include "httputils.h"
+#include "compr/compr.h"
+#include "libkev/src/util/kmtrace.h"
+
+KUMA_NS_USING
+
+//////////////////////////////////////////////////////////////////////////
+//
+const StaticResourceCache::Variant& StaticResourceCache::Resource::getVariant(const std::string &accept_encodings) const
+{
+    if (!encodings.empty()) {
+        auto encoding = negotiateEncoding(accept_encodings, encodings);
+        for (size_t i = 1; !encoding.empty() && i < variants.size(); ++i) {
+            if (variants[i].encoding == encoding) {
+                return variants[i];
+            }
+        }
+    }
+    return variants[0];
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+StaticResourceCache& StaticResourceCache::instance()
+{
+    static StaticResourceCache s_instance;
+    return s_instance;
+}
+
+StaticResourceCache::~StaticResourceCache()
+{
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        stopping_ = true;
+        jobs_.clear();
+    }
+    jobs_cond_.notify_one();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void StaticResourceCache::setResource(const std::string &path, const std::string &content_type, const KMBuffer &body, bool async)
+{
+    auto res = std::make_shared<Resource>();
+    res->content_type = content_type;
+    Variant identity;
+    auto body_size = body.chainLength();
+    if (body_size > 0) {
+        // copy once into shared storage, the responses reference it afterwards
+        KMBuffer buf(body_size);
+        buf.bytesWritten(body.readChained(buf.writePtr(), body_size));
+        identity.body = std::move(buf);
+    }
+    res->variants.emplace_back(std::move(identity));
+    res->vary = body_size >= kMinCompressSize && !isContentCompressed(content_type);
+    
+    ResourcePtr resource = std::move(res);
+    if (resource->vary && !async) {
+        resource = buildVariants(resource);
+    }
+    
+    std::lock_guard<std::mutex> g(mutex_);
+    resources_[path] = resource;
+    if (resource->vary && async) {
+        jobs_.emplace_back(path, resource);
+        if (!worker_.joinable()) {
+            worker_ = std::thread([this] { workerProc(); });
+        }
+        jobs_cond_.notify_one();
+    }
+}
+
+StaticResourceCache::ResourcePtr StaticResourceCache::getResource(const std::string &path)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = resources_.find(path);
+    return it != resources_.end() ? it->second : nullptr;
+}
+
+void StaticResourceCache::removeResource(const std::string &path)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    resources_.erase(path);
+}
+
+StaticResourceCache::ResourcePtr StaticResourceCache::buildVariants(const ResourcePtr &resource)
+{
+    auto res = std::make_shared<Resource>(*resource);
+    auto &identity = resource->variants[0].body;
+    auto identity_size = identity.chainLength();
+    for (auto &encoding : getSupportedEncodings()) {
+        auto compr = createCompressor(encoding, CompressionLevel::BEST);
+        if (!compr) {
+            continue;
+        }
+        KMBuffer::Ptr cbuf;
+        if (compr->compress(identity, cbuf) != KMError::NOERR ||
+            compr->compress(nullptr, 0, cbuf) != KMError::NOERR || !cbuf) {
+            KM_WARNTRACE("StaticResourceCache::buildVariants, failed to compress, encoding=" << encoding);
+            continue;
+        }
+        auto size = cbuf->chainLength();
+        if (size >= identity_size) {
+            continue; // no gain
+        }
+        Variant variant;
+        variant.encoding = encoding;
+        KMBuffer buf(size);
+        buf.bytesWritten(cbuf->readChained(buf.writePtr(), size));
+        variant.body = std::move(buf);
+        res->variants.emplace_back(std::move(variant));
+        res->encodings.emplace_back(encoding);
+    }
+    return res;
+}
+
+void StaticResourceCache::workerProc()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+        jobs_cond_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+        if (stopping_) {
+            break;
+        }
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        auto it = resources_.find(job.first);
+        if (it == resources_.end() || it->second != job.second) {
+            continue; // replaced or removed
+        }
+        lk.unlock();
+        auto resource = buildVariants(job.second);
+        lk.lock();
+        it = resources_.find(job.first);
+        if (it != resources_.end() && it->second == job.second) {
+            it->second = std::move(resource);
+        }
+    }
+}
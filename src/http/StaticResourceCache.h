@@ -0,0 +1,95 @@
+/* Copyright (c) 2016, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __StaticResourceCache_H__
+#define __StaticResourceCache_H__
+
+#include "kmdefs.h"
+#include "kmbuffer.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+KUMA_NS_BEGIN
+
+/*
+ * process-wide cache of static responses. each resource keeps the identity body
+ * and its compressed variants, which are compressed once at the best level, and
+ * all the variants are kept in shared storage, so serving one copies no data
+ */
+class StaticResourceCache final
+{
+public:
+    struct Variant
+    {
+        std::string encoding; // empty for identity
+        KMBuffer body;
+    };
+    struct Resource
+    {
+        std::string content_type;
+        std::vector<Variant> variants; // identity is the first one
+        std::vector<std::string> encodings; // encodings of the compressed variants
+        bool vary = false; // response varies on Accept-Encoding
+        
+        /*
+         * return the variant that best matches Accept-Encoding
+         */
+        const Variant& getVariant(const std::string &accept_encodings) const;
+    };
+    using ResourcePtr = std::shared_ptr<const Resource>;
+    
+    static StaticResourceCache& instance();
+    
+    /*
+     * the compressed variants are built in a background thread if async is true,
+     * the identity body is served until they are ready
+     */
+    void setResource(const std::string &path, const std::string &content_type, const KMBuffer &body, bool async);
+    ResourcePtr getResource(const std::string &path);
+    void removeResource(const std::string &path);
+    
+protected:
+    StaticResourceCache() = default;
+    ~StaticResourceCache();
+    
+    static ResourcePtr buildVariants(const ResourcePtr &resource);
+    void workerProc();
+    
+protected:
+    std::map<std::string, ResourcePtr> resources_;
+    std::mutex mutex_;
+    
+    std::deque<std::pair<std::string, ResourcePtr>> jobs_;
+    std::condition_variable jobs_cond_;
+    std::thread worker_;
+    bool stopping_ = false;
+};
+
+KUMA_NS_END
+
+#endif
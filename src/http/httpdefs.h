@@ -41,6 +41,7 @@ const std::string strHost = "Host";
 const std::string strUpgrade = "Upgrade";
 const std::string strAcceptEncoding = "Accept-Encoding";
 const std::string strContentEncoding = "Content-Encoding";
+const std::string strVary = "Vary";
 const std::string strProxyAuthenticate = "Proxy-Authenticate";
 const std::string strProxyAuthorization = "Proxy-Authorization";
 const std::string strProxyConnection = "Proxy-Connection";
@@ -22,7 +22,35 @@
 #include "FlowControl.h"
 #include "libkev/src/util/kmtrace.h"
 
+#include <algorithm>
+
 using namespace kuma;
+using namespace std::chrono;
+
+namespace {
+    // probe interval when the window is not the bottleneck
+    const auto kBdpProbeIdleInterval = milliseconds(1000);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+WindowBudget& WindowBudget::get()
+{
+    static WindowBudget s_budget;
+    return s_budget;
+}
+
+size_t WindowBudget::acquire(size_t bytes, size_t min_bytes)
+{
+    size_t used = used_;
+    size_t granted = 0;
+    do {
+        size_t limit = limit_;
+        size_t avail = used < limit ? limit - used : 0;
+        granted = std::max(std::min(bytes, avail), std::min(bytes, min_bytes));
+    } while (!used_.compare_exchange_weak(used, used + granted));
+    return granted;
+}
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -32,6 +60,30 @@ FlowControl::FlowControl(uint32_t stream_id, UpdateCallback cb)
     
 }
 
+FlowControl::~FlowControl()
+{
+    if (budget_ && budget_charged_ > 0) {
+        budget_->release(budget_charged_);
+        budget_charged_ = 0;
+    }
+}
+
+void FlowControl::reset(uint32_t stream_id)
+{
+    if (budget_ && budget_charged_ > 0) {
+        budget_->release(budget_charged_);
+    }
+    budget_charged_ = 0;
+    stream_id_ = stream_id;
+    local_window_step_ = H2_DEFAULT_WINDOW_SIZE;
+    local_window_size_ = H2_DEFAULT_WINDOW_SIZE;
+    min_local_window_size_ = 32768;
+    bytes_received_ = 0;
+    bytes_unconsumed_ = 0;
+    remote_window_size_ = H2_DEFAULT_WINDOW_SIZE;
+    bytes_sent_ = 0;
+}
+
 void FlowControl::setLocalWindowStep(uint32_t window_size)
 {
     local_window_step_ = window_size;
@@ -56,6 +108,10 @@ void FlowControl::updateRemoteWindowSize(long delta)
 void FlowControl::initLocalWindowSize(uint32_t window_size)
 {
     local_window_size_ = window_size;
+    if (budget_) {
+        budget_->charge(window_size);
+        budget_charged_ += window_size;
+    }
 }
 
 void FlowControl::initRemoteWindowSize(uint32_t window_size)
@@ -63,6 +119,51 @@ void FlowControl::initRemoteWindowSize(uint32_t window_size)
     remote_window_size_ = window_size;
 }
 
+void FlowControl::growLocalWindow(uint32_t window_size, bool send_update)
+{
+    if (window_size <= local_window_step_) {
+        return;
+    }
+    auto delta = window_size - local_window_step_;
+    if (budget_) {
+        if (send_update) {
+            delta = budget_->acquire(delta, 0);
+            if (delta == 0) {
+                return;
+            }
+        } else {
+            // peer is informed by SETTINGS, the full delta is promised already
+            budget_->charge(delta);
+        }
+        budget_charged_ += delta;
+    }
+    local_window_step_ += delta;
+    local_window_size_ += (long)delta;
+    if (send_update && update_cb_) {
+        update_cb_(uint32_t(delta));
+    }
+}
+
+void FlowControl::shrinkLocalWindow(uint32_t window_size)
+{
+    if (window_size >= local_window_step_) {
+        return;
+    }
+    auto delta = local_window_step_ - window_size;
+    if (budget_) {
+        // the data in flight is still charged if the window becomes negative
+        size_t window = local_window_size_ > 0 ? size_t(local_window_size_) : 0;
+        auto released = std::min(std::min(delta, window), budget_charged_);
+        budget_->release(released);
+        budget_charged_ -= released;
+    }
+    local_window_step_ = window_size;
+    local_window_size_ -= (long)delta;
+    if (min_local_window_size_ > local_window_step_/2) {
+        min_local_window_size_ = local_window_step_/2;
+    }
+}
+
 uint32_t FlowControl::localWindowSize()
 {
     return local_window_size_>0 ? uint32_t(local_window_size_) : 0;
@@ -85,12 +186,110 @@ void FlowControl::bytesSent(size_t bytes)
 void FlowControl::bytesReceived(size_t bytes)
 {
     bytes_received_ += bytes;
+    bytes_unconsumed_ += bytes;
     local_window_size_ -= (long)bytes;
+}
+
+void FlowControl::bytesConsumed(size_t bytes)
+{
+    bytes = std::min(bytes, bytes_unconsumed_);
+    bytes_unconsumed_ -= bytes;
+    if (budget_) {
+        auto consumed = std::min(bytes, budget_charged_);
+        budget_->release(consumed);
+        budget_charged_ -= consumed;
+    }
     if (local_window_size_ < long(min_local_window_size_)) {
-        auto delta = local_window_step_ - local_window_size_;
+        // the window of data still buffered by application is not refilled
+        long target = long(local_window_step_) - long(bytes_unconsumed_);
+        if (target <= local_window_size_) {
+            return;
+        }
+        size_t delta = size_t(target - local_window_size_);
+        if (budget_) {
+            // refill to the default window at least even if budget is exhausted
+            long min_window = std::min<long>(long(local_window_step_), H2_DEFAULT_WINDOW_SIZE);
+            min_window -= long(bytes_unconsumed_);
+            size_t min_delta = min_window > local_window_size_ ? size_t(min_window - local_window_size_) : 0;
+            delta = budget_->acquire(delta, min_delta);
+            budget_charged_ += delta;
+            if (delta == 0) {
+                return;
+            }
+        }
         local_window_size_ += (long)delta;
         if (update_cb_) {
             update_cb_(uint32_t(delta));
         }
     }
 }
+
+//////////////////////////////////////////////////////////////////////////
+//
+bool BdpEstimator::bytesReceived(size_t bytes)
+{
+    if (window_size_ >= max_window_size_) {
+        return false;
+    }
+    sample_ += bytes;
+    if (ping_outstanding_) {
+        return false;
+    }
+    return steady_clock::now() >= next_probe_time_;
+}
+
+void BdpEstimator::pingSent()
+{
+    ping_outstanding_ = true;
+    ping_time_ = steady_clock::now();
+    sample_ = 0;
+}
+
+void RttStats::update(uint32_t rtt_us)
+{
+    latest_us_ = rtt_us;
+    if (samples_ == 0) {
+        min_us_ = rtt_us;
+        smoothed_us_ = rtt_us;
+        variance_us_ = rtt_us / 2;
+    } else {
+        // RFC 6298, 2.3
+        uint32_t srtt = smoothed_us_;
+        uint32_t diff = srtt > rtt_us ? srtt - rtt_us : rtt_us - srtt;
+        variance_us_ = uint32_t((uint64_t(variance_us_) * 3 + diff) / 4);
+        smoothed_us_ = uint32_t((uint64_t(srtt) * 7 + rtt_us) / 8);
+        if (rtt_us < min_us_) {
+            min_us_ = rtt_us;
+        }
+    }
+    ++samples_;
+}
+
+uint32_t BdpEstimator::pingAcked()
+{
+    if (!ping_outstanding_) {
+        return 0;
+    }
+    ping_outstanding_ = false;
+    auto now = steady_clock::now();
+    auto rtt = duration_cast<microseconds>(now - ping_time_).count();
+    if (rtt <= 0) {
+        rtt = 1;
+    }
+    rtt_us_ = rtt_us_ == 0 ? uint32_t(rtt) : uint32_t((rtt_us_ * 7 + rtt) / 8);
+    
+    auto sample = sample_;
+    sample_ = 0;
+    double bandwidth = double(sample) / rtt;
+    // the window is the bottleneck if it is nearly filled in one round trip
+    if (bandwidth > max_bandwidth_ && uint64_t(sample) >= uint64_t(window_size_) * 2 / 3) {
+        max_bandwidth_ = bandwidth;
+        auto window_size = std::min<uint64_t>(uint64_t(sample) * 2, max_window_size_);
+        if (window_size > window_size_) {
+            window_size_ = uint32_t(window_size);
+            return window_size_;
+        }
+    }
+    next_probe_time_ = now + kBdpProbeIdleInterval;
+    return 0;
+}
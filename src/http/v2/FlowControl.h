@@ -26,29 +26,95 @@
 #include "h2defs.h"
 
 #include <functional>
+#include <chrono>
+#include <atomic>
 
 KUMA_NS_BEGIN
 
+/*
+ * WindowBudget bounds the receive windows granted by all the connections and streams
+ * in process, that is the most data peers are allowed to send before it is consumed.
+ * under pressure the windows are only refilled to a minimal size, so that a stream
+ * never stalls, and the initial stream window is shrunk. they grow back when the
+ * budget is relaxed
+ */
+class WindowBudget
+{
+public:
+    static WindowBudget& get();
+    
+    void setLimit(size_t limit) { limit_ = limit; }
+    size_t limit() const { return limit_; }
+    size_t used() const { return used_; }
+    bool underPressure() const { return used_ >= limit_ / 4 * 3; }
+    bool relaxed() const { return used_ < limit_ / 2; }
+    
+    /*
+     * charge bytes regardless of the limit, for the window already promised to peer
+     */
+    void charge(size_t bytes) { used_ += bytes; }
+    /*
+     * acquire up to bytes from budget, min_bytes is granted even if budget is exhausted.
+     * return the bytes acquired
+     */
+    size_t acquire(size_t bytes, size_t min_bytes);
+    void release(size_t bytes) { used_ -= bytes; }
+    
+private:
+    std::atomic<size_t> limit_{H2_RECV_WINDOW_BUDGET};
+    std::atomic<size_t> used_{0};
+};
+
 class FlowControl
 {
 public:
     using UpdateCallback = std::function<void(uint32_t)>;
     
     FlowControl(uint32_t stream_id, UpdateCallback cb);
+    ~FlowControl();
+    FlowControl(const FlowControl &) = delete;
+    FlowControl& operator=(const FlowControl &) = delete;
+    
+    /*
+     * release the budget and restore the default windows, so that it can be reused by another stream
+     */
+    void reset(uint32_t stream_id);
+    
+    /*
+     * local window is accounted in budget if it is set, must be called before initLocalWindowSize
+     */
+    void setBudget(WindowBudget *budget) { budget_ = budget; }
     void setLocalWindowStep(uint32_t window_size);
     void setMinLocalWindowSize(uint32_t min_window_size);
     void updateRemoteWindowSize(long delta);
     void initLocalWindowSize(uint32_t window_size);
     void initRemoteWindowSize(uint32_t window_size);
+    /*
+     * grow local window to window_size, the increment is sent by WINDOW_UPDATE if send_update is true,
+     * otherwise the peer is informed by SETTINGS_INITIAL_WINDOW_SIZE
+     */
+    void growLocalWindow(uint32_t window_size, bool send_update);
+    /*
+     * shrink local window to window_size, the peer is informed by SETTINGS_INITIAL_WINDOW_SIZE,
+     * the budget of the window withdrawn is released
+     */
+    void shrinkLocalWindow(uint32_t window_size);
+    uint32_t localWindowStep() const { return uint32_t(local_window_step_); }
     
     uint32_t localWindowSize();
     uint32_t remoteWindowSize();
     
     void bytesSent(size_t bytes);
+    /*
+     * received bytes shrink the local window only, the window and budget of them
+     * are restored by bytesConsumed once the data is consumed by application
+     */
     void bytesReceived(size_t bytes);
+    void bytesConsumed(size_t bytes);
     
     size_t bytesSent() { return bytes_sent_; }
     size_t bytesReceived() { return bytes_received_; }
+    size_t bytesUnconsumed() const { return bytes_unconsumed_; }
     
 private:
     uint32_t stream_id_ = 0;
@@ -56,13 +122,74 @@ private:
     long local_window_size_ = H2_DEFAULT_WINDOW_SIZE;
     size_t min_local_window_size_ = 32768;
     size_t bytes_received_ = 0;
+    size_t bytes_unconsumed_ = 0;
     
     long remote_window_size_ = H2_DEFAULT_WINDOW_SIZE;
     size_t bytes_sent_ = 0;
     
+    WindowBudget *budget_ = nullptr;
+    size_t budget_charged_ = 0;
+    
     UpdateCallback update_cb_;
 };
 
+/*
+ * BdpEstimator estimates the bandwidth-delay product by timing a PING sent along
+ * with received DATA. the receive window should grow when the bytes received
+ * in one round trip approach the current window
+ */
+class BdpEstimator
+{
+public:
+    void setWindowSize(uint32_t window_size) { window_size_ = window_size; }
+    void setMaxWindowSize(uint32_t max_window_size) { max_window_size_ = max_window_size; }
+    uint32_t windowSize() const { return window_size_; }
+    uint32_t maxWindowSize() const { return max_window_size_; }
+    
+    // return true if a BDP ping should be sent
+    bool bytesReceived(size_t bytes);
+    void pingSent();
+    // return the new window size if the window should grow, otherwise 0
+    uint32_t pingAcked();
+    bool pingOutstanding() const { return ping_outstanding_; }
+    // smoothed RTT in microseconds
+    uint32_t rtt() const { return rtt_us_; }
+    
+private:
+    using time_point = std::chrono::steady_clock::time_point;
+    
+    uint32_t window_size_ = H2_LOCAL_STREAM_INITIAL_WINDOW_SIZE;
+    uint32_t max_window_size_ = H2_LOCAL_MAX_WINDOW_SIZE;
+    size_t sample_ = 0;
+    double max_bandwidth_ = 0;
+    uint32_t rtt_us_ = 0;
+    bool ping_outstanding_ = false;
+    time_point ping_time_;
+    time_point next_probe_time_;
+};
+
+/*
+ * RttStats keeps the round trip times measured by PING in microseconds.
+ * it is updated on connection thread and can be read from any thread
+ */
+class RttStats
+{
+public:
+    void update(uint32_t rtt_us);
+    uint32_t latest() const { return latest_us_; }
+    uint32_t minimum() const { return min_us_; }
+    uint32_t smoothed() const { return smoothed_us_; }
+    uint32_t variance() const { return variance_us_; }
+    uint32_t samples() const { return samples_; }
+    
+private:
+    std::atomic<uint32_t> latest_us_{0};
+    std::atomic<uint32_t> min_us_{0};
+    std::atomic<uint32_t> smoothed_us_{0};
+    std::atomic<uint32_t> variance_us_{0};
+    std::atomic<uint32_t> samples_{0};
+};
+
 KUMA_NS_END
 
 #endif
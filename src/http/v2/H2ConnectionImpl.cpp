@@ -25,6 +25,7 @@
 #include "H2Handshake.h"
 #include "PushClient.h"
 
+#include <algorithm>
 
 using namespace kuma;
 
@@ -32,12 +33,15 @@ namespace {
 #ifdef KUMA_HAS_OPENSSL
     static const AlpnProtos alpnProtos{ 2, 'h', '2' };
 #endif
+    static const uint8_t kBdpPingData[H2_PING_PAYLOAD_SIZE] = { 'k', 'm', 'b', 'd', 'p', 0, 0, 0 };
+    static const uint8_t kHealthPingData[H2_PING_PAYLOAD_SIZE] = { 'k', 'm', 'p', 'i', 'n', 'g', 0, 0 };
 }
 
 //////////////////////////////////////////////////////////////////////////
 H2Connection::Impl::Impl(const EventLoopPtr &loop)
 : tcp_conn_(loop), thread_id_(loop->threadId()), frame_parser_(this)
 , flow_ctrl_(0, [this] (uint32_t w) { sendWindowUpdate(0, w); })
+, ping_timer_(loop->getTimerMgr())
 {
     loop_token_.eventLoop(loop);
     tcp_conn_.setDataCallback([this](uint8_t *data, size_t size) {
@@ -50,10 +54,15 @@ H2Connection::Impl::Impl(const EventLoopPtr &loop)
         onError(err);
     });
     
+    flow_ctrl_.setBudget(&WindowBudget::get());
     flow_ctrl_.initLocalWindowSize(H2_LOCAL_CONN_INITIAL_WINDOW_SIZE);
     flow_ctrl_.setMinLocalWindowSize(init_local_window_size_);
     flow_ctrl_.setLocalWindowStep(H2_LOCAL_CONN_INITIAL_WINDOW_SIZE);
     frame_parser_.setMaxFrameSize(max_local_frame_size_);
+    hp_decoder_.updateTableSize(header_table_size_);
+    hp_decoder_.setMaxHeaderListSize(max_header_list_size_);
+    hp_encoder_.setEncodeCacheSize(H2_HEADER_BLOCK_CACHE_SIZE);
+    bdp_estimator_.setWindowSize(init_local_window_size_);
     KM_SetObjKey("H2Connection");
     KM_INFOXTRACE("H2Connection");
 }
@@ -73,14 +82,19 @@ H2Connection::Impl::~Impl()
 void H2Connection::Impl::cleanup()
 {
     setState(State::CLOSED);
+    ping_timer_.cancel();
     tcp_conn_.close();
     push_clients_.clear();
+    push_servers_.clear();
+    closed_streams_.clear();
+    reset_streams_.clear();
+    stream_pool_.clear();
 }
 
 void H2Connection::Impl::cleanupAndRemove()
 {
     cleanup();
-    H2ConnectionMgr::removeConnection(key_, tcp_conn_.sslEnabled());
+    H2ConnectionMgr::removeConnection(key_, this, tcp_conn_.sslEnabled());
 }
 
 void H2Connection::Impl::setConnectionKey(const std::string &key)
@@ -91,6 +105,29 @@ void H2Connection::Impl::setConnectionKey(const std::string &key)
     }
 }
 
+void H2Connection::Impl::setHeaderTableSize(uint32_t table_size)
+{
+    header_table_size_ = table_size;
+    hp_decoder_.updateTableSize(header_table_size_);
+}
+
+void H2Connection::Impl::setMaxHeaderListSize(uint32_t list_size)
+{
+    max_header_list_size_ = list_size;
+    hp_decoder_.setMaxHeaderListSize(max_header_list_size_);
+}
+
+void H2Connection::Impl::setPingInterval(uint32_t interval_ms, uint32_t timeout_ms)
+{
+    ping_interval_ms_ = interval_ms;
+    ping_timeout_ms_ = timeout_ms;
+}
+
+void H2Connection::Impl::setMaxLocalWindowSize(uint32_t max_window_size)
+{
+    bdp_estimator_.setMaxWindowSize(std::min(max_window_size, H2_MAX_WINDOW_SIZE));
+}
+
 KMError H2Connection::Impl::setProxyInfo(const ProxyInfo &proxy_info)
 {
     return tcp_conn_.setProxyInfo(proxy_info);
@@ -178,6 +215,7 @@ KMError H2Connection::Impl::sendData(const KMBuffer &buf)
     } else if (ret == 0) {
         // send blocked
         tcp_conn_.appendSendBuffer(buf);
+        send_saturated_ = true;
         return KMError::NOERR;
     } else {
         return KMError::SOCK_ERROR;
@@ -201,6 +239,9 @@ KMError H2Connection::Impl::sendH2Frame(H2Frame *frame)
     if (frame->type() == H2FrameType::HEADERS) {
         HeadersFrame *headers = dynamic_cast<HeadersFrame*>(frame);
         return sendHeadersFrame(headers);
+    } else if (frame->type() == H2FrameType::PUSH_PROMISE) {
+        PushPromiseFrame *push = dynamic_cast<PushPromiseFrame*>(frame);
+        return sendPushPromiseFrame(push);
     } else if (frame->type() == H2FrameType::DATA) {
         if (flow_ctrl_.remoteWindowSize() < frame->getPayloadLength()) {
             KM_INFOXTRACE("sendH2Frame, BUFFER_TOO_SMALL, win="<<flow_ctrl_.remoteWindowSize()<<", len="<<frame->getPayloadLength());
@@ -208,6 +249,7 @@ KMError H2Connection::Impl::sendH2Frame(H2Frame *frame)
             return KMError::BUFFER_TOO_SMALL;
         }
         flow_ctrl_.bytesSent(frame->getPayloadLength());
+        return sendDataFrame(dynamic_cast<DataFrame*>(frame));
     } else if (frame->type() == H2FrameType::WINDOW_UPDATE && frame->getStreamId() != 0) {
         //WindowUpdateFrame *wu = dynamic_cast<WindowUpdateFrame*>(frame);
         //flow_ctrl_.increaseLocalWindowSize(wu->getWindowSizeIncrement());
@@ -227,6 +269,21 @@ KMError H2Connection::Impl::sendH2Frame(H2Frame *frame)
     return sendData(buf);
 }
 
+KMError H2Connection::Impl::sendDataFrame(DataFrame *frame)
+{
+    // only frame header is encoded, payload is linked to it without copying
+    uint8_t hdr_buf[H2_FRAME_HEADER_SIZE];
+    KMBuffer hdr_kmb(hdr_buf, sizeof(hdr_buf));
+    KMBuffer::Ptr payload;
+    if (frame->encode(hdr_kmb, payload) < 0) {
+        KM_ERRXTRACE("sendDataFrame, failed to encode frame");
+        return KMError::INVALID_PARAM;
+    }
+    auto err = sendData(hdr_kmb);
+    hdr_kmb.unlink();
+    return err;
+}
+
 KMError H2Connection::Impl::sendHeadersFrame(HeadersFrame *frame)
 {
     h2_priority_t pri;
@@ -250,9 +307,30 @@ KMError H2Connection::Impl::sendHeadersFrame(HeadersFrame *frame)
     return sendData(buf);
 }
 
+KMError H2Connection::Impl::sendPushPromiseFrame(PushPromiseFrame *frame)
+{
+    auto &headers = frame->getHeaders();
+    size_t hpackSize = frame->getHeadersSize() * 3 / 2;
+    std::vector<uint8_t> block(hpackSize);
+    int ret = hp_encoder_.encode(headers, &block[0], block.size());
+    if (ret < 0) {
+        return KMError::FAILED;
+    }
+    frame->setBlock(&block[0], uint32_t(ret));
+    
+    KMBuffer buf(H2_FRAME_HEADER_SIZE + frame->calcPayloadSize());
+    ret = frame->encode((uint8_t*)buf.writePtr(), buf.space());
+    if (ret < 0) {
+        KM_ERRXTRACE("sendPushPromiseFrame, failed to encode frame");
+        return KMError::INVALID_PARAM;
+    }
+    buf.bytesWritten(ret);
+    return sendData(buf);
+}
+
 H2StreamPtr H2Connection::Impl::createStream()
 {
-    H2StreamPtr stream(new H2Stream(next_stream_id_, this, init_local_window_size_, init_remote_window_size_));
+    auto stream = newStream(next_stream_id_);
     next_stream_id_ += 2;
     addStream(stream);
     return stream;
@@ -260,11 +338,52 @@ H2StreamPtr H2Connection::Impl::createStream()
 
 H2StreamPtr H2Connection::Impl::createStream(uint32_t stream_id)
 {
-    H2StreamPtr stream(new H2Stream(stream_id, this, init_local_window_size_, init_remote_window_size_));
+    auto stream = newStream(stream_id);
     addStream(stream);
     return stream;
 }
 
+H2StreamPtr H2Connection::Impl::newStream(uint32_t stream_id)
+{
+    reclaimClosedStreams();
+    if (stream_pool_.empty()) {
+        return H2StreamPtr(new H2Stream(stream_id, this, init_local_window_size_, init_remote_window_size_));
+    }
+    auto stream = std::move(stream_pool_.back());
+    stream_pool_.pop_back();
+    stream->init(stream_id, this, init_local_window_size_, init_remote_window_size_);
+    return stream;
+}
+
+void H2Connection::Impl::recycleStream(H2StreamPtr stream)
+{
+    if (!stream || stream.use_count() > 1 || stream_pool_.size() >= H2_MAX_POOLED_STREAMS) {
+        return;
+    }
+    stream->reset();
+    stream_pool_.emplace_back(std::move(stream));
+}
+
+void H2Connection::Impl::reclaimClosedStreams()
+{
+    size_t i = 0;
+    for (auto stream_id : closed_streams_) {
+        auto stream = streams_.find(stream_id);
+        if (!stream) {
+            continue;
+        }
+        if (stream->use_count() > 1) {
+            // still referenced by its owner, try it later
+            closed_streams_[i++] = stream_id;
+            continue;
+        }
+        H2StreamPtr s = std::move(*stream);
+        streams_.erase(stream_id);
+        recycleStream(std::move(s));
+    }
+    closed_streams_.resize(i);
+}
+
 bool H2Connection::Impl::handleDataFrame(DataFrame *frame)
 {
     if (frame->getStreamId() == 0) {
@@ -272,14 +391,32 @@ bool H2Connection::Impl::handleDataFrame(DataFrame *frame)
         connectionError(H2Error::PROTOCOL_ERROR);
         return false;
     }
+    // data buffered by application is bounded by stream windows,
+    // so the connection window is restored on receipt
     flow_ctrl_.bytesReceived(frame->getPayloadLength());
+    flow_ctrl_.bytesConsumed(frame->getPayloadLength());
+    if (bdp_estimator_.bytesReceived(frame->getPayloadLength())) {
+        sendBdpPing();
+    }
+    adjustLocalWindowSize();
     H2StreamPtr stream = getStream(frame->getStreamId());
     if (stream) {
         return stream->handleDataFrame(frame);
-    } else {
-        KM_WARNXTRACE("handleDataFrame, no stream, streamId="<<frame->getStreamId()<<", size="<<frame->size()<<", flags="<<int(frame->getFlags()));
+    }
+    KM_WARNXTRACE("handleDataFrame, no stream, streamId="<<frame->getStreamId()<<", size="<<frame->size()<<", flags="<<int(frame->getFlags()));
+    // the data is still accounted in connection window above
+    if (isResetStream(frame->getStreamId())) {
+        // RFC 7540, 5.1, frames in flight after RST_STREAM sent are ignored
         return false;
     }
+    if (isIdleStream(frame->getStreamId())) {
+        // RFC 7540, 5.1, the stream is never opened
+        connectionError(H2Error::PROTOCOL_ERROR);
+        return false;
+    }
+    // RFC 7540, 5.1 and 6.1, the stream is closed
+    streamError(frame->getStreamId(), H2Error::STREAM_CLOSED);
+    return false;
 }
 
 bool H2Connection::Impl::handleHeadersFrame(HeadersFrame *frame)
@@ -291,38 +428,54 @@ bool H2Connection::Impl::handleHeadersFrame(HeadersFrame *frame)
         return false;
     }
     H2StreamPtr stream = getStream(frame->getStreamId());
+    // the header block of a frame ignored is still decoded to keep HPACK state in sync
+    bool ignored = false;
     if (!stream) {
-        if (frame->getStreamId() < last_stream_id_) {
-            KM_ERRXTRACE("handleHeadersFrame, PROTOCOL_ERROR, streamId="<<frame->getStreamId()<<", last_id="<<last_stream_id_);
-            // RFC 7540, 5.1.1
-            connectionError(H2Error::PROTOCOL_ERROR);
-            return false;
-        }
-        if (opened_stream_count_ + 1 > max_concurrent_streams_) {
+        if (isResetStream(frame->getStreamId())) {
+            // RFC 7540, 5.1, frames in flight after RST_STREAM sent are ignored, e.g. trailers
+            ignored = true;
+        } else if (!isIdleStream(frame->getStreamId())) {
+            KM_WARNXTRACE("handleHeadersFrame, stream is closed, streamId="<<frame->getStreamId()<<", last_id="<<last_stream_id_);
+            // RFC 7540, 5.1, the stream is closed already
+            streamError(frame->getStreamId(), H2Error::STREAM_CLOSED);
+            ignored = true;
+        } else if (!tcp_conn_.isServer()) {
+            KM_WARNXTRACE("handleHeadersFrame, no local stream or promised stream, streamId="<<frame->getStreamId());
+            ignored = true; // client: no local steram or promised stream
+        } else if (opened_stream_count_ + 1 > max_concurrent_streams_) {
             KM_WARNXTRACE("handleHeadersFrame, too many concurrent streams, streamId="<<frame->getStreamId()<<", opened="<<opened_stream_count_<<", max="<<max_concurrent_streams_);
             // RFC 7540, 5.1.2
             streamError(frame->getStreamId(), H2Error::REFUSED_STREAM);
-            return false;
-        }
-        if (!tcp_conn_.isServer()) {
-            KM_WARNXTRACE("handleHeadersFrame, no local stream or promised stream, streamId="<<frame->getStreamId());
-            return false; // client: no local steram or promised stream
+            ignored = true;
         }
     }
     
     if (frame->hasEndHeaders()) {
         HeaderVector headers;
-        if (hp_decoder_.decode(frame->getBlock(), frame->getBlockSize(), headers) < 0) {
-            KM_ERRXTRACE("handleHeadersFrame, hpack decode failed");
-            // RFC 7540, 4.3
-            connectionError(H2Error::COMPRESSION_ERROR);
+        if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), true, headers)) {
+            return false;
+        }
+        if (ignored) {
+            return false;
+        }
+        if (hp_decoder_.isHeaderListTooLarge()) {
+            if (!stream) {
+                last_stream_id_ = frame->getStreamId();
+            }
+            onHeaderListTooLarge(frame->getStreamId());
             return false;
         }
         frame->setHeaders(std::move(headers), 0);
     } else {
         expect_continuation_frame_ = true;
         stream_id_of_expected_continuation_ = frame->getStreamId();
-        headers_block_buf_.assign(frame->getBlock(), frame->getBlock() + frame->getBlockSize());
+        continuation_headers_.clear();
+        if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), false, continuation_headers_)) {
+            return false;
+        }
+        if (ignored) {
+            return false;
+        }
     }
     
     if (!stream) {
@@ -385,6 +538,7 @@ bool H2Connection::Impl::handleSettingsFrame(SettingsFrame *frame)
             connectionError(H2Error::FRAME_SIZE_ERROR);
             return false;
         }
+        window_settings_pending_ = false;
         return true;
     } else { // send setings ack
         SettingsFrame settings;
@@ -433,20 +587,26 @@ bool H2Connection::Impl::handlePushFrame(PushPromiseFrame *frame)
     
     if (frame->hasEndHeaders()) {
         HeaderVector headers;
-        if (hp_decoder_.decode(frame->getBlock(), frame->getBlockSize(), headers) < 0) {
-            KM_ERRXTRACE("handlePushFrame, hpack decode failed");
-            // RFC 7540, 4.3
-            connectionError(H2Error::COMPRESSION_ERROR);
+        if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), true, headers)) {
+            return false;
+        }
+        if (hp_decoder_.isHeaderListTooLarge()) {
+            // the promised stream is never created
+            onHeaderListTooLarge(frame->getPromisedStreamId());
             return false;
         }
         frame->setHeaders(std::move(headers), 0);
     } else {
         expect_continuation_frame_ = true;
         stream_id_of_expected_continuation_ = frame->getPromisedStreamId();
-        headers_block_buf_.assign(frame->getBlock(), frame->getBlock() + frame->getBlockSize());
+        continuation_headers_.clear();
+        if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), false, continuation_headers_)) {
+            return false;
+        }
     }
     
     auto stream = createStream(frame->getPromisedStreamId());
+    last_stream_id_ = frame->getPromisedStreamId();
     PushClientPtr client(new PushClient());
     client->attachStream(this, stream);
     addPushClient(stream->getStreamId(), std::move(client));
@@ -472,6 +632,10 @@ bool H2Connection::Impl::handlePingFrame(PingFrame *frame)
         pingFrame.setAck(true);
         pingFrame.setData(frame->getData(), H2_PING_PAYLOAD_SIZE);
         sendH2Frame(&pingFrame);
+    } else if (memcmp(frame->getData(), kBdpPingData, H2_PING_PAYLOAD_SIZE) == 0) {
+        onBdpPingAck();
+    } else if (memcmp(frame->getData(), kHealthPingData, H2_PING_PAYLOAD_SIZE) == 0) {
+        onHealthPingAck();
     }
     return true;
 }
@@ -484,15 +648,37 @@ bool H2Connection::Impl::handleGoawayFrame(GoawayFrame *frame)
         connectionError(H2Error::PROTOCOL_ERROR);
         return false;
     }
-    tcp_conn_.close();
-    auto streams = std::move(streams_);
-    for (auto it : streams) {
-        it.second->onError(frame->getErrorCode());
+    goaway_received_ = true;
+    // the streams initiated by this side beyond last stream id are not processed
+    // by peer, they are refused so that the owners can retry them on other connection
+    std::vector<H2StreamPtr> refused_streams;
+    auto last_stream_id = frame->getLastStreamId();
+    streams_.forEach([this, last_stream_id, &refused_streams] (uint32_t stream_id, H2StreamPtr &stream) {
+        if (stream_id > last_stream_id && (stream_id & 1) == (next_stream_id_ & 1)) {
+            refused_streams.push_back(stream);
+        }
+    });
+    for (auto &stream : refused_streams) {
+        streams_.erase(stream->getStreamId());
+        auto state = stream->getState();
+        if (state == H2Stream::State::OPEN ||
+            state == H2Stream::State::HALF_CLOSED_L ||
+            state == H2Stream::State::HALF_CLOSED_R) {
+            --opened_stream_count_;
+        }
+        stream->onError(int(H2Error::REFUSED_STREAM));
     }
-    streams = std::move(promised_streams_);
-    for (auto it : streams) {
-        it.second->onError(frame->getErrorCode());
+    if (frame->getErrorCode() == uint32_t(H2Error::NOERR) && opened_stream_count_ > 0) {
+        // graceful shutdown, new streams go to other connection while the accepted ones complete
+        KM_INFOXTRACE("handleGoawayFrame, draining, streams="<<opened_stream_count_);
+        removeSelf();
+        return true;
     }
+    tcp_conn_.close();
+    auto streams = std::move(streams_);
+    streams.forEach([frame] (uint32_t, H2StreamPtr &stream) {
+        stream->onError(frame->getErrorCode());
+    });
     auto error_cb = std::move(error_cb_);
     removeSelf();
     if (error_cb) {
@@ -522,7 +708,7 @@ bool H2Connection::Impl::handleWindowUpdateFrame(WindowUpdateFrame *frame)
             connectionError(H2Error::PROTOCOL_ERROR);
             return false;
         }
-        bool need_notify = !blocked_streams_.empty();
+        bool need_notify = streams_.hasBlocked();
         flow_ctrl_.updateRemoteWindowSize(frame->getWindowSizeIncrement());
         if (need_notify && flow_ctrl_.remoteWindowSize() > 0) {
             notifyBlockedStreams();
@@ -530,7 +716,7 @@ bool H2Connection::Impl::handleWindowUpdateFrame(WindowUpdateFrame *frame)
         return true;
     } else {
         H2StreamPtr stream = getStream(frame->getStreamId());
-        if (!stream && tcp_conn_.isServer()) {
+        if (!stream && tcp_conn_.isServer() && frame->getStreamId() > last_stream_id_) {
             // new stream arrived on server side
             stream = createStream(frame->getStreamId());
             last_stream_id_ = frame->getStreamId();
@@ -557,30 +743,57 @@ bool H2Connection::Impl::handleContinuationFrame(ContinuationFrame *frame)
         return false;
     }
     H2StreamPtr stream = getStream(frame->getStreamId());
-    if (stream) {
-        headers_block_buf_.insert(headers_block_buf_.end(),
-                                  frame->getBlock(),
-                                  frame->getBlock() + frame->getBlockSize());
+    if (!stream) {
+        // the header block is ignored, but decoded to keep HPACK state in sync
+        if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), frame->hasEndHeaders(), continuation_headers_)) {
+            return false;
+        }
         if (frame->hasEndHeaders()) {
-            HeaderVector headers;
-            uint8_t *headers_block = headers_block_buf_.empty()?nullptr:&headers_block_buf_[0];
-            if (hp_decoder_.decode(headers_block, headers_block_buf_.size(), headers) < 0) {
-                KM_ERRXTRACE("handleContinuationFrame, hpack decode failed");
-                // RFC 7540, 4.3
-                connectionError(H2Error::COMPRESSION_ERROR);
-                return false;
-            }
-            frame->setHeaders(std::move(headers), 0);
             expect_continuation_frame_ = false;
-            headers_block_buf_.clear();
-            if (!handleHeadersComplete(frame->getStreamId(), frame->getHeaders())) {
-                // the stream is rejected by user
-                return false;
-            }
+            continuation_headers_.clear();
         }
-        return stream->handleContinuationFrame(frame);
+        return false;
+    }
+    if (!decodeHeaderBlock(frame->getBlock(), frame->getBlockSize(), frame->hasEndHeaders(), continuation_headers_)) {
+        return false;
+    }
+    if (frame->hasEndHeaders()) {
+        expect_continuation_frame_ = false;
+        if (hp_decoder_.isHeaderListTooLarge()) {
+            continuation_headers_.clear();
+            onHeaderListTooLarge(frame->getStreamId());
+            return false;
+        }
+        frame->setHeaders(std::move(continuation_headers_), 0);
+        continuation_headers_.clear();
+        if (!handleHeadersComplete(frame->getStreamId(), frame->getHeaders())) {
+            // the stream is rejected by user
+            return false;
+        }
+    }
+    return stream->handleContinuationFrame(frame);
+}
+
+bool H2Connection::Impl::decodeHeaderBlock(const uint8_t *block, size_t len, bool end_block, HeaderVector &headers)
+{
+    if (hp_decoder_.decode(block, len, end_block, headers) < 0) {
+        KM_ERRXTRACE("decodeHeaderBlock, hpack decode failed");
+        // RFC 7540, 4.3
+        connectionError(H2Error::COMPRESSION_ERROR);
+        return false;
+    }
+    return true;
+}
+
+void H2Connection::Impl::onHeaderListTooLarge(uint32_t stream_id)
+{
+    KM_WARNXTRACE("onHeaderListTooLarge, streamId="<<stream_id<<", max="<<max_header_list_size_);
+    H2StreamPtr stream = getStream(stream_id);
+    // RFC 7540, 10.5.1
+    streamError(stream_id, H2Error::ENHANCE_YOUR_CALM);
+    if (stream) {
+        stream->onError(int(H2Error::ENHANCE_YOUR_CALM));
     }
-    return false;
 }
 
 bool H2Connection::Impl::handleHeadersComplete(uint32_t stream_id, const HeaderVector &header_vec)
@@ -683,6 +896,7 @@ bool H2Connection::Impl::onFrame(H2Frame *frame)
         connectionError(H2Error::PROTOCOL_ERROR);
         return false;
     }
+    frame_received_ = true;
     switch (frame->type()) {
         case H2FrameType::DATA:
             handleDataFrame(dynamic_cast<DataFrame*>(frame));
@@ -743,36 +957,29 @@ void H2Connection::Impl::onFrameError(const FrameHeader &hdr, H2Error err, bool
 void H2Connection::Impl::addStream(H2StreamPtr stream)
 {
     KM_INFOXTRACE("addStream, streamId="<<stream->getStreamId());
-    if (isPromisedStream(stream->getStreamId())) {
-        promised_streams_[stream->getStreamId()] = stream;
-    } else {
-        streams_[stream->getStreamId()] = stream;
-    }
+    streams_.insert(stream->getStreamId(), std::move(stream));
 }
 
 H2StreamPtr H2Connection::Impl::getStream(uint32_t stream_id)
 {
-    auto &streams = isPromisedStream(stream_id) ? promised_streams_ : streams_;
-    auto it = streams.find(stream_id);
-    if (it != streams.end()) {
-        return it->second;
-    }
-    return H2StreamPtr();
+    auto stream = streams_.find(stream_id);
+    return stream ? *stream : H2StreamPtr();
 }
 
 void H2Connection::Impl::removeStream(uint32_t stream_id)
 {
     KM_INFOXTRACE("removeStream, streamId="<<stream_id);
-    if (isPromisedStream(stream_id)) {
-        promised_streams_.erase(stream_id);
-    } else {
+    auto stream = streams_.find(stream_id);
+    if (stream) {
+        H2StreamPtr s = std::move(*stream);
         streams_.erase(stream_id);
+        recycleStream(std::move(s));
     }
 }
 
 void H2Connection::Impl::addPushClient(uint32_t push_id, PushClientPtr client)
 {
-    push_clients_[push_id] = std::move(client);
+    push_clients_.insert(push_id, std::move(client));
 }
 
 void H2Connection::Impl::removePushClient(uint32_t push_id)
@@ -782,12 +989,83 @@ void H2Connection::Impl::removePushClient(uint32_t push_id)
 
 PushClient* H2Connection::Impl::getPushClient(const std::string &cache_key)
 {
-    for (auto &it : push_clients_) {
-        if (kev::is_equal(cache_key, it.second->getCacheKey())) {
-            return it.second.get();
+    PushClient *push_client = nullptr;
+    push_clients_.forEach([&] (uint32_t, PushClientPtr &client) {
+        if (!push_client && kev::is_equal(cache_key, client->getCacheKey())) {
+            push_client = client.get();
         }
+    });
+    return push_client;
+}
+
+KMError H2Connection::Impl::pushResource(uint32_t assoc_stream_id, const std::string &scheme, const std::string &authority, const std::string &path)
+{
+    if (!tcp_conn_.isServer() || getState() != State::OPEN) {
+        return KMError::INVALID_STATE;
+    }
+    if (!remote_enable_push_) {
+        return KMError::NOT_SUPPORTED;
+    }
+    auto cache_key = authority + path;
+    if (pushed_keys_.find(cache_key) != pushed_keys_.end()) {
+        // client has it already
+        return KMError::ALREADY_EXIST;
+    }
+    if (push_servers_.size() >= remote_max_concurrent_streams_) {
+        return KMError::AGAIN;
+    }
+    auto assoc_stream = getStream(assoc_stream_id);
+    if (!assoc_stream) {
+        return KMError::INVALID_STATE;
+    }
+    // PUSH_PROMISE is sent on a stream that is open or half-closed (remote) only
+    auto assoc_state = assoc_stream->getState();
+    if (assoc_state != H2Stream::State::OPEN && assoc_state != H2Stream::State::HALF_CLOSED_R) {
+        return KMError::INVALID_STATE;
+    }
+    auto resource = PushCache::instance().getResource(authority, path);
+    if (!resource) {
+        return KMError::NOT_EXIST;
+    }
+    
+    HeaderVector req_headers;
+    size_t req_headers_size = 0;
+    auto add_header = [&req_headers, &req_headers_size] (const std::string &name, const std::string &value) {
+        req_headers.emplace_back(name, value);
+        req_headers_size += name.size() + value.size();
+    };
+    add_header(H2HeaderMethod, "GET");
+    add_header(H2HeaderScheme, scheme);
+    add_header(H2HeaderAuthority, authority);
+    add_header(H2HeaderPath, path);
+    
+    auto stream = createStream();
+    PushServerPtr server(new PushServer());
+    server->attachStream(this, stream, std::move(resource));
+    auto *push_server = server.get();
+    push_servers_.insert(stream->getStreamId(), std::move(server));
+    KM_INFOXTRACE("pushResource, path="<<path<<", streamId="<<stream->getStreamId()<<", assoc="<<assoc_stream_id);
+    auto ret = push_server->push(assoc_stream_id, req_headers, req_headers_size);
+    if (ret != KMError::NOERR) {
+        KM_WARNXTRACE("pushResource, failed to push, path="<<path<<", err="<<int(ret));
+        removePushServer(stream->getStreamId());
+        return ret;
+    }
+    // recorded on success only, a failed push may be retried
+    pushed_keys_.insert(std::move(cache_key));
+    return ret;
+}
+
+void H2Connection::Impl::removePushServer(uint32_t push_id)
+{
+    // it may be called by push server itself, remove it later
+    auto loop = eventLoop();
+    if (loop) {
+        loop->post([this, push_id] {
+            push_servers_.erase(push_id);
+            removeStream(push_id);
+        }, &loop_token_);
     }
-    return nullptr;
 }
 
 void H2Connection::Impl::addConnectListener(long uid, ConnectCallback cb)
@@ -802,7 +1080,7 @@ void H2Connection::Impl::removeConnectListener(long uid)
 
 void H2Connection::Impl::appendBlockedStream(uint32_t stream_id)
 {
-    blocked_streams_[stream_id] = stream_id;
+    streams_.block(stream_id);
 }
 
 void H2Connection::Impl::notifyBlockedStreams()
@@ -810,19 +1088,14 @@ void H2Connection::Impl::notifyBlockedStreams()
     if (!tcp_conn_.sendBufferEmpty() || remoteWindowSize() == 0) {
         return;
     }
-    auto streams = std::move(blocked_streams_);
-    auto it = streams.begin();
-    while (it != streams.end() && tcp_conn_.sendBufferEmpty() && remoteWindowSize() > 0) {
-        uint32_t stream_id = it->second;
-        it = streams.erase(it);
-        auto stream = getStream(stream_id);
+    // the streams blocked again in onWrite are appended to the tail and wait for next round
+    auto count = streams_.blockedCount();
+    while (count-- > 0 && tcp_conn_.sendBufferEmpty() && remoteWindowSize() > 0) {
+        auto stream = getStream(streams_.unblockFront());
         if (stream) {
             stream->onWrite();
         }
     }
-    if (!streams.empty()) {
-        blocked_streams_.insert(streams.begin(), streams.end());
-    }
 }
 
 void H2Connection::Impl::onLoopActivity(kev::LoopActivity acti)
@@ -867,6 +1140,8 @@ void H2Connection::Impl::setupH2Handshake()
 {
     handshake_.reset(new H2Handshake());
     handshake_->setLocalWindowSize(flow_ctrl_.localWindowSize());
+    handshake_->setHeaderTableSize(header_table_size_);
+    handshake_->setMaxHeaderListSize(max_header_list_size_);
     handshake_->setHandshakeSender([this] (KMBuffer &buf) {
         return sendData(buf);
     });
@@ -907,6 +1182,7 @@ void H2Connection::Impl::onConnect(KMError err, const std::string &host)
 
 void H2Connection::Impl::onWrite()
 {// send_buffer_ must be empty
+    send_saturated_ = false;
     if (getState() == State::OPEN) {
         notifyBlockedStreams();
     }
@@ -930,7 +1206,7 @@ void H2Connection::Impl::onConnectError(KMError err)
     auto conn_key(std::move(key_));
     auto secure = tcp_conn_.sslEnabled();
     notifyListeners(err);
-    H2ConnectionMgr::removeConnection(conn_key, secure);
+    H2ConnectionMgr::removeConnection(conn_key, this, secure);
 }
 
 KMError H2Connection::Impl::sendWindowUpdate(uint32_t stream_id, uint32_t delta)
@@ -952,8 +1228,14 @@ bool H2Connection::Impl::applySettings(const ParamVector &params)
         KM_INFOXTRACE("applySettings, id="<<kv.first<<", value="<<kv.second);
         switch (kv.first) {
             case HEADER_TABLE_SIZE:
-                hp_decoder_.setMaxTableSize(kv.second);
+            {
+                // peer's decoder table size, the encoder may use less than it
+                auto table_size = std::min(kv.second, header_table_size_);
+                if (table_size != hp_encoder_.getTableSize()) {
+                    hp_encoder_.updateTableSize(table_size);
+                }
                 break;
+            }
             case INITIAL_WINDOW_SIZE:
                 if (kv.second > H2_MAX_WINDOW_SIZE) {
                     // RFC 7540, 6.5.2
@@ -971,6 +1253,7 @@ bool H2Connection::Impl::applySettings(const ParamVector &params)
                 max_remote_frame_size_ = kv.second;
                 break;
             case MAX_CONCURRENT_STREAMS:
+                remote_max_concurrent_streams_ = kv.second;
                 break;
             case ENABLE_PUSH:
                 if (kv.second != 0 && kv.second != 1) {
@@ -978,6 +1261,7 @@ bool H2Connection::Impl::applySettings(const ParamVector &params)
                     connectionError(H2Error::PROTOCOL_ERROR);
                     return false;
                 }
+                remote_enable_push_ = kv.second == 1;
                 break;
             case ENABLE_CONNECT_PROTOCOL:
                 enable_connect_protocol_ = kv.second == 1;
@@ -992,12 +1276,139 @@ void H2Connection::Impl::updateInitialWindowSize(uint32_t ws)
     if (ws != init_remote_window_size_) {
         long delta = int32_t(ws - init_remote_window_size_);
         init_remote_window_size_ = ws;
-        for (auto it : streams_) {
-            it.second->updateRemoteWindowSize(delta);
-        }
-        for (auto it : promised_streams_) {
-            it.second->updateRemoteWindowSize(delta);
+        streams_.forEach([delta] (uint32_t, H2StreamPtr &stream) {
+            stream->updateRemoteWindowSize(delta);
+        });
+    }
+}
+
+void H2Connection::Impl::sendBdpPing()
+{
+    PingFrame frame;
+    frame.setStreamId(0);
+    frame.setData(kBdpPingData, H2_PING_PAYLOAD_SIZE);
+    if (sendH2Frame(&frame) == KMError::NOERR) {
+        bdp_estimator_.pingSent();
+    }
+}
+
+void H2Connection::Impl::onBdpPingAck()
+{
+    if (bdp_estimator_.pingAcked() > 0) {
+        adjustLocalWindowSize();
+    }
+}
+
+void H2Connection::Impl::scheduleHealthPing()
+{
+    if (ping_interval_ms_ == 0 || getState() != State::OPEN) {
+        return;
+    }
+    ping_timer_.schedule(ping_interval_ms_, kev::Timer::Mode::ONE_SHOT, [this] {
+        sendHealthPing();
+    });
+}
+
+void H2Connection::Impl::sendHealthPing()
+{
+    PingFrame frame;
+    frame.setStreamId(0);
+    frame.setData(kHealthPingData, H2_PING_PAYLOAD_SIZE);
+    frame_received_ = false;
+    if (sendH2Frame(&frame) != KMError::NOERR) {
+        onHealthPingTimeout();
+        return;
+    }
+    health_ping_outstanding_ = true;
+    health_ping_time_ = std::chrono::steady_clock::now();
+    ping_timer_.schedule(ping_timeout_ms_, kev::Timer::Mode::ONE_SHOT, [this] {
+        onHealthPingTimeout();
+    });
+}
+
+void H2Connection::Impl::onHealthPingAck()
+{
+    if (!health_ping_outstanding_) {
+        return;
+    }
+    health_ping_outstanding_ = false;
+    // the ack may arrive after timeout
+    healthy_ = true;
+    auto rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - health_ping_time_).count();
+    rtt_stats_.update(rtt > 0 ? uint32_t(rtt) : 1);
+    KM_INFOXTRACE("onHealthPingAck, rtt="<<rtt_stats_.latest()<<"us, srtt="<<rtt_stats_.smoothed()<<"us");
+    scheduleHealthPing();
+}
+
+void H2Connection::Impl::onHealthPingTimeout()
+{
+    if (frame_received_ && health_ping_outstanding_) {
+        // peer is alive, the ack may be queued behind the data in flight
+        frame_received_ = false;
+        ping_timer_.schedule(ping_timeout_ms_, kev::Timer::Mode::ONE_SHOT, [this] {
+            onHealthPingTimeout();
+        });
+        return;
+    }
+    KM_WARNXTRACE("onHealthPingTimeout, timeout="<<ping_timeout_ms_<<"ms, srtt="<<rtt_stats_.smoothed()<<"us, opened="<<opened_stream_count_);
+    // the connection is not reused, the open streams are let to complete
+    healthy_ = false;
+    if (opened_stream_count_ > 0) {
+        return;
+    }
+    health_ping_outstanding_ = false;
+    auto streams = std::move(streams_);
+    streams.forEach([] (uint32_t, H2StreamPtr &stream) {
+        stream->onError(int(H2Error::CANCEL));
+    });
+    onError(KMError::TIMEOUT);
+}
+
+void H2Connection::Impl::adjustLocalWindowSize()
+{
+    if (window_settings_pending_) {
+        // wait for peer to apply the last change
+        return;
+    }
+    auto &budget = WindowBudget::get();
+    auto ws = init_local_window_size_;
+    if (budget.underPressure()) {
+        // new and idle streams advertise less until the budget is relaxed
+        ws = std::max(init_local_window_size_ / 2, H2_DEFAULT_WINDOW_SIZE);
+    } else if (budget.relaxed()) {
+        // grow to the window measured by BDP
+        ws = std::max(bdp_estimator_.windowSize(), init_local_window_size_);
+    }
+    if (ws == init_local_window_size_) {
+        return;
+    }
+    KM_INFOXTRACE("adjustLocalWindowSize, window="<<ws<<", old="<<init_local_window_size_<<", budget_used="<<budget.used()<<", rtt="<<bdp_estimator_.rtt()<<"us");
+    bool grow = ws > init_local_window_size_;
+    init_local_window_size_ = ws;
+    // peer will apply the delta to all the stream windows when SETTINGS received
+    streams_.forEach([ws, grow] (uint32_t, H2StreamPtr &stream) {
+        if (grow) {
+            stream->growLocalWindowSize(ws);
+        } else {
+            stream->shrinkLocalWindowSize(ws);
         }
+    });
+    SettingsFrame settings;
+    settings.setStreamId(0);
+    ParamVector params;
+    params.emplace_back(std::make_pair(INITIAL_WINDOW_SIZE, ws));
+    settings.setParams(std::move(params));
+    if (sendH2Frame(&settings) == KMError::NOERR) {
+        window_settings_pending_ = true;
+    }
+    if (!grow) {
+        return;
+    }
+    
+    // connection window should hold at least two streams at full speed
+    auto conn_ws = std::min<uint64_t>(uint64_t(ws) * 2, bdp_estimator_.maxWindowSize());
+    if (conn_ws > flow_ctrl_.localWindowStep()) {
+        flow_ctrl_.growLocalWindow(uint32_t(conn_ws), true);
     }
 }
 
@@ -1011,6 +1422,23 @@ void H2Connection::Impl::sendGoaway(H2Error err)
     sendH2Frame(&frame);
 }
 
+void H2Connection::Impl::onDrained()
+{
+    if (getState() != State::OPEN || opened_stream_count_ > 0) {
+        return;
+    }
+    if (!goaway_received_ && healthy_) {
+        // PING is acked after all
+        return;
+    }
+    KM_INFOXTRACE("onDrained, all streams are completed, goaway="<<goaway_received_<<", healthy="<<healthy_);
+    auto error_cb = std::move(error_cb_);
+    cleanupAndRemove();
+    if (error_cb) {
+        error_cb(int(H2Error::NOERR));
+    }
+}
+
 void H2Connection::Impl::connectionError(H2Error err)
 {
     sendGoaway(err);
@@ -1026,6 +1454,7 @@ void H2Connection::Impl::streamError(uint32_t stream_id, H2Error err)
     if (stream) {
         stream->streamError(err);
     } else {
+        streamReset(stream_id);
         RSTStreamFrame frame;
         frame.setStreamId(stream_id);
         frame.setErrorCode(uint32_t(err));
@@ -1033,6 +1462,31 @@ void H2Connection::Impl::streamError(uint32_t stream_id, H2Error err)
     }
 }
 
+void H2Connection::Impl::streamReset(uint32_t stream_id)
+{
+    if (isResetStream(stream_id)) {
+        return;
+    }
+    if (reset_streams_.size() >= H2_MAX_RESET_STREAMS) {
+        reset_streams_.pop_front();
+    }
+    reset_streams_.push_back(stream_id);
+}
+
+bool H2Connection::Impl::isResetStream(uint32_t stream_id) const
+{
+    return std::find(reset_streams_.begin(), reset_streams_.end(), stream_id) != reset_streams_.end();
+}
+
+bool H2Connection::Impl::isIdleStream(uint32_t stream_id) const
+{
+    if ((stream_id & 1) == (next_stream_id_ & 1)) {
+        // initiated by local
+        return stream_id >= next_stream_id_;
+    }
+    return stream_id > last_stream_id_;
+}
+
 void H2Connection::Impl::streamOpened(uint32_t stream_id)
 {
     ++opened_stream_count_;
@@ -1041,6 +1495,14 @@ void H2Connection::Impl::streamOpened(uint32_t stream_id)
 void H2Connection::Impl::streamClosed(uint32_t stream_id)
 {
     --opened_stream_count_;
+    // the stream is still in use by the caller, it is removed at next stream creation
+    closed_streams_.push_back(stream_id);
+    if ((goaway_received_ || !healthy_) && opened_stream_count_ == 0) {
+        auto loop = eventLoop();
+        if (loop) {
+            loop->post([this] { onDrained(); }, &loop_token_);
+        }
+    }
 }
 
 void H2Connection::Impl::onStateOpen()
@@ -1048,6 +1510,7 @@ void H2Connection::Impl::onStateOpen()
     KM_INFOXTRACE("onStateOpen");
     setState(State::OPEN);
     handshake_.reset();
+    scheduleHealthPing();
     if (!tcp_conn_.isServer()) {
         // stream 1 for upgrade response
         // stream 1 data is discarded
@@ -1073,6 +1536,6 @@ void H2Connection::Impl::removeSelf()
     if (!key_.empty()) {
         std::string key(std::move(key_));
         // will destroy self when calling from loop stop
-        H2ConnectionMgr::removeConnection(key, tcp_conn_.sslEnabled());
+        H2ConnectionMgr::removeConnection(key, this, tcp_conn_.sslEnabled());
     }
 }
@@ -27,6 +27,8 @@
 #include "hpack/HPacker.h"
 #include "H2Stream.h"
 #include "PushClient.h"
+#include "PushServer.h"
+#include "StreamTable.h"
 #include "TcpSocketImpl.h"
 #include "TcpConnection.h"
 #include "http/HttpParserImpl.h"
@@ -35,6 +37,9 @@
 #include "proxy/ProxyConnectionImpl.h"
 
 #include <map>
+#include <deque>
+#include <unordered_set>
+#include <atomic>
 #include <vector>
 
 using namespace hpack;
@@ -68,8 +73,52 @@ public:
     void removeConnectListener(long uid);
     
     KMError sendH2Frame(H2Frame *frame);
+    uint32_t getMaxRemoteFrameSize() const { return max_remote_frame_size_; }
+    
+    /*
+     * set the size of HPACK dynamic table, it is advertised by SETTINGS_HEADER_TABLE_SIZE
+     * and limits the table size used by encoder. must be called before connecting
+     */
+    void setHeaderTableSize(uint32_t table_size);
+    /*
+     * set SETTINGS_MAX_HEADER_LIST_SIZE, it is enforced while the header block is decoded,
+     * and the stream is reset once the limit is exceeded. must be called before connecting
+     */
+    void setMaxHeaderListSize(uint32_t list_size);
+    /*
+     * set the upper limit of receive window, the stream and connection windows
+     * are grown automatically towards bandwidth-delay product but never beyond it
+     */
+    void setMaxLocalWindowSize(uint32_t max_window_size);
+    /*
+     * send PING every interval_ms once the connection is open, the connection is closed
+     * and removed from H2ConnectionMgr if a PING is not acked in timeout_ms.
+     * interval_ms 0 disables the health check, it is enabled by H2ConnectionMgr for pooled connections
+     */
+    void setPingInterval(uint32_t interval_ms, uint32_t timeout_ms);
+    const RttStats& getRttStats() const { return rtt_stats_; }
+    bool isHealthy() const { return healthy_; }
+    /*
+     * true once GOAWAY is received, no new stream should be created on the connection,
+     * it is closed after the streams accepted by peer are completed
+     */
+    bool isDraining() const { return goaway_received_; }
     
     bool isReady() const { return getState() == State::OPEN; }
+    /*
+     * stream slots reserved by H2ConnectionMgr for client requests, they are
+     * thread safe so that connection pool can balance the load across event loops
+     */
+    void reserveStream() { ++reserved_streams_; }
+    void releaseStream() { --reserved_streams_; }
+    uint32_t streamLoad() const { return reserved_streams_; }
+    /*
+     * true if remote MAX_CONCURRENT_STREAMS is reached or send buffer is not drained
+     */
+    bool isSaturated() const
+    {
+        return reserved_streams_ >= remote_max_concurrent_streams_ || send_saturated_;
+    }
     bool isConnectProtocolEnabled() const { return enable_connect_protocol_; }
     
     void setConnectionKey(const std::string &key);
@@ -81,6 +130,14 @@ public:
     void removeStream(uint32_t stream_id);
     void removePushClient(uint32_t push_id);
     
+    /*
+     * server only, push the resource in PushCache on a new promised stream.
+     * the resource is pushed once on this connection, and the pushes are limited by
+     * peer's SETTINGS_ENABLE_PUSH and SETTINGS_MAX_CONCURRENT_STREAMS
+     */
+    KMError pushResource(uint32_t assoc_stream_id, const std::string &scheme, const std::string &authority, const std::string &path);
+    void removePushServer(uint32_t push_id);
+    
     uint32_t remoteWindowSize() { return flow_ctrl_.remoteWindowSize(); }
     void appendBlockedStream(uint32_t stream_id);
     
@@ -95,6 +152,8 @@ public:
     void streamError(uint32_t stream_id, H2Error err);
     void streamOpened(uint32_t stream_id);
     void streamClosed(uint32_t stream_id);
+    // RST_STREAM is sent on the stream
+    void streamReset(uint32_t stream_id);
     
 public:
     bool onFrame(H2Frame *frame) override;
@@ -109,7 +168,9 @@ private:
 private:
     KMError connect_i(const std::string &host, uint16_t port);
     KMError sendData(const KMBuffer &buf);
+    KMError sendDataFrame(DataFrame *frame);
     KMError sendHeadersFrame(HeadersFrame *frame);
+    KMError sendPushPromiseFrame(PushPromiseFrame *frame);
     KMError parseInputData(const uint8_t *buf, size_t len);
     bool handleDataFrame(DataFrame *frame);
     bool handleHeadersFrame(HeadersFrame *frame);
@@ -123,8 +184,22 @@ private:
     bool handleContinuationFrame(ContinuationFrame *frame);
     
     bool handleHeadersComplete(uint32_t stream_id, const HeaderVector &header_vec);
+    /*
+     * decode a fragment of header block, false is returned on decoding error
+     */
+    bool decodeHeaderBlock(const uint8_t *block, size_t len, bool end_block, HeaderVector &headers);
+    void onHeaderListTooLarge(uint32_t stream_id);
     
     void addStream(H2StreamPtr stream);
+    H2StreamPtr newStream(uint32_t stream_id);
+    /*
+     * put the stream back to stream_pool_ if no one else refers to it
+     */
+    void recycleStream(H2StreamPtr stream);
+    /*
+     * remove the closed streams that are released by their owners
+     */
+    void reclaimClosedStreams();
     void addPushClient(uint32_t push_id, PushClientPtr client);
     
     void setupH2Handshake();
@@ -149,10 +224,20 @@ private:
     void notifyBlockedStreams();
     KMError sendWindowUpdate(uint32_t stream_id, uint32_t delta);
     bool isControlFrame(H2Frame *frame);
+    bool isIdleStream(uint32_t stream_id) const;
+    bool isResetStream(uint32_t stream_id) const;
     
     bool applySettings(const ParamVector &params);
     void updateInitialWindowSize(uint32_t ws);
+    void sendBdpPing();
+    void onBdpPingAck();
+    void scheduleHealthPing();
+    void sendHealthPing();
+    void onHealthPingAck();
+    void onHealthPingTimeout();
+    void adjustLocalWindowSize();
     void sendGoaway(H2Error err);
+    void onDrained();
     
     void notifyListeners(KMError err);
     void removeSelf();
@@ -173,20 +258,43 @@ protected:
     HPacker hp_encoder_;
     HPacker hp_decoder_;
     
-    std::vector<uint8_t> headers_block_buf_;
+    // the headers decoded so far when header block is continued by CONTINUATION frames
+    HeaderVector continuation_headers_;
     
-    std::map<uint32_t, H2StreamPtr> streams_;
-    std::map<uint32_t, H2StreamPtr> promised_streams_;
-    std::map<uint32_t, uint32_t> blocked_streams_;
+    // both the initiated and the promised streams, it links blocked streams as well
+    StreamTable<H2StreamPtr> streams_;
+    // closed streams are removed from streams_ when their owners release them
+    std::vector<uint32_t> closed_streams_;
+    std::vector<H2StreamPtr> stream_pool_;
+    // the streams reset recently by local, the frames in flight on them are ignored
+    std::deque<uint32_t> reset_streams_;
     
-    std::map<uint32_t, PushClientPtr> push_clients_;
+    StreamTable<PushClientPtr> push_clients_;
+    StreamTable<PushServerPtr> push_servers_;
+    std::unordered_set<std::string> pushed_keys_;
+    bool remote_enable_push_ = true;
     
     uint32_t max_local_frame_size_ = 65536;
     uint32_t max_remote_frame_size_ = H2_DEFAULT_FRAME_SIZE;
     uint32_t init_remote_window_size_ = H2_DEFAULT_WINDOW_SIZE;
     uint32_t init_local_window_size_ = H2_LOCAL_STREAM_INITIAL_WINDOW_SIZE; // initial local stream window size
+    uint32_t header_table_size_ = H2_LOCAL_HEADER_TABLE_SIZE;
+    uint32_t max_header_list_size_ = H2_LOCAL_MAX_HEADER_LIST_SIZE;
     
     FlowControl flow_ctrl_;
+    BdpEstimator bdp_estimator_;
+    // SETTINGS_INITIAL_WINDOW_SIZE is sent and not acked yet
+    bool window_settings_pending_ = false;
+    
+    uint32_t ping_interval_ms_ = 0;
+    uint32_t ping_timeout_ms_ = H2_PING_TIMEOUT_MS;
+    bool health_ping_outstanding_ = false;
+    // any frame received after the health PING is sent proves the connection alive
+    bool frame_received_ = false;
+    std::chrono::steady_clock::time_point health_ping_time_;
+    RttStats rtt_stats_;
+    std::atomic_bool healthy_{true};
+    std::atomic_bool goaway_received_{false};
     
     uint32_t next_stream_id_ = 0;
     uint32_t last_stream_id_ = 0;
@@ -194,12 +302,17 @@ protected:
     uint32_t max_concurrent_streams_ = 128;
     uint32_t opened_stream_count_ = 0;
     
+    std::atomic<uint32_t> remote_max_concurrent_streams_{H2_DEFAULT_MAX_CONCURRENT_STREAMS};
+    std::atomic<uint32_t> reserved_streams_{0};
+    std::atomic_bool send_saturated_{false};
+    
     bool enable_connect_protocol_ = false;
     bool expect_continuation_frame_ = false;
     uint32_t stream_id_of_expected_continuation_ = 0;
     
     ProxyConnection::Impl tcp_conn_;
     EventLoopToken loop_token_;
+    Timer::Impl ping_timer_;
 };
 
 using H2ConnectionPtr = std::shared_ptr<H2Connection::Impl>;
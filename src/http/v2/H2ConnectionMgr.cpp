@@ -23,69 +23,241 @@
 #include "libkev/src/util/kmtrace.h"
 #include "DnsResolver.h"
 
+#include <algorithm>
+
 using namespace kuma;
 
+namespace {
+    // true if a new stream is expected to complete earlier on c1, the RTT is
+    // taken into account once it is measured on both connections
+    bool isPreferred(const H2ConnectionPtr &c1, const H2ConnectionPtr &c2)
+    {
+        auto rtt1 = c1->getRttStats().smoothed();
+        auto rtt2 = c2->getRttStats().smoothed();
+        if (rtt1 == 0 || rtt2 == 0) {
+            return c1->streamLoad() < c2->streamLoad();
+        }
+        return uint64_t(c1->streamLoad() + 1) * rtt1 < uint64_t(c2->streamLoad() + 1) * rtt2;
+    }
+}
 
 H2ConnectionMgr H2ConnectionMgr::req_conn_mgr_;
 H2ConnectionMgr H2ConnectionMgr::req_secure_conn_mgr_;
+std::atomic<uint32_t> H2ConnectionMgr::ping_interval_ms_{H2_PING_INTERVAL_MS};
+std::atomic<uint32_t> H2ConnectionMgr::ping_timeout_ms_{H2_PING_TIMEOUT_MS};
+std::atomic<uint32_t> H2ConnectionMgr::max_window_size_{H2_LOCAL_MAX_WINDOW_SIZE};
 //////////////////////////////////////////////////////////////////////////
 
 void H2ConnectionMgr::addConnection(const std::string &key, H2ConnectionPtr &conn)
 {
     std::lock_guard<std::mutex> g(conn_mutex_);
-    conn_map_[key] = conn;
+    conn_map_[key].push_back(conn);
 }
 
 void H2ConnectionMgr::addConnection(const std::string &key, H2ConnectionPtr &&conn)
 {
     std::lock_guard<std::mutex> g(conn_mutex_);
-    conn_map_[key] = std::move(conn);
+    conn_map_[key].push_back(std::move(conn));
 }
 
 H2ConnectionPtr H2ConnectionMgr::getConnection(const std::string &key)
 {
     std::lock_guard<std::mutex> g(conn_mutex_);
     auto it = conn_map_.find(key);
-    return it != conn_map_.end() ? it->second : nullptr;
+    return it != conn_map_.end() && !it->second.empty() ? it->second.front() : nullptr;
+}
+
+bool H2ConnectionMgr::selectConnection(const H2ConnectionList &conns, const EventLoopPtr &loop, H2ConnectionPtr &conn)
+{// return true if conn is selected, false if a new connection should be created on loop
+    H2ConnectionPtr local_free; // preferred unsaturated connection on loop
+    H2ConnectionPtr local_conn; // preferred connection on loop
+    H2ConnectionPtr remote_conn; // preferred unsaturated connection on other loops
+    size_t local_count = 0;
+    for (auto &c : conns) {
+        if (!c->isHealthy() || c->isDraining()) {
+            continue; // it is being removed
+        }
+        if (c->eventLoop() == loop) {
+            ++local_count;
+            if (!c->isSaturated() && (!local_free || isPreferred(c, local_free))) {
+                local_free = c;
+            }
+            if (!local_conn || isPreferred(c, local_conn)) {
+                local_conn = c;
+            }
+        } else if (!c->isSaturated()) {
+            if (!remote_conn || isPreferred(c, remote_conn)) {
+                remote_conn = c;
+            }
+        }
+    }
+    if (local_free) {
+        conn = local_free;
+        return true;
+    }
+    if (local_count < H2_MAX_CONNECTIONS_PER_LOOP && conns.size() < H2_MAX_CONNECTIONS_PER_ORIGIN) {
+        return false;
+    }
+    // pool is full, prefer an unsaturated connection on other loop to queuing on a saturated one
+    conn = remote_conn ? remote_conn : local_conn;
+    if (!conn) {
+        for (auto &c : conns) {
+            if (c->isHealthy() && !c->isDraining() && (!conn || isPreferred(c, conn))) {
+                conn = c;
+            }
+        }
+    }
+    return !!conn;
 }
 
 H2ConnectionPtr H2ConnectionMgr::getConnection(const std::string &host, uint16_t port, uint32_t ssl_flags, const EventLoopPtr &loop, const ProxyInfo &proxy_info)
 {
-    std::string key;
-    std::string ip;
-    sockaddr_storage ss_addr = { 0 };
-    auto ret = DnsResolver::get().resolve(host, port, ss_addr);
-    if (ret == KMError::NOERR && kev::km_get_sock_addr(ss_addr, ip, nullptr) == 0) {
-        key = ip + ":" + std::to_string(port);
-    } else {
-        key = host + ":" + std::to_string(port);
+    // never block on DNS here, the address is only used for coalescing if it is cached already
+    auto key = host + ":" + std::to_string(port);
+    std::string addr_key;
+    bool coalesce = proxy_info.url.empty() && !kev::km_is_ip_address(host.c_str());
+    if (coalesce) {
+        addr_key = getAddressKey(host, port);
     }
     std::lock_guard<std::mutex> g(conn_mutex_);
-    auto it = conn_map_.find(key);
-    if (it != conn_map_.end()) {
-        return it->second;
+    auto &conns = conn_map_[key];
+    H2ConnectionPtr conn;
+    if (selectConnection(conns, loop, conn)) {
+        // pending connects to the same origin are coalesced as well
+        conn->reserveStream();
+        return conn;
     }
-    H2ConnectionPtr conn(new H2Connection::Impl(loop));
+    if (!addr_key.empty()) {
+        auto it = addr_conn_map_.find(addr_key);
+        if (it != addr_conn_map_.end() && selectConnection(it->second, loop, conn) &&
+            !conn->isSaturated() && conn->getSslFlags() == ssl_flags)
+        {
+            KM_INFOTRACE("H2ConnectionMgr::getConnection, coalesced, key="<<key<<", addr="<<addr_key);
+            conn->reserveStream();
+            return conn;
+        }
+    }
+    conn.reset(new H2Connection::Impl(loop));
     conn->setConnectionKey(key);
     conn->setSslFlags(ssl_flags);
     conn->setProxyInfo(proxy_info);
+    conn->setPingInterval(ping_interval_ms_, ping_timeout_ms_);
+    conn->setMaxLocalWindowSize(max_window_size_);
     if (conn->connect(host, port) != KMError::NOERR) {
+        if (conns.empty()) {
+            conn_map_.erase(key);
+        }
         return H2ConnectionPtr();
     }
-    conn_map_[key] = conn;
+    KM_INFOTRACE("H2ConnectionMgr::getConnection, new connection, key="<<key<<", count="<<conns.size() + 1);
+    conn->reserveStream();
+    conns.push_back(conn);
+    if (coalesce) {
+        if (addr_key.empty()) {
+            resolveAddress(key, host, port, conn);
+        } else {
+            addr_conn_map_[addr_key].push_back(conn);
+        }
+    }
     return conn;
 }
 
-void H2ConnectionMgr::removeConnection(const std::string key)
+std::string H2ConnectionMgr::getAddressKey(const std::string &host, uint16_t port)
 {
+    std::string ip;
+    sockaddr_storage ss_addr = { 0 };
+    if (DnsResolver::get().getAddress(host, port, ss_addr) == KMError::NOERR &&
+        kev::km_get_sock_addr(ss_addr, ip, nullptr) == 0) {
+        return ip + ":" + std::to_string(port);
+    }
+    return "";
+}
+
+void H2ConnectionMgr::resolveAddress(const std::string &key, const std::string &host, uint16_t port, const H2ConnectionPtr &conn)
+{// conn_mutex_ is locked
+    H2ConnectionWeakPtr weak_conn = conn;
+    DnsResolver::get().resolve(host, port, [=] (KMError err, const sockaddr_storage &addr) {
+        // on DNS thread
+        std::string ip;
+        if (err != KMError::NOERR || kev::km_get_sock_addr(addr, ip, nullptr) != 0) {
+            return;
+        }
+        auto conn = weak_conn.lock();
+        if (!conn) {
+            return;
+        }
+        std::lock_guard<std::mutex> g(conn_mutex_);
+        auto it = conn_map_.find(key);
+        if (it == conn_map_.end() ||
+            std::find(it->second.begin(), it->second.end(), conn) == it->second.end()) {
+            return; // connection is removed already
+        }
+        addr_conn_map_[ip + ":" + std::to_string(port)].push_back(conn);
+    });
+}
+
+void H2ConnectionMgr::removeConnection(const std::string &key, const H2Connection::Impl *conn)
+{
+    H2ConnectionPtr removed; // destroy it out of lock
     std::lock_guard<std::mutex> g(conn_mutex_);
-    conn_map_.erase(key);
+    auto it = conn_map_.find(key);
+    if (it == conn_map_.end()) {
+        return;
+    }
+    auto &conns = it->second;
+    for (auto itc = conns.begin(); itc != conns.end(); ++itc) {
+        if (itc->get() == conn) {
+            removed = std::move(*itc);
+            conns.erase(itc);
+            break;
+        }
+    }
+    if (conns.empty()) {
+        conn_map_.erase(it);
+    }
+    for (auto ita = addr_conn_map_.begin(); ita != addr_conn_map_.end(); ) {
+        auto &addr_conns = ita->second;
+        addr_conns.erase(std::remove_if(addr_conns.begin(), addr_conns.end(), [conn] (const H2ConnectionPtr &c) {
+            return c.get() == conn;
+        }), addr_conns.end());
+        if (addr_conns.empty()) {
+            ita = addr_conn_map_.erase(ita);
+        } else {
+            ++ita;
+        }
+    }
+}
+
+bool H2ConnectionMgr::getRttStats(const std::string &host, uint16_t port, H2RttStats &stats)
+{
+    auto key = host + ":" + std::to_string(port);
+    std::lock_guard<std::mutex> g(conn_mutex_);
+    auto it = conn_map_.find(key);
+    if (it == conn_map_.end()) {
+        return false;
+    }
+    const RttStats *best = nullptr;
+    for (auto &c : it->second) {
+        auto &rtt = c->getRttStats();
+        if (rtt.samples() > 0 && (!best || rtt.smoothed() < best->smoothed())) {
+            best = &rtt;
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    stats.latest_us = best->latest();
+    stats.min_us = best->minimum();
+    stats.smoothed_us = best->smoothed();
+    stats.variance_us = best->variance();
+    stats.samples = best->samples();
+    return true;
 }
 
-void H2ConnectionMgr::removeConnection(const std::string &key, bool secure)
+void H2ConnectionMgr::removeConnection(const std::string &key, const H2Connection::Impl *conn, bool secure)
 {
     if (!key.empty()) {
         auto &conn_mgr = H2ConnectionMgr::getRequestConnMgr(secure);
-        conn_mgr.removeConnection(key);
+        conn_mgr.removeConnection(key, conn);
     }
 }
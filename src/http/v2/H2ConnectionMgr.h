@@ -25,6 +25,8 @@
 #include "kmdefs.h"
 #include <memory>
 #include <mutex>
+#include <vector>
+#include <atomic>
 
 #include "h2defs.h"
 #include "H2ConnectionImpl.h"
@@ -41,21 +43,62 @@ public:
     void addConnection(const std::string &key, H2ConnectionPtr &conn);
     void addConnection(const std::string &key, H2ConnectionPtr &&conn);
     H2ConnectionPtr getConnection(const std::string &key);
+    /*
+     * get a connection to the origin from the pool, the connection on caller's loop is preferred.
+     * a new connection is created on the loop if all the pooled ones are saturated.
+     * it never blocks on DNS, the connection is keyed by host:port and coalesced by
+     * address only after the address is resolved
+     * a stream slot is reserved on the returned connection, caller should call
+     * releaseStream on the connection when the stream is done
+     */
     H2ConnectionPtr getConnection(const std::string &host, uint16_t port, uint32_t ssl_flags, const EventLoopPtr &loop, const ProxyInfo &proxy_info);
-    void removeConnection(const std::string key);
+    void removeConnection(const std::string &key, const H2Connection::Impl *conn);
+    /*
+     * get the RTT stats of the connection to host:port with the lowest smoothed RTT,
+     * return false if RTT is not measured on any connection
+     */
+    bool getRttStats(const std::string &host, uint16_t port, H2RttStats &stats);
     
 public:
     static H2ConnectionMgr& getRequestConnMgr(bool secure)
     {
         return secure ? req_secure_conn_mgr_ : req_conn_mgr_;
     }
-    static void removeConnection(const std::string &key, bool secure);
+    static void removeConnection(const std::string &key, const H2Connection::Impl *conn, bool secure);
+    /*
+     * the pooled connections created afterwards are probed by PING every interval_ms,
+     * 0 disables the probe
+     */
+    static void setPingPolicy(uint32_t interval_ms, uint32_t timeout_ms)
+    {
+        ping_interval_ms_ = interval_ms;
+        ping_timeout_ms_ = timeout_ms;
+    }
+    /*
+     * the receive window of the pooled connections created afterwards grows up to max_window_size
+     */
+    static void setMaxWindowSize(uint32_t max_window_size)
+    {
+        max_window_size_ = max_window_size;
+    }
     static H2ConnectionMgr req_conn_mgr_;
     static H2ConnectionMgr req_secure_conn_mgr_;
+    static std::atomic<uint32_t> ping_interval_ms_;
+    static std::atomic<uint32_t> ping_timeout_ms_;
+    static std::atomic<uint32_t> max_window_size_;
 
 private:
-    using H2ConnectionMap = std::map<std::string, H2ConnectionPtr>;
+    using H2ConnectionList = std::vector<H2ConnectionPtr>;
+    using H2ConnectionMap = std::map<std::string, H2ConnectionList>;
+    
+    bool selectConnection(const H2ConnectionList &conns, const EventLoopPtr &loop, H2ConnectionPtr &conn);
+    std::string getAddressKey(const std::string &host, uint16_t port);
+    void resolveAddress(const std::string &key, const std::string &host, uint16_t port, const H2ConnectionPtr &conn);
+    
+    // keyed by "host:port"
     H2ConnectionMap conn_map_;
+    // keyed by "ip:port", connections to different hosts on same address can be shared
+    H2ConnectionMap addr_conn_map_;
     std::mutex conn_mutex_;
 };
 
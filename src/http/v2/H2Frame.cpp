@@ -123,6 +123,24 @@ int DataFrame::encode(uint8_t *dst, size_t len)
     return int(ptr - dst);
 }
 
+int DataFrame::encode(KMBuffer &hdr, KMBuffer::Ptr &payload)
+{
+    int ret = H2Frame::encodeHeader(static_cast<uint8_t*>(hdr.writePtr()), hdr.space());
+    if (ret < 0) {
+        return ret;
+    }
+    hdr.bytesWritten(ret);
+    if (size_ > 0) {
+        if (data_) {
+            payload.reset(new KMBuffer(data_, size_, size_, KMBuffer::StorageType::OTHER));
+        } else if (buf_) {
+            payload.reset(sliceBuffer(*buf_, 0, size_));
+        }
+        hdr.append(payload.get());
+    }
+    return ret + int(size_);
+}
+
 H2Error DataFrame::decode(const FrameHeader &hdr, const uint8_t *payload)
 {
     setFrameHeader(hdr);
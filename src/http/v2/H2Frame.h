@@ -97,6 +97,12 @@ public:
     H2FrameType type() { return H2FrameType::DATA; }
     H2Error decode(const FrameHeader &hdr, const uint8_t *payload);
     int encode(uint8_t *dst, size_t len);
+    /*
+     * encode frame header into hdr and link a view of payload after it. the payload
+     * is neither copied nor modified, so a buffer shared by threads can be sent.
+     * caller should unlink hdr before payload is destroyed
+     */
+    int encode(KMBuffer &hdr, KMBuffer::Ptr &payload);
     
     size_t calcPayloadSize() { return size_; }
     
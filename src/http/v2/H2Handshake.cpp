@@ -127,16 +127,28 @@ size_t H2Handshake::parseInputData(uint8_t *buf, size_t len)
     }
 }
 
-std::string H2Handshake::buildUpgradeRequest()
+ParamVector H2Handshake::buildSettingsParams()
 {
     ParamVector params;
     params.emplace_back(std::make_pair(INITIAL_WINDOW_SIZE, init_local_window_size_));
     params.emplace_back(std::make_pair(MAX_FRAME_SIZE, max_local_frame_size_));
-    uint8_t buf[2 * H2_SETTING_ITEM_SIZE];
+    if (header_table_size_ != H2_DEFAULT_HEADER_TABLE_SIZE) {
+        params.emplace_back(std::make_pair(HEADER_TABLE_SIZE, header_table_size_));
+    }
+    if (max_header_list_size_ > 0) {
+        params.emplace_back(std::make_pair(MAX_HEADER_LIST_SIZE, max_header_list_size_));
+    }
+    return params;
+}
+
+std::string H2Handshake::buildUpgradeRequest()
+{
+    ParamVector params = buildSettingsParams();
+    std::vector<uint8_t> buf(params.size() * H2_SETTING_ITEM_SIZE);
     SettingsFrame settings;
-    settings.encodePayload(buf, sizeof(buf), params);
+    settings.encodePayload(&buf[0], buf.size(), params);
     
-    auto settings_str = x64_encode(buf, sizeof(buf), false);
+    auto settings_str = x64_encode(&buf[0], buf.size(), false);
     
     std::stringstream ss;
     ss << "GET / HTTP/1.1\r\n";
@@ -186,9 +198,7 @@ KMError H2Handshake::sendPreface()
 
 KMBuffer H2Handshake::buildPreface()
 {
-    ParamVector params;
-    params.emplace_back(std::make_pair(INITIAL_WINDOW_SIZE, init_local_window_size_));
-    params.emplace_back(std::make_pair(MAX_FRAME_SIZE, max_local_frame_size_));
+    ParamVector params = buildSettingsParams();
     size_t setting_size = H2_FRAME_HEADER_SIZE + params.size() * H2_SETTING_ITEM_SIZE;
     KMBuffer buf;
     if (!isServer()) {
@@ -38,6 +38,8 @@ public:
     H2Handshake();
     void setHost(std::string host) { host_ = std::move(host); }
     void setLocalWindowSize(uint32_t win_size) { local_window_size_ = win_size; }
+    void setHeaderTableSize(uint32_t table_size) { header_table_size_ = table_size; }
+    void setMaxHeaderListSize(uint32_t list_size) { max_header_list_size_ = list_size; }
     void setHttpParser(HttpParser::Impl&& parser);
     KMError start(bool is_server, bool is_ssl);
     size_t parseInputData(uint8_t *buf, size_t len);
@@ -51,6 +53,7 @@ protected:
     void onFrameError(const FrameHeader &hdr, H2Error err, bool stream_err) override;
     
 protected:
+    ParamVector buildSettingsParams();
     std::string buildUpgradeRequest();
     std::string buildUpgradeResponse();
     KMBuffer buildPreface();
@@ -90,6 +93,8 @@ protected:
     uint32_t init_local_window_size_ { H2_LOCAL_STREAM_INITIAL_WINDOW_SIZE };
     uint32_t max_concurrent_streams_ = 128;
     uint32_t local_window_size_ = 0;
+    uint32_t header_table_size_ = H2_DEFAULT_HEADER_TABLE_SIZE;
+    uint32_t max_header_list_size_ = 0; // unlimited
     bool enable_connect_protocol_ = false;
     
     bool is_server_ = false;
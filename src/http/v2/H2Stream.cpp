@@ -22,6 +22,7 @@
 #include "H2Stream.h"
 #include "H2ConnectionImpl.h"
 #include "libkev/src/util/kmtrace.h"
+#include "util/util.h"
 
 #include <algorithm>
 
@@ -31,6 +32,15 @@ using namespace kuma;
 H2Stream::H2Stream(uint32_t stream_id, H2Connection::Impl* conn, uint32_t init_local_window_size, uint32_t init_remote_window_size)
 : stream_id_(stream_id), conn_(conn), flow_ctrl_(stream_id, [this] (uint32_t w) { sendWindowUpdate(w); })
 {
+    flow_ctrl_.setBudget(&WindowBudget::get());
+    init(stream_id, conn, init_local_window_size, init_remote_window_size);
+}
+
+void H2Stream::init(uint32_t stream_id, H2Connection::Impl* conn, uint32_t init_local_window_size, uint32_t init_remote_window_size)
+{
+    stream_id_ = stream_id;
+    conn_ = conn;
+    flow_ctrl_.reset(stream_id);
     flow_ctrl_.initLocalWindowSize(init_local_window_size);
     flow_ctrl_.initRemoteWindowSize(init_remote_window_size);
     flow_ctrl_.setLocalWindowStep(init_local_window_size);
@@ -41,6 +51,32 @@ H2Stream::H2Stream(uint32_t stream_id, H2Connection::Impl* conn, uint32_t init_l
     KM_SetObjKey("H2Stream_"<<stream_id);
 }
 
+void H2Stream::reset()
+{
+    conn_ = nullptr;
+    state_ = State::IDLE;
+    
+    promise_cb_ = nullptr;
+    headers_cb_ = nullptr;
+    data_cb_ = nullptr;
+    reset_cb_ = nullptr;
+    write_cb_ = nullptr;
+    
+    write_blocked_ = false;
+    headers_received_ = false;
+    headers_end_ = false;
+    tailers_received_ = false;
+    tailers_end_ = false;
+    
+    end_stream_sent_ = false;
+    end_stream_received_ = false;
+    rst_stream_sent_ = false;
+    rst_stream_received_ = false;
+    manual_consume_ = false;
+    
+    flow_ctrl_.reset(0);
+}
+
 KMError H2Stream::sendPushPromise(const HeaderVector &headers, size_t headers_size, uint32_t stream_id)
 {
     if (!isPromisedStream(getStreamId())) {
@@ -101,30 +137,41 @@ int H2Stream::sendData(const void *data, size_t len, bool end_stream)
         return 0;
     }
     size_t send_len = std::min<size_t>(window_size, len);
-    DataFrame frame;
-    frame.setStreamId(getStreamId());
-    if (end_stream) {
-        frame.addFlags(H2_FRAME_FLAG_END_STREAM);
-    }
-    frame.setData(data, send_len);
-    auto ret = conn_->sendH2Frame(&frame);
-    //KM_INFOXTRACE("sendData, len="<<len<<", send_len="<<send_len<<", ret="<<int(ret)<<", win="<<flow_ctrl_.remoteWindowSize());
-    if (KMError::NOERR == ret) {
-        if (end_stream) {
-            endStreamSent();
+    if (send_len < len) {
+        end_stream = false; // the rest will be sent with end stream
+    }
+    // DATA frame cannot exceed SETTINGS_MAX_FRAME_SIZE of peer
+    size_t max_frame_size = conn_->getMaxRemoteFrameSize();
+    size_t offset = 0;
+    do {
+        size_t frame_len = std::min<size_t>(send_len - offset, max_frame_size);
+        bool last_frame = offset + frame_len == send_len;
+        DataFrame frame;
+        frame.setStreamId(getStreamId());
+        if (end_stream && last_frame) {
+            frame.addFlags(H2_FRAME_FLAG_END_STREAM);
         }
-        flow_ctrl_.bytesSent(send_len);
-        if (send_len < len) {
+        frame.setData(static_cast<const uint8_t*>(data) + offset, frame_len);
+        auto ret = conn_->sendH2Frame(&frame);
+        //KM_INFOXTRACE("sendData, len="<<len<<", frame_len="<<frame_len<<", ret="<<int(ret)<<", win="<<flow_ctrl_.remoteWindowSize());
+        if (KMError::NOERR == ret) {
+            flow_ctrl_.bytesSent(frame_len);
+            offset += frame_len;
+            if (end_stream && last_frame) {
+                endStreamSent();
+            }
+        } else if (KMError::AGAIN == ret || KMError::BUFFER_TOO_SMALL == ret) {
             write_blocked_ = true;
-            conn_->appendBlockedStream(stream_id_);
+            return int(offset);
+        } else {
+            return -1;
         }
-        return int(send_len);
-    } else if (KMError::AGAIN == ret || KMError::BUFFER_TOO_SMALL == ret) {
+    } while (offset < send_len);
+    if (send_len < len) {
         write_blocked_ = true;
-        return 0;
+        conn_->appendBlockedStream(stream_id_);
     }
-    
-    return -1;
+    return int(send_len);
 }
 
 int H2Stream::sendData(const KMBuffer &buf, bool end_stream)
@@ -148,36 +195,48 @@ int H2Stream::sendData(const KMBuffer &buf, bool end_stream)
         return 0;
     }
     size_t send_len = window_size < buf_len ? window_size : buf_len;
-    DataFrame frame;
-    frame.setStreamId(getStreamId());
-    if (end_stream) {
-        frame.addFlags(H2_FRAME_FLAG_END_STREAM);
-    }
-    std::unique_ptr<KMBuffer> sub_buf;
     if (send_len < buf_len) {
-        sub_buf.reset(buf.subbuffer(0, send_len));
-        frame.setData(*sub_buf);
-    } else {
-        frame.setData(buf);
-    }
-    auto ret = conn_->sendH2Frame(&frame);
-    //KM_INFOXTRACE("sendData, len="<<len<<", send_len="<<send_len<<", ret="<<int(ret)<<", win="<<flow_ctrl_.remoteWindowSize());
-    if (KMError::NOERR == ret) {
-        if (end_stream) {
-            endStreamSent();
+        end_stream = false; // the rest will be sent with end stream
+    }
+    // DATA frame cannot exceed SETTINGS_MAX_FRAME_SIZE of peer,
+    // each frame payload is a slice of buf, no data copy
+    size_t max_frame_size = conn_->getMaxRemoteFrameSize();
+    size_t offset = 0;
+    do {
+        size_t frame_len = std::min<size_t>(send_len - offset, max_frame_size);
+        bool last_frame = offset + frame_len == send_len;
+        DataFrame frame;
+        frame.setStreamId(getStreamId());
+        if (end_stream && last_frame) {
+            frame.addFlags(H2_FRAME_FLAG_END_STREAM);
         }
-        flow_ctrl_.bytesSent(send_len);
-        if (send_len < buf_len) {
+        KMBuffer::Ptr slice;
+        if (frame_len < buf_len) {
+            slice.reset(sliceBuffer(buf, offset, frame_len));
+            frame.setData(*slice);
+        } else {
+            frame.setData(buf);
+        }
+        auto ret = conn_->sendH2Frame(&frame);
+        //KM_INFOXTRACE("sendData, len="<<buf_len<<", frame_len="<<frame_len<<", ret="<<int(ret)<<", win="<<flow_ctrl_.remoteWindowSize());
+        if (KMError::NOERR == ret) {
+            flow_ctrl_.bytesSent(frame_len);
+            offset += frame_len;
+            if (end_stream && last_frame) {
+                endStreamSent();
+            }
+        } else if (KMError::AGAIN == ret || KMError::BUFFER_TOO_SMALL == ret) {
             write_blocked_ = true;
-            conn_->appendBlockedStream(stream_id_);
+            return int(offset);
+        } else {
+            return -1;
         }
-        return int(send_len);
-    } else if (KMError::AGAIN == ret || KMError::BUFFER_TOO_SMALL == ret) {
+    } while (offset < send_len);
+    if (send_len < buf_len) {
         write_blocked_ = true;
-        return 0;
+        conn_->appendBlockedStream(stream_id_);
     }
-    
-    return -1;
+    return int(send_len);
 }
 
 KMError H2Stream::sendWindowUpdate(uint32_t delta)
@@ -191,6 +250,14 @@ KMError H2Stream::sendWindowUpdate(uint32_t delta)
     return conn_->sendH2Frame(&frame);
 }
 
+void H2Stream::bytesConsumed(size_t bytes)
+{
+    if (getState() == State::IDLE) {
+        return;
+    }
+    flow_ctrl_.bytesConsumed(bytes);
+}
+
 void H2Stream::close()
 {
     if (getState() == State::CLOSED || getState() == State::IDLE) {
@@ -250,6 +317,7 @@ KMError H2Stream::sendRSTStream(H2Error err)
     rst_stream_sent_ = true;
     
     if (conn_) {
+        conn_->streamReset(stream_id_);
         RSTStreamFrame frame;
         frame.setStreamId(stream_id_);
         frame.setErrorCode(uint32_t(err));
@@ -266,6 +334,18 @@ void H2Stream::connectionError(H2Error err)
     }
 }
 
+void H2Stream::growLocalWindowSize(uint32_t window_size)
+{
+    // peer is informed by SETTINGS_INITIAL_WINDOW_SIZE
+    flow_ctrl_.growLocalWindow(window_size, false);
+}
+
+void H2Stream::shrinkLocalWindowSize(uint32_t window_size)
+{
+    // peer is informed by SETTINGS_INITIAL_WINDOW_SIZE
+    flow_ctrl_.shrinkLocalWindow(window_size);
+}
+
 void H2Stream::streamError(H2Error err)
 {
     setState(State::CLOSED);
@@ -294,6 +374,9 @@ bool H2Stream::handleDataFrame(DataFrame *frame)
         endStreamReceived();
     }
     flow_ctrl_.bytesReceived(frame->size());
+    if (!manual_consume_) {
+        flow_ctrl_.bytesConsumed(frame->size());
+    }
     if (data_cb_) {
         KMBuffer buf(frame->data(), frame->size(), frame->size());
         data_cb_(buf, end_stream);
@@ -46,7 +46,17 @@ public:
 public:
     H2Stream(uint32_t stream_id, H2Connection::Impl* conn, uint32_t init_local_window_size, uint32_t init_remote_window_size);
     
+    /*
+     * reuse a recycled stream, the stream must be reset before
+     */
+    void init(uint32_t stream_id, H2Connection::Impl* conn, uint32_t init_local_window_size, uint32_t init_remote_window_size);
+    /*
+     * drop callbacks and state, and release the window budget, called when the stream is recycled
+     */
+    void reset();
+    
     uint32_t getStreamId() { return stream_id_; }
+    H2Connection::Impl* getConnection() { return conn_; }
     
     KMError sendPushPromise(const HeaderVector &headers, size_t headers_size, uint32_t stream_id);
     KMError sendHeaders(const HeaderVector &headers, size_t headers_size, bool end_stream);
@@ -54,6 +64,14 @@ public:
     int sendData(const KMBuffer &buf, bool end_stream = false);
     KMError sendWindowUpdate(uint32_t delta);
     
+    /*
+     * if manual consume is enabled, the window of received data is restored by
+     * bytesConsumed instead of on receipt, so the data buffered by a slow consumer
+     * is bounded by the stream window
+     */
+    void setManualConsume(bool manual_consume) { manual_consume_ = manual_consume; }
+    void bytesConsumed(size_t bytes);
+    
     void close();
     
     void setHeadersCallback(HeadersCallback cb) { headers_cb_ = std::move(cb); }
@@ -73,6 +91,8 @@ public:
     void onWrite();
     void onError(int err);
     void updateRemoteWindowSize(long delta);
+    void growLocalWindowSize(uint32_t window_size);
+    void shrinkLocalWindowSize(uint32_t window_size);
     void streamError(H2Error err);
     
     enum State {
@@ -120,6 +140,7 @@ protected:
     bool end_stream_received_ { false };
     bool rst_stream_sent_ { false };
     bool rst_stream_received_ { false };
+    bool manual_consume_ { false };
     
     FlowControl flow_ctrl_;
 };
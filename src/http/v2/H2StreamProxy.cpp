@@ -29,6 +29,11 @@
 
 using namespace kuma;
 
+namespace {
+    // a request refused by peer before it is processed is retried on other connection
+    const int kMaxRequestRetries = 2;
+}
+
 H2StreamProxy::H2StreamProxy(const EventLoopPtr &loop)
 : loop_(loop)
 {
@@ -39,12 +44,7 @@ H2StreamProxy::H2StreamProxy(const EventLoopPtr &loop)
 H2StreamProxy::~H2StreamProxy()
 {
     close();
-    while (!send_buf_queue_.empty()) {
-        send_buf_queue_.pop_front();
-    }
-    while (!recv_buf_queue_.empty()) {
-        recv_buf_queue_.pop_front();
-    }
+    recv_buf_queue_.clear();
     conn_token_.reset();
     loop_token_.reset();
 }
@@ -78,12 +78,22 @@ KMError H2StreamProxy::sendRequest(std::string method, std::string url, uint32_t
     is_server_ = false;
     method_ = std::move(method);
     ssl_flags_ = ssl_flags;
+    retries_ = 0;
     
+    return connectRequest();
+}
+
+KMError H2StreamProxy::connectRequest()
+{// on loop_ thread
+    auto loop = loop_.lock();
+    if (!loop) {
+        return KMError::INVALID_STATE;
+    }
     setState(State::CONNECTING);
     
+    uint32_t ssl_flags = SSL_NONE;
     std::string str_port = uri_.getPort();
     uint16_t port = 80;
-    ssl_flags = SSL_NONE;
     if (kev::is_equal("https", uri_.getScheme()) || kev::is_equal("wss", uri_.getScheme())) {
         ssl_flags = SSL_ENABLE | ssl_flags_;
         port = 443;
@@ -98,6 +108,7 @@ KMError H2StreamProxy::sendRequest(std::string method, std::string url, uint32_t
         KM_ERRXTRACE("sendRequest, failed to get H2Connection");
         return KMError::INVALID_PARAM;
     }
+    stream_reserved_ = true;
     auto conn_loop = conn_->eventLoop();
     conn_loop_ = conn_loop;
     conn_token_.eventLoop(conn_loop);
@@ -160,14 +171,50 @@ KMError H2StreamProxy::sendResponse(int status_code)
     return KMError::NOERR;
 }
 
+KMError H2StreamProxy::pushResource(std::string path)
+{
+    if (!is_server_ || !stream_) {
+        return KMError::INVALID_STATE;
+    }
+    if (is_same_loop_) {
+        return pushResource_i(path);
+    }
+    if (!runOnStreamThread([this, path = std::move(path)] { pushResource_i(path); })) {
+        return KMError::INVALID_STATE;
+    }
+    return KMError::NOERR;
+}
+
+KMError H2StreamProxy::pushResource_i(const std::string &path)
+{// on conn_ thread
+    auto conn = stream_ ? stream_->getConnection() : nullptr;
+    if (!conn) {
+        return KMError::INVALID_STATE;
+    }
+    auto const &scheme = incoming_header_.getHeader(H2HeaderScheme);
+    auto const &authority = incoming_header_.getHeader(strHost);
+    return conn->pushResource(stream_->getStreamId(), scheme, authority, path);
+}
+
 KMError H2StreamProxy::sendRequest_i()
 {// on conn_ thread
     if (!conn_) {
         return KMError::INVALID_STATE;
     }
+    if (conn_->isDraining()) {
+        // GOAWAY is received after the connection is selected
+        releaseConnStream();
+        runOnLoopThread([this] { retryRequest(); }, false);
+        return KMError::NOERR;
+    }
     if (!conn_->isReady()) {
         conn_->addConnectListener(getObjId(), [this] (KMError err) { onConnect_i(err); });
         return KMError::NOERR;
+    } else if (kev::is_equal(method_, "CONNECT") && !protocol_.empty() &&
+               !conn_->isConnectProtocolEnabled()) {
+        // the shared connection is ready, RFC 8441 is not supported by peer
+        KM_ERRXTRACE("sendRequest_i, connect protocol is not enabled, proto=" << protocol_);
+        return KMError::NOT_SUPPORTED;
     } else {
         if (processPushPromise()) {
             // server push is available
@@ -250,6 +297,8 @@ KMError H2StreamProxy::sendHeaders_i()
 
 void H2StreamProxy::setupStreamCallbacks()
 {
+    // the window is restored when the data is delivered to application
+    stream_->setManualConsume(true);
     stream_->setHeadersCallback([this] (const HeaderVector &headers, bool endSteam) {
         onHeaders_i(headers, endSteam);
     });
@@ -264,6 +313,14 @@ void H2StreamProxy::setupStreamCallbacks()
     });
 }
 
+void H2StreamProxy::releaseConnStream()
+{
+    if (stream_reserved_ && conn_) {
+        stream_reserved_ = false;
+        conn_->releaseStream();
+    }
+}
+
 void H2StreamProxy::onConnect_i(KMError err)
 {// on conn_ thread
     if(err != KMError::NOERR) {
@@ -305,11 +362,21 @@ int H2StreamProxy::sendData(const void* data, size_t len)
         return 0;
     }
     if (is_same_loop_ && send_buf_queue_.empty()) {
-        return sendData_i(data, len); // return the bytes sent directly
+        auto ret = sendData_i(data, len); // return the bytes sent directly
+        if (send_all_ && ret >= 0 && static_cast<size_t>(ret) < len && getState() == State::OPEN) {
+            // the rest will be sent on write event
+            saveRequestData(static_cast<const uint8_t*>(data) + ret, len - ret);
+            return int(len);
+        }
+        return ret;
     } else {
         saveRequestData(data, len);
-        if (send_buf_queue_.size() <= 1) {
-            runOnStreamThread([this] { sendData_i(); });
+        if (!send_scheduled_.exchange(true)) {
+            // one task drains all the data queued before it runs
+            runOnStreamThread([this] {
+                send_scheduled_ = false;
+                sendData_i();
+            });
         }
         return int(len);
     }
@@ -321,11 +388,22 @@ int H2StreamProxy::sendData(const KMBuffer &buf)
         return 0;
     }
     if (is_same_loop_ && send_buf_queue_.empty()) {
-        return sendData_i(buf); // return the bytes sent directly
+        auto ret = sendData_i(buf); // return the bytes sent directly
+        auto chain_len = buf.chainLength();
+        if (send_all_ && ret >= 0 && static_cast<size_t>(ret) < chain_len && getState() == State::OPEN) {
+            // the rest will be sent on write event
+            KMBuffer::Ptr rest(buf.subbuffer(ret, chain_len - ret));
+            saveRequestData(*rest);
+            return int(chain_len);
+        }
+        return ret;
     } else {
         saveRequestData(buf);
-        if (send_buf_queue_.size() <= 1) {
-            runOnStreamThread([this] { sendData_i(); });
+        if (!send_scheduled_.exchange(true)) {
+            runOnStreamThread([this] {
+                send_scheduled_ = false;
+                sendData_i();
+            });
         }
         return int(buf.chainLength());
     }
@@ -333,7 +411,7 @@ int H2StreamProxy::sendData(const KMBuffer &buf)
 
 int H2StreamProxy::sendData_i(const void* data, size_t len)
 {// on conn_ thread
-    if (getState() != State::OPEN) {
+    if (getState() != State::OPEN || !stream_) {
         return 0;
     }
     int ret = 0;
@@ -357,7 +435,7 @@ int H2StreamProxy::sendData_i(const void* data, size_t len)
 
 int H2StreamProxy::sendData_i(const KMBuffer &buf)
 {// on conn_ thread
-    if (getState() != State::OPEN) {
+    if (getState() != State::OPEN || !stream_) {
         return 0;
     }
     int ret = 0;
@@ -383,11 +461,16 @@ int H2StreamProxy::sendData_i(const KMBuffer &buf)
 int H2StreamProxy::sendData_i()
 {// on conn_ thread
     int bytes_sent = 0;
-    while (!send_buf_queue_.empty()) {
-        auto &kmb = send_buf_queue_.front();
+    while (auto *kmb = send_buf_queue_.front()) {
+        auto chain_len = kmb->chainLength();
         int ret = sendData_i(*kmb);
         if (ret > 0) {
             bytes_sent += ret;
+            if (static_cast<size_t>(ret) < chain_len) {
+                // stream is blocked, the rest is sent on next write event
+                kmb->bytesRead(ret);
+                break;
+            }
             send_buf_queue_.pop_front();
         } else if (ret == 0) {
             break;
@@ -401,6 +484,9 @@ int H2StreamProxy::sendData_i()
 
 void H2StreamProxy::onHeaders_i(const HeaderVector &headers, bool end_stream)
 {// on conn_ thread
+    if (end_stream) {
+        releaseConnStream();
+    }
     HeaderVector in_headers;
     if (isServer()) {
         if (!processH2RequestHeaders(headers, method_, path_, in_headers)) {
@@ -422,25 +508,72 @@ void H2StreamProxy::onHeaders_i(const HeaderVector &headers, bool end_stream)
 
 void H2StreamProxy::onData_i(KMBuffer &buf, bool end_stream)
 {// on conn_ thread
+    if (end_stream) {
+        releaseConnStream();
+    }
     if (is_same_loop_ && recv_buf_queue_.empty()) {
+        auto bytes = buf.chainLength();
         DESTROY_DETECTOR_SETUP();
         onStreamData(buf);
         DESTROY_DETECTOR_CHECK_VOID();
+        if (stream_) {
+            stream_->bytesConsumed(bytes);
+        }
         
         if (end_stream) {
             onIncomingComplete();
         }
     } else {
         saveResponseData(buf);
-        runOnLoopThread([this, end_stream] { onData(end_stream); });
+        if (end_stream) {
+            recv_end_stream_ = true;
+        }
+        if (!recv_scheduled_.exchange(true)) {
+            runOnLoopThread([this] { onRecvData(); });
+        }
     }
 }
 
 void H2StreamProxy::onRSTStream_i(int err)
 {// on conn_ thread
+    if (err == int(H2Error::REFUSED_STREAM) && !is_server_) {
+        // RFC 7540, 8.1.4, the request is not processed by peer,
+        // whether it can be retried is checked on loop_ thread
+        KM_INFOXTRACE("onRSTStream_i, refused");
+        stream_.reset();
+        releaseConnStream();
+        runOnLoopThread([this] { retryRequest(); }, false);
+        return;
+    }
     onError_i(KMError::FAILED);
 }
 
+bool H2StreamProxy::canRetry() const
+{// on loop_ thread
+    // the request body sent is not buffered, so it cannot be sent again
+    return !is_server_ && retries_ < kMaxRequestRetries &&
+        body_bytes_sent_ == 0 && !header_complete_ && getState() != State::CLOSED;
+}
+
+void H2StreamProxy::retryRequest()
+{// on loop_ thread
+    if (getState() == State::CLOSED || getState() == State::IN_ERROR) {
+        return;
+    }
+    if (!canRetry()) {
+        KM_WARNXTRACE("retryRequest, cannot retry, retries=" << retries_);
+        onError(KMError::FAILED);
+        return;
+    }
+    ++retries_;
+    conn_token_.reset();
+    conn_.reset();
+    auto err = connectRequest();
+    if (err != KMError::NOERR) {
+        onError(err);
+    }
+}
+
 void H2StreamProxy::onWrite_i()
 {// on conn_ thread
     if (sendData_i() < 0 || !send_buf_queue_.empty()) {
@@ -465,27 +598,31 @@ void H2StreamProxy::onIncomingComplete_i()
 
 void H2StreamProxy::saveRequestData(const void *data, size_t len)
 {
-    KMBuffer buf(data, len, len);
-    KMBuffer::Ptr kmb(buf.clone());
+    KMBuffer kmb(len);
+    kmb.write(data, len);
     send_buf_queue_.enqueue(std::move(kmb));
 }
 
 void H2StreamProxy::saveRequestData(const KMBuffer &buf)
 {
-    KMBuffer::Ptr kmb(buf.clone());
+    // the shared storage of buf is referenced, only the unowned data is copied
+    KMBuffer kmb(buf);
     send_buf_queue_.enqueue(std::move(kmb));
 }
 
 void H2StreamProxy::saveResponseData(const void *data, size_t len)
 {
-    KMBuffer buf(data, len, len);
-    KMBuffer::Ptr kmb(buf.clone());
+    KMBuffer kmb(len);
+    kmb.write(data, len);
     recv_buf_queue_.enqueue(std::move(kmb));
 }
 
 void H2StreamProxy::saveResponseData(const KMBuffer &buf)
 {
-    KMBuffer::Ptr kmb(buf.clone());
+    // the payload of DATA frame is not owned, copy it into one flat buffer
+    auto len = buf.chainLength();
+    KMBuffer kmb(len);
+    kmb.bytesWritten(buf.readChained(kmb.writePtr(), len));
     recv_buf_queue_.enqueue(std::move(kmb));
 }
 
@@ -501,15 +638,31 @@ void H2StreamProxy::onHeaders(bool end_stream)
     }
 }
 
+void H2StreamProxy::onRecvData()
+{// on loop_ thread
+    recv_scheduled_ = false;
+    // read end flag before draining, so that all the data before end stream is drained
+    bool end_stream = recv_end_stream_.exchange(false);
+    onData(end_stream);
+}
+
 void H2StreamProxy::onData(bool end_stream)
 {// on loop_ thread
-    while (!recv_buf_queue_.empty()) {
-        auto &kmb = recv_buf_queue_.front();
+    size_t bytes_consumed = 0;
+    while (auto *kmb = recv_buf_queue_.front()) {
+        bytes_consumed += kmb->chainLength();
         DESTROY_DETECTOR_SETUP();
-        if (kmb) onStreamData(*kmb);
+        onStreamData(*kmb);
         DESTROY_DETECTOR_CHECK_VOID();
         recv_buf_queue_.pop_front();
     }
+    if (bytes_consumed > 0) {
+        runOnStreamThread([this, bytes_consumed] {
+            if (stream_) {
+                stream_->bytesConsumed(bytes_consumed);
+            }
+        });
+    }
     if (end_stream) {
         onIncomingComplete();
     }
@@ -566,18 +719,28 @@ void H2StreamProxy::onError(KMError err)
 }
 
 void H2StreamProxy::reset()
-{
-    while (!send_buf_queue_.empty()) {
-        send_buf_queue_.pop_front();
-    }
-    while (!recv_buf_queue_.empty()) {
-        recv_buf_queue_.pop_front();
+{// on loop_ thread
+    auto reset_i = [this] {
+        // send_buf_queue_ is consumed on conn_ thread
+        send_buf_queue_.clear();
+        send_scheduled_ = false;
+        if (stream_) {
+            stream_->close();
+            stream_.reset();
+        }
+        releaseConnStream();
+    };
+    if (conn_) {
+        conn_->sync(reset_i);
+    } else {
+        reset_i();
     }
+    recv_buf_queue_.clear();
+    recv_scheduled_ = false;
+    recv_end_stream_ = false;
     
     outgoing_header_.reset();
     incoming_header_.reset();
-    stream_->close();
-    stream_.reset();
     
     is_same_loop_ = false;
     body_bytes_sent_ = 0;
@@ -605,10 +768,13 @@ void H2StreamProxy::close_i()
     if (getState() == State::CONNECTING && conn_) {
         conn_->removeConnectListener(getObjId());
     }
+    releaseConnStream();
     if (stream_) {
         stream_->close();
         stream_.reset();
     }
+    // send_buf_queue_ is consumed on conn_ thread
+    send_buf_queue_.clear();
     setState(State::CLOSED);
 }
 
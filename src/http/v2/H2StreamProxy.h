@@ -27,8 +27,10 @@
 #include "http/Uri.h"
 #include "libkev/src/util/kmobject.h"
 #include "libkev/src/util/DestroyDetector.h"
-#include "libkev/src/util/kmqueue.h"
 #include "proxy/proxydefs.h"
+#include "util/spscqueue.h"
+
+#include <atomic>
 
 KUMA_NS_BEGIN
 
@@ -49,6 +51,7 @@ public:
     KMError sendRequest(std::string method, std::string url, uint32_t ssl_flags);
     KMError attachStream(uint32_t stream_id, H2Connection::Impl* conn);
     KMError sendResponse(int status_code);
+    KMError pushResource(std::string path);
     int sendData(const void* data, size_t len);
     int sendData(const KMBuffer &buf);
     void reset();
@@ -56,6 +59,11 @@ public:
     
     bool isServer() const { return is_server_; }
     bool canSendData() const;
+    /*
+     * when send_all is true, the data not accepted by stream due to flow control
+     * is queued and sent on write event, so the data is never partially sent
+     */
+    void setSendAll(bool send_all) { send_all_ = send_all; }
     
     HttpHeader& getOutgoingHeaders() { return outgoing_header_; }
     HttpHeader& getIncomingHeaders() { return incoming_header_; }
@@ -100,6 +108,13 @@ protected:
     //}
     
     void setupStreamCallbacks();
+    void releaseConnStream();
+    
+    //{ on loop_ thread
+    bool canRetry() const;
+    KMError connectRequest();
+    void retryRequest();
+    //}
     
     void saveRequestData(const void *data, size_t len);
     void saveRequestData(const KMBuffer &buf);
@@ -112,6 +127,7 @@ protected:
     KMError sendRequest_i();
     KMError sendResponse_i();
     KMError sendHeaders_i();
+    KMError pushResource_i(const std::string &path);
     int sendData_i(const void* data, size_t len);
     int sendData_i(const KMBuffer &buf);
     int sendData_i();
@@ -125,6 +141,7 @@ protected:
     
     //{ on loop_ thread
     void onHeaders(bool end_stream);
+    void onRecvData();
     void onData(bool end_stream);
     void onPushPromise(bool end_stream);
     void onWrite();
@@ -181,6 +198,9 @@ protected:
     H2StreamPtr stream_;
     bool is_server_ = false;
     bool is_same_loop_ = false;
+    bool send_all_ = false;
+    bool stream_reserved_ = false; // a stream slot of conn_ is reserved by H2ConnectionMgr
+    int retries_ = 0;
     
     std::string method_;
     std::string path_;
@@ -196,11 +216,16 @@ protected:
     
     // incoming
     HttpHeader incoming_header_{false, true};
-    kev::KMQueue<KMBuffer::Ptr> recv_buf_queue_;
+    // conn_ thread -> loop_ thread
+    SpscQueue<KMBuffer> recv_buf_queue_;
+    std::atomic_bool recv_scheduled_{false};
+    std::atomic_bool recv_end_stream_{false};
     bool header_complete_ {false};
     
     bool write_blocked_ { false };
-    kev::KMQueue<KMBuffer::Ptr>  send_buf_queue_;
+    // loop_ thread -> conn_ thread
+    SpscQueue<KMBuffer> send_buf_queue_;
+    std::atomic_bool send_scheduled_{false};
     
     HeaderCallback          header_cb_;
     DataCallback            data_cb_;
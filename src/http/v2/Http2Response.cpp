@@ -28,7 +28,7 @@
 using namespace kuma;
 
 Http2Response::Http2Response(const EventLoopPtr &loop, std::string ver)
-: HttpResponse::Impl(std::move(ver)), stream_(new H2StreamProxy(loop))
+: HttpResponse::Impl(loop, std::move(ver)), stream_(new H2StreamProxy(loop))
 {
     stream_->setHeaderCallback([this] {
         onHeader();
@@ -67,6 +67,15 @@ KMError Http2Response::sendResponse(int status_code, const std::string& desc, co
     return stream_->sendResponse(status_code);
 }
 
+KMError Http2Response::pushResource(const std::string &path)
+{
+    if (getState() != State::WAIT_FOR_RESPONSE && getState() != State::RECVING_REQUEST) {
+        // PUSH_PROMISE should be sent before the response
+        return KMError::INVALID_STATE;
+    }
+    return stream_->pushResource(path);
+}
+
 bool Http2Response::canSendBody() const
 {
     return stream_->canSendData() && getState() == State::SENDING_RESPONSE;
@@ -39,6 +39,7 @@ public:
     KMError attachStream(uint32_t stream_id, H2Connection::Impl* conn) override;
     KMError addHeader(std::string name, std::string value) override;
     KMError sendResponse(int status_code, const std::string& desc, const std::string& ver) override;
+    KMError pushResource(const std::string &path) override;
     int sendBody(const void* data, size_t len) override;
     int sendBody(const KMBuffer &buf) override;
     KMError close() override;
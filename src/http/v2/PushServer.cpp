@@ -0,0 +1,164 @@
+/* Copyright © 2014-2017, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "PushServer.h"
+#include "H2ConnectionImpl.h"
+#include "http/httpdefs.h"
+#include "libkev/src/util/kmtrace.h"
+
+KUMA_NS_USING
+
+//////////////////////////////////////////////////////////////////////////
+//
+PushCache& PushCache::instance()
+{
+    static PushCache s_instance;
+    return s_instance;
+}
+
+void PushCache::setResource(const std::string &authority, const std::string &path, int status_code, const std::string &content_type, const KMBuffer &body)
+{
+    auto res = std::make_shared<Resource>();
+    auto str_status_code = std::to_string(status_code);
+    res->headers.emplace_back(H2HeaderStatus, str_status_code);
+    res->headers_size += H2HeaderStatus.size() + str_status_code.size();
+    if (!content_type.empty()) {
+        res->headers.emplace_back(H2HeaderContentType, content_type);
+        res->headers_size += H2HeaderContentType.size() + content_type.size();
+    }
+    auto body_size = body.chainLength();
+    auto str_body_size = std::to_string(body_size);
+    res->headers.emplace_back(H2HeaderContentLength, str_body_size);
+    res->headers_size += H2HeaderContentLength.size() + str_body_size.size();
+    if (body_size > 0) {
+        // copy once into shared storage, the pushes reference it afterwards
+        KMBuffer buf(body_size);
+        buf.bytesWritten(body.readChained(buf.writePtr(), body_size));
+        res->body = std::move(buf);
+    }
+    std::lock_guard<std::mutex> g(mutex_);
+    resources_[authority + path] = std::move(res);
+}
+
+PushCache::ResourcePtr PushCache::getResource(const std::string &authority, const std::string &path)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = resources_.find(authority + path);
+    if (it == resources_.end() && !authority.empty()) {
+        it = resources_.find(path);
+    }
+    return it != resources_.end() ? it->second : nullptr;
+}
+
+void PushCache::removeResource(const std::string &authority, const std::string &path)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    resources_.erase(authority + path);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+KMError PushServer::attachStream(H2Connection::Impl* conn, H2StreamPtr &stream, PushCache::ResourcePtr resource)
+{
+    stream_ = stream;
+    if (!stream_ || !resource) {
+        return KMError::INVALID_STATE;
+    }
+    push_id_ = stream_->getStreamId();
+    conn_ = conn;
+    resource_ = std::move(resource);
+    stream_->setRSTStreamCallback([this] (int err) {
+        onRSTStream(err);
+    });
+    stream_->setWriteCallback([this] {
+        onWrite();
+    });
+    return KMError::NOERR;
+}
+
+KMError PushServer::push(uint32_t assoc_stream_id, const HeaderVector &req_headers, size_t req_headers_size)
+{
+    auto ret = stream_->sendPushPromise(req_headers, req_headers_size, assoc_stream_id);
+    if (ret != KMError::NOERR) {
+        return ret;
+    }
+    bool end_stream = resource_->body.empty();
+    ret = stream_->sendHeaders(resource_->headers, resource_->headers_size, end_stream);
+    if (ret != KMError::NOERR) {
+        return ret;
+    }
+    if (end_stream) {
+        onComplete();
+    } else {
+        sendBody();
+    }
+    return KMError::NOERR;
+}
+
+void PushServer::sendBody()
+{
+    auto &body = resource_->body;
+    auto body_size = body.chainLength();
+    while (body_sent_ < body_size) {
+        int ret = 0;
+        if (body_sent_ == 0) {
+            ret = stream_->sendData(body, true);
+        } else {
+            std::unique_ptr<KMBuffer> remain(body.subbuffer(body_sent_, body_size - body_sent_));
+            ret = stream_->sendData(*remain, true);
+        }
+        if (ret > 0) {
+            body_sent_ += ret;
+        } else if (ret == 0) {
+            return; // wait for onWrite
+        } else {
+            KM_WARNTRACE("PushServer::sendBody, failed, push_id="<<push_id_);
+            onComplete();
+            return;
+        }
+    }
+    onComplete();
+}
+
+void PushServer::onWrite()
+{
+    if (!complete_) {
+        sendBody();
+    }
+}
+
+void PushServer::onRSTStream(int err)
+{
+    KM_INFOTRACE("PushServer::onRSTStream, push_id="<<push_id_<<", err="<<err);
+    onComplete();
+}
+
+void PushServer::onComplete()
+{
+    if (complete_) {
+        return;
+    }
+    complete_ = true;
+    if (conn_) {
+        // it is removed asynchronously, don't touch the members after this
+        conn_->removePushServer(push_id_);
+    }
+}
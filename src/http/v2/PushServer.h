@@ -0,0 +1,96 @@
+/* Copyright © 2014-2017, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __PushServer_H__
+#define __PushServer_H__
+
+#include "h2defs.h"
+#include "H2Stream.h"
+
+#include <memory>
+#include <map>
+#include <mutex>
+
+KUMA_NS_BEGIN
+
+/*
+ * process-wide cache of the responses for server push. the response headers
+ * are prepared for HPACK encoding and the body is kept in shared storage, so
+ * pushing a resource on any connection copies no data. the resources are keyed
+ * by authority and path, the one added with empty authority serves any host
+ */
+class PushCache final
+{
+public:
+    struct Resource
+    {
+        HeaderVector headers; // response headers with :status
+        size_t headers_size = 0;
+        KMBuffer body;
+    };
+    using ResourcePtr = std::shared_ptr<const Resource>;
+    
+    static PushCache& instance();
+    
+    void setResource(const std::string &authority, const std::string &path, int status_code, const std::string &content_type, const KMBuffer &body);
+    ResourcePtr getResource(const std::string &authority, const std::string &path);
+    void removeResource(const std::string &authority, const std::string &path);
+    
+protected:
+    PushCache() = default;
+    
+protected:
+    std::map<std::string, ResourcePtr> resources_;
+    std::mutex mutex_;
+};
+
+/*
+ * PushServer sends one cached response on a promised stream
+ */
+class PushServer final
+{
+public:
+    KMError attachStream(H2Connection::Impl* conn, H2StreamPtr &stream, PushCache::ResourcePtr resource);
+    /*
+     * send PUSH_PROMISE on the associated stream, then the response
+     */
+    KMError push(uint32_t assoc_stream_id, const HeaderVector &req_headers, size_t req_headers_size);
+    
+protected:
+    void sendBody();
+    void onWrite();
+    void onRSTStream(int err);
+    void onComplete();
+    
+protected:
+    H2StreamPtr stream_;
+    H2Connection::Impl* conn_ = nullptr;
+    uint32_t push_id_ = 0;
+    PushCache::ResourcePtr resource_;
+    size_t body_sent_ = 0;
+    bool complete_ = false;
+};
+
+using PushServerPtr = std::unique_ptr<PushServer>;
+
+KUMA_NS_END
+
+#endif
@@ -0,0 +1,257 @@
+/* Copyright (c) 2016, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __StreamTable_H__
+#define __StreamTable_H__
+
+#include "kmdefs.h"
+
+#include <vector>
+#include <utility>
+
+KUMA_NS_BEGIN
+
+/*
+ * open-addressed table keyed by stream id. stream ids are monotonic, the slot of
+ * a stream is the id modulo capacity, so the active streams work as a sliding window
+ * and lookup is O(1) without collision in common case.
+ * the table also links the blocked streams in FIFO order by stream ids stored in
+ * the slots, a stream is unlinked automatically when it is erased.
+ * stream id 0 is reserved as empty slot
+ */
+template<typename T>
+class StreamTable
+{
+public:
+    StreamTable() = default;
+    StreamTable(StreamTable &&other) { swap(other); }
+    StreamTable& operator=(StreamTable &&other)
+    {
+        if (this != &other) {
+            StreamTable tmp(std::move(other));
+            swap(tmp);
+        }
+        return *this;
+    }
+    StreamTable(const StreamTable &) = delete;
+    StreamTable& operator=(const StreamTable &) = delete;
+    
+    T* find(uint32_t id)
+    {
+        auto idx = indexOf(id);
+        return idx < entries_.size() ? &entries_[idx].value : nullptr;
+    }
+    
+    void insert(uint32_t id, T value)
+    {
+        if (id == 0) {
+            return;
+        }
+        auto idx = indexOf(id);
+        if (idx < entries_.size()) {
+            entries_[idx].value = std::move(value);
+            return;
+        }
+        if ((size_ + 1) * 2 > entries_.size()) {
+            rehash(entries_.empty() ? kMinCapacity : entries_.size() * 2);
+        }
+        idx = id & mask();
+        while (entries_[idx].id != 0) {
+            idx = (idx + 1) & mask();
+        }
+        entries_[idx].id = id;
+        entries_[idx].value = std::move(value);
+        ++size_;
+    }
+    
+    bool erase(uint32_t id)
+    {
+        auto idx = indexOf(id);
+        if (idx >= entries_.size()) {
+            return false;
+        }
+        unlink(entries_[idx]);
+        entries_[idx] = Entry();
+        --size_;
+        // backward shift the following entries of the cluster
+        auto j = idx;
+        while (true) {
+            j = (j + 1) & mask();
+            if (entries_[j].id == 0) {
+                break;
+            }
+            auto home = entries_[j].id & mask();
+            if (((j - home) & mask()) >= ((j - idx) & mask())) {
+                entries_[idx] = std::move(entries_[j]);
+                entries_[j] = Entry();
+                idx = j;
+            }
+        }
+        return true;
+    }
+    
+    void clear()
+    {
+        StreamTable tmp;
+        swap(tmp);
+    }
+    
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    
+    /*
+     * f(uint32_t id, T &value), table must not be modified in f
+     */
+    template<typename Func>
+    void forEach(Func &&f)
+    {
+        for (auto &e : entries_) {
+            if (e.id != 0) {
+                f(e.id, e.value);
+            }
+        }
+    }
+    
+    /*
+     * append stream to the tail of blocked list, return false if stream is
+     * not in table. the stream is not appended again if it is blocked already
+     */
+    bool block(uint32_t id)
+    {
+        auto idx = indexOf(id);
+        if (idx >= entries_.size()) {
+            return false;
+        }
+        auto &e = entries_[idx];
+        if (e.blocked) {
+            return true;
+        }
+        e.blocked = true;
+        e.prev = blocked_tail_;
+        e.next = 0;
+        if (blocked_tail_ != 0) {
+            entries_[indexOf(blocked_tail_)].next = id;
+        } else {
+            blocked_head_ = id;
+        }
+        blocked_tail_ = id;
+        ++blocked_count_;
+        return true;
+    }
+    
+    /*
+     * remove the head of blocked list, return its stream id or 0 if list is empty
+     */
+    uint32_t unblockFront()
+    {
+        auto id = blocked_head_;
+        if (id != 0) {
+            unlink(entries_[indexOf(id)]);
+        }
+        return id;
+    }
+    
+    bool hasBlocked() const { return blocked_count_ != 0; }
+    size_t blockedCount() const { return blocked_count_; }
+    
+    void swap(StreamTable &other)
+    {
+        entries_.swap(other.entries_);
+        std::swap(size_, other.size_);
+        std::swap(blocked_head_, other.blocked_head_);
+        std::swap(blocked_tail_, other.blocked_tail_);
+        std::swap(blocked_count_, other.blocked_count_);
+    }
+    
+private:
+    struct Entry
+    {
+        uint32_t id = 0;
+        uint32_t prev = 0; // blocked list
+        uint32_t next = 0; // blocked list
+        bool blocked = false;
+        T value {};
+    };
+    
+    size_t mask() const { return entries_.size() - 1; }
+    
+    size_t indexOf(uint32_t id) const
+    {
+        if (id == 0 || entries_.empty()) {
+            return entries_.size();
+        }
+        auto idx = id & mask();
+        while (entries_[idx].id != 0) {
+            if (entries_[idx].id == id) {
+                return idx;
+            }
+            idx = (idx + 1) & mask();
+        }
+        return entries_.size();
+    }
+    
+    void unlink(Entry &e)
+    {
+        if (!e.blocked) {
+            return;
+        }
+        if (e.prev != 0) {
+            entries_[indexOf(e.prev)].next = e.next;
+        } else {
+            blocked_head_ = e.next;
+        }
+        if (e.next != 0) {
+            entries_[indexOf(e.next)].prev = e.prev;
+        } else {
+            blocked_tail_ = e.prev;
+        }
+        e.blocked = false;
+        e.prev = e.next = 0;
+        --blocked_count_;
+    }
+    
+    void rehash(size_t capacity)
+    {
+        std::vector<Entry> entries(capacity);
+        entries.swap(entries_);
+        for (auto &e : entries) {
+            if (e.id != 0) {
+                auto idx = e.id & mask();
+                while (entries_[idx].id != 0) {
+                    idx = (idx + 1) & mask();
+                }
+                entries_[idx] = std::move(e);
+            }
+        }
+    }
+    
+    static const size_t kMinCapacity = 16;
+    
+    std::vector<Entry> entries_;
+    size_t size_ = 0;
+    uint32_t blocked_head_ = 0;
+    uint32_t blocked_tail_ = 0;
+    size_t blocked_count_ = 0;
+};
+
+KUMA_NS_END
+
+#endif
@@ -30,6 +30,21 @@ const uint8_t H2_FRAME_FLAG_PRIORITY = 0x20;
 
 const uint32_t H2_LOCAL_CONN_INITIAL_WINDOW_SIZE = 20*1024*1024;
 const uint32_t H2_LOCAL_STREAM_INITIAL_WINDOW_SIZE = 6*1024*1024;
+const uint32_t H2_LOCAL_MAX_WINDOW_SIZE = 64*1024*1024; // upper limit of auto-tuned window
+const size_t H2_RECV_WINDOW_BUDGET = 1024*1024*1024; // upper limit of stream receive windows of all connections
+
+const uint32_t H2_DEFAULT_HEADER_TABLE_SIZE = 4096;
+const uint32_t H2_LOCAL_HEADER_TABLE_SIZE = 16384;
+const uint32_t H2_HEADER_BLOCK_CACHE_SIZE = 8;
+const uint32_t H2_LOCAL_MAX_HEADER_LIST_SIZE = 64*1024;
+
+const uint32_t H2_DEFAULT_MAX_CONCURRENT_STREAMS = 100; // assumed until peer's SETTINGS is received
+const size_t H2_MAX_CONNECTIONS_PER_LOOP = 4; // client connections to one origin on one event loop
+const size_t H2_MAX_CONNECTIONS_PER_ORIGIN = 16;
+const size_t H2_MAX_POOLED_STREAMS = 64; // recycled streams kept by one connection
+const size_t H2_MAX_RESET_STREAMS = 128; // recently reset streams whose frames in flight are ignored
+const uint32_t H2_PING_INTERVAL_MS = 15000; // health check interval of pooled client connection
+const uint32_t H2_PING_TIMEOUT_MS = 5000; // connection is unhealthy if PING is not acked in time
 
 enum H2FrameType : uint8_t {
     DATA            = 0,
@@ -80,6 +95,8 @@ const std::string H2HeaderAuthority(":authority");
 const std::string H2HeaderPath(":path");
 const std::string H2HeaderStatus(":status");
 const std::string H2HeaderCookie("cookie");
+const std::string H2HeaderContentType("content-type");
+const std::string H2HeaderContentLength("content-length");
 
 inline bool isPromisedStream(uint32_t stream_id) {
     return !(stream_id & 1);
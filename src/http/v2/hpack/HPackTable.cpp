@@ -72,6 +72,7 @@ bool HPackTable::addHeader(const std::string &name, const std::string &value)
     }
     dynamicTable_.push_front(std::make_pair(name, value));
     tableSize_ += entrySize;
+    ++generation_;
     if (isEncoder_) {
         std::string key = name + value;
         updateIndex(key, ++indexSequence_);
@@ -92,6 +93,9 @@ void HPackTable::updateLimitSize(size_t limitSize)
     if (tableSize_ > limitSize) {
         evictTableBySize(tableSize_ - limitSize);
     }
+    if (limitSize_ != limitSize) {
+        ++generation_;
+    }
     limitSize_ = limitSize;
 }
 
@@ -108,6 +112,7 @@ void HPackTable::evictTableBySize(size_t size)
         }
         dynamicTable_.pop_back();
         evicted += entrySize;
+        ++generation_;
     }
 }
 
@@ -46,6 +46,8 @@ public:
     size_t getMaxSize() { return maxSize_; }
     size_t getLimitSize() { return limitSize_; }
     size_t getTableSize() { return tableSize_; }
+    // changed whenever the dynamic table is modified
+    uint64_t getGeneration() { return generation_; }
     
 private:
     int getDynamicIndex(int idxSeq);
@@ -62,6 +64,7 @@ private:
     size_t tableSize_ = 0;
     size_t limitSize_ = 4096;
     size_t maxSize_ = 4096;
+    uint64_t generation_ = 0;
     
     bool isEncoder_ = false;
     int indexSequence_ = 0;
@@ -22,11 +22,18 @@
 #include "HPacker.h"
 #include "hpack_huffman_table.h"
 
-#include <math.h>
 #include <string.h> // for memcpy
+#include <algorithm>
 
 namespace hpack {
 
+namespace {
+    // max distinct values tracked per header name, a name exceeding it is treated as volatile
+    const size_t kMaxTrackedValues = 8;
+    // max header names tracked by adaptive indexing policy
+    const size_t kMaxTrackedNames = 64;
+}
+
 static char *huffDecodeBits(char *dst, uint8_t bits, uint8_t *state, bool *ending) {
     const auto &entry = huff_decode_table[*state][bits];
     
@@ -166,6 +173,7 @@ static int encodeString(const std::string &str, uint8_t *buf, size_t len) {
     return int(ptr - buf);
 }
 
+// the decode functions return 0 if more data is needed, -1 on error
 static int decodeInteger(uint8_t N, const uint8_t *buf, size_t len, uint64_t &I) {
     if (N > 8) {
         return -1;
@@ -173,7 +181,7 @@ static int decodeInteger(uint8_t N, const uint8_t *buf, size_t len, uint64_t &I)
     const uint8_t *ptr = buf;
     const uint8_t *end = buf + len;
     if (ptr == end) {
-        return -1;
+        return 0;
     }
     uint8_t NF = (1 << N) - 1;
     uint8_t prefix = (*ptr++) & NF;
@@ -182,18 +190,21 @@ static int decodeInteger(uint8_t N, const uint8_t *buf, size_t len, uint64_t &I)
         return 1;
     }
     if (ptr == end) {
-        return -1;
+        return 0;
     }
     int m = 0;
     uint64_t u64 = prefix;
     uint8_t b = 0;
     do {
+        if (m > 56) {
+            return -1; // overflow
+        }
         b = *ptr++;
-        u64 += static_cast<uint64_t>((b & 127) * pow(2, m));
+        u64 += static_cast<uint64_t>(b & 127) << m;
         m += 7;
     } while (ptr < end && (b & 128));
     if (ptr == end && (b & 128)) {
-        return -1;
+        return 0;
     }
     I = u64;
     
@@ -205,17 +216,17 @@ static int decodeString(const uint8_t *buf, size_t len, std::string &str)
     const uint8_t *ptr = buf;
     const uint8_t *end = buf + len;
     if (ptr == end) {
-        return -1;
+        return 0;
     }
     bool H = !!(*ptr & 0x80);
     uint64_t slen = 0;
     int ret = decodeInteger(7, ptr, end - ptr, slen);
     if (ret <= 0) {
-        return -1;
+        return ret;
     }
     ptr += ret;
     if (slen > static_cast<size_t>(end - ptr)) {
-        return -1;
+        return 0;
     }
     if (H) {
         if(huffDecode(ptr, static_cast<size_t>(slen), str) < 0) {
@@ -239,6 +250,9 @@ enum class PrefixType {
 static int decodePrefix(const uint8_t *buf, size_t len, PrefixType &type, uint64_t &I) {
     const uint8_t *ptr = buf;
     const uint8_t *end = buf + len;
+    if (ptr == end) {
+        return 0;
+    }
     uint8_t N = 0;
     if (*ptr & 0x80) {
         N = 7;
@@ -255,23 +269,126 @@ static int decodePrefix(const uint8_t *buf, size_t len, PrefixType &type, uint64
     }
     int ret = decodeInteger(N, ptr, end - ptr, I);
     if (ret <= 0) {
-        return -1;
+        return ret;
     }
     ptr += ret;
     return int(ptr - buf);
 }
 
+static bool isVolatileHeader(const std::string &name)
+{
+    // headers that change on nearly every message or carry credentials
+    static const char* const volatileHeaders[] = {
+        "age", "authorization", "content-length", "content-range", "date", "etag",
+        "expires", "if-modified-since", "if-none-match", "last-modified",
+        "proxy-authorization", "range", "set-cookie", "x-request-id"
+    };
+    for (auto const *hdr : volatileHeaders) {
+        if (name == hdr) {
+            return true;
+        }
+    }
+    return false;
+}
+
 HPacker::IndexingType HPacker::getIndexingType(const std::string &name, const std::string &value)
 {
     if (query_cb_) {
         return query_cb_(name, value);
     }
+    return getAdaptiveIndexingType(name, value);
+}
+
+HPacker::IndexingType HPacker::getAdaptiveIndexingType(const std::string &name, const std::string &value)
+{
     if (name == "cookie" || name == ":authority" || name == "user-agent" || name == "pragma") {
         return IndexingType::ALL;
     }
+    if (isVolatileHeader(name)) {
+        return IndexingType::NONE;
+    }
+    auto it = valueStats_.find(name);
+    if (it == valueStats_.end()) {
+        if (valueStats_.size() >= kMaxTrackedNames) {
+            return IndexingType::NONE;
+        }
+        it = valueStats_.emplace(name, ValueStats()).first;
+    }
+    auto &stats = it->second;
+    if (stats.volatileName) {
+        return IndexingType::NONE;
+    }
+    auto hash = std::hash<std::string>()(value);
+    if (std::find(stats.values.begin(), stats.values.end(), hash) != stats.values.end()) {
+        // the value is repeated, it is worth a table entry
+        return IndexingType::ALL;
+    }
+    if (stats.values.size() >= kMaxTrackedValues) {
+        // high cardinality, never index this header again
+        stats.volatileName = true;
+        stats.values.clear();
+        stats.values.shrink_to_fit();
+        return IndexingType::NONE;
+    }
+    stats.values.push_back(hash);
+    // index the value when it is seen again
+    indexDeferred_ = true;
     return IndexingType::NONE;
 }
 
+void HPacker::updateTableSize(size_t tableSize)
+{
+    table_.setMaxSize(tableSize);
+    table_.updateLimitSize(tableSize);
+    updateTableSize_ = true;
+}
+
+void HPacker::setEncodeCacheSize(size_t maxBlocks)
+{
+    maxCacheBlocks_ = maxBlocks;
+    while (encodeCache_.size() > maxCacheBlocks_) {
+        encodeCache_.pop_back();
+    }
+}
+
+int HPacker::encodeFromCache(const std::string &key, uint8_t *buf, size_t len)
+{
+    for (auto it = encodeCache_.begin(); it != encodeCache_.end(); ++it) {
+        if (it->key != key) {
+            continue;
+        }
+        if (it->generation != table_.getGeneration()) {
+            // the block may reference the entries that are no longer in table
+            encodeCache_.erase(it);
+            return -1;
+        }
+        if (it->block.size() > len) {
+            return -1;
+        }
+        memcpy(buf, it->block.data(), it->block.size());
+        int ret = int(it->block.size());
+        if (it != encodeCache_.begin()) {
+            auto block = std::move(*it);
+            encodeCache_.erase(it);
+            encodeCache_.emplace_front(std::move(block));
+        }
+        return ret;
+    }
+    return -1;
+}
+
+void HPacker::addToCache(std::string &&key, const uint8_t *block, size_t len, uint64_t generation)
+{
+    if (encodeCache_.size() >= maxCacheBlocks_) {
+        encodeCache_.pop_back();
+    }
+    EncodedBlock eb;
+    eb.key = std::move(key);
+    eb.block.assign(block, block + len);
+    eb.generation = generation;
+    encodeCache_.emplace_front(std::move(eb));
+}
+
 int HPacker::encodeSizeUpdate(int sz, uint8_t *buf, size_t len)
 {
     uint8_t *ptr = buf;
@@ -352,6 +469,22 @@ int HPacker::encode(const KeyValueVector &headers, uint8_t *buf, size_t len) {
     uint8_t *ptr = buf;
     const uint8_t *end = buf + len;
     
+    std::string cacheKey;
+    if (maxCacheBlocks_ > 0 && !updateTableSize_ && !headers.empty()) {
+        for (const auto &hdr : headers) {
+            cacheKey.append(hdr.first);
+            cacheKey.push_back('\0');
+            cacheKey.append(hdr.second);
+            cacheKey.push_back('\0');
+        }
+        int ret = encodeFromCache(cacheKey, buf, len);
+        if (ret > 0) {
+            return ret;
+        }
+    }
+    auto generation = table_.getGeneration();
+    indexDeferred_ = false;
+    
     if (updateTableSize_) {
         updateTableSize_ = false;
         int ret = encodeSizeUpdate(int(table_.getLimitSize()), ptr, end - ptr);
@@ -367,23 +500,67 @@ int HPacker::encode(const KeyValueVector &headers, uint8_t *buf, size_t len) {
         }
         ptr += ret;
     }
+    // only the block that leaves dynamic table untouched can be replayed
+    if (!cacheKey.empty() && !indexDeferred_ && table_.getGeneration() == generation) {
+        addToCache(std::move(cacheKey), buf, ptr - buf, generation);
+    }
     return int(ptr - buf);
 }
 
 int HPacker::decode(const uint8_t *buf, size_t len, KeyValueVector &headers) {
+    headers.clear();
+    pending_.clear();
+    blockStarted_ = false;
+    return decode(buf, len, true, headers);
+}
+
+int HPacker::decode(const uint8_t *buf, size_t len, bool endBlock, KeyValueVector &headers) {
     table_.setMode(false);
+    if (!blockStarted_) {
+        blockStarted_ = true;
+        headerListSize_ = 0;
+        headerListTooLarge_ = false;
+    }
+    int ret = 0;
+    if (pending_.empty()) {
+        ret = decodeHeaders(buf, len, headers);
+        if (ret >= 0 && size_t(ret) < len) {
+            pending_.assign(buf + ret, buf + len);
+        }
+    } else {
+        // the header field is split between fragments
+        pending_.insert(pending_.end(), buf, buf + len);
+        ret = decodeHeaders(&pending_[0], pending_.size(), headers);
+        if (ret > 0) {
+            pending_.erase(pending_.begin(), pending_.begin() + ret);
+        }
+    }
+    if (ret < 0 ||
+        (maxHeaderListSize_ > 0 && pending_.size() > maxHeaderListSize_) ||
+        (endBlock && !pending_.empty())) {
+        pending_.clear();
+        blockStarted_ = false;
+        return -1;
+    }
+    if (endBlock) {
+        blockStarted_ = false;
+    }
+    return int(len);
+}
+
+int HPacker::decodeHeaders(const uint8_t *buf, size_t len, KeyValueVector &headers) {
     const uint8_t *ptr = buf;
     const uint8_t *end = buf + len;
-    headers.clear();
     
     while (ptr < end) {
+        const uint8_t *start = ptr;
         std::string name;
         std::string value;
         PrefixType type;
         uint64_t I = 0;
         int ret = decodePrefix(ptr, end - ptr, type, I);
         if (ret <= 0) {
-            return -1;
+            return ret < 0 ? -1 : int(start - buf);
         }
         ptr += ret;
         if (PrefixType::INDEXED_HEADER == type) {
@@ -395,7 +572,7 @@ int HPacker::decode(const uint8_t *buf, size_t len, KeyValueVector &headers) {
             if (0 == I) {
                 ret = decodeString(ptr, end - ptr, name);
                 if (ret <= 0) {
-                    return -1;
+                    return ret < 0 ? -1 : int(start - buf);
                 }
                 ptr += ret;
             } else if (!table_.getIndexedName(int(I), name)) {
@@ -403,7 +580,7 @@ int HPacker::decode(const uint8_t *buf, size_t len, KeyValueVector &headers) {
             }
             ret = decodeString(ptr, end - ptr, value);
             if (ret <= 0) {
-                return -1;
+                return ret < 0 ? -1 : int(start - buf);
             }
             ptr += ret;
             if (PrefixType::LITERAL_HEADER_WITH_INDEXING == type) {
@@ -416,9 +593,17 @@ int HPacker::decode(const uint8_t *buf, size_t len, KeyValueVector &headers) {
             table_.updateLimitSize(static_cast<size_t>(I));
             continue;
         }
-        headers.emplace_back(std::make_pair(name, value));
+        // RFC 7540, 6.5.2, the size of header field is its length plus 32
+        headerListSize_ += name.size() + value.size() + 32;
+        if (maxHeaderListSize_ > 0 && headerListSize_ > maxHeaderListSize_) {
+            // keep decoding to sync the dynamic table, but drop the headers
+            headerListTooLarge_ = true;
+        }
+        if (!headerListTooLarge_) {
+            headers.emplace_back(std::move(name), std::move(value));
+        }
     }
-    return int(len);
+    return int(ptr - buf);
 }
 
 } // namespace hpack
@@ -24,6 +24,8 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
 #include <functional>
 
 #include "HPackTable.h"
@@ -46,19 +48,73 @@ public:
 public:
     int encode(const KeyValueVector &headers, uint8_t *buf, size_t len);
     int decode(const uint8_t *buf, size_t len, KeyValueVector &headers);
+    /*
+     * decode a header block fragment as it arrives, the decoded headers are appended to headers.
+     * a header field split between fragments is kept until the rest of it arrives,
+     * endBlock indicates the last fragment of the header block.
+     * return len on success, -1 on decoding error
+     */
+    int decode(const uint8_t *buf, size_t len, bool endBlock, KeyValueVector &headers);
+    /*
+     * limit the size of decoded header list, 0 means unlimited. the headers beyond
+     * the limit are decoded to keep the dynamic table in sync but not emitted
+     */
+    void setMaxHeaderListSize(size_t maxSize) { maxHeaderListSize_ = maxSize; }
+    size_t getMaxHeaderListSize() const { return maxHeaderListSize_; }
+    /*
+     * true if the header list of the current or last header block exceeds the limit
+     */
+    bool isHeaderListTooLarge() const { return headerListTooLarge_; }
     void setMaxTableSize(size_t maxSize) { table_.setMaxSize(maxSize); }
+    /*
+     * change both the maximum and the current size of dynamic table,
+     * encoder will signal the new size at the beginning of next header block
+     */
+    void updateTableSize(size_t tableSize);
+    size_t getTableSize() { return table_.getLimitSize(); }
     void setIndexingTypeCallback(IndexingTypeCallback cb) { query_cb_ = std::move(cb); }
+    /*
+     * cache up to maxBlocks encoded header blocks, a cached block is reused only
+     * when the dynamic table has not been changed since it was encoded
+     */
+    void setEncodeCacheSize(size_t maxBlocks);
     
 private:
     int encodeHeader(const std::string &name, const std::string &value, uint8_t *buf, size_t len);
+    int decodeHeaders(const uint8_t *buf, size_t len, KeyValueVector &headers);
     int encodeSizeUpdate(int sz, uint8_t *buf, size_t len);
+    int encodeFromCache(const std::string &key, uint8_t *buf, size_t len);
+    void addToCache(std::string &&key, const uint8_t *block, size_t len, uint64_t generation);
 
     IndexingType getIndexingType(const std::string &name, const std::string &value);
+    IndexingType getAdaptiveIndexingType(const std::string &name, const std::string &value);
     
 private:
+    struct ValueStats {
+        std::vector<size_t> values; // hashes of distinct values seen
+        bool volatileName = false;
+    };
+    struct EncodedBlock {
+        std::string key;
+        std::vector<uint8_t> block;
+        uint64_t generation = 0;
+    };
+    
     HPackTable table_;
     IndexingTypeCallback query_cb_;
     bool updateTableSize_ = true;
+    bool indexDeferred_ = false;
+    
+    std::map<std::string, ValueStats> valueStats_;
+    std::deque<EncodedBlock> encodeCache_;
+    size_t maxCacheBlocks_ = 0;
+    
+    // the incomplete header field of the header block being decoded
+    std::vector<uint8_t> pending_;
+    bool blockStarted_ = false;
+    size_t headerListSize_ = 0;
+    size_t maxHeaderListSize_ = 0;
+    bool headerListTooLarge_ = false;
 };
 
 } // namespace hpack
@@ -30,6 +30,36 @@ MY_ZLIB_SRC_FILES := \
     $(MY_ZLIB_DIR)/uncompr.c \
     $(MY_ZLIB_DIR)/zutil.c
 
+MY_ZSTD_DIR := ../third_party/zstd/lib
+
+MY_ZSTD_SRC_FILES := \
+    $(MY_ZSTD_DIR)/common/debug.c \
+    $(MY_ZSTD_DIR)/common/entropy_common.c \
+    $(MY_ZSTD_DIR)/common/error_private.c \
+    $(MY_ZSTD_DIR)/common/fse_decompress.c \
+    $(MY_ZSTD_DIR)/common/pool.c \
+    $(MY_ZSTD_DIR)/common/threading.c \
+    $(MY_ZSTD_DIR)/common/xxhash.c \
+    $(MY_ZSTD_DIR)/common/zstd_common.c \
+    $(MY_ZSTD_DIR)/compress/fse_compress.c \
+    $(MY_ZSTD_DIR)/compress/hist.c \
+    $(MY_ZSTD_DIR)/compress/huf_compress.c \
+    $(MY_ZSTD_DIR)/compress/zstd_compress.c \
+    $(MY_ZSTD_DIR)/compress/zstd_compress_literals.c \
+    $(MY_ZSTD_DIR)/compress/zstd_compress_sequences.c \
+    $(MY_ZSTD_DIR)/compress/zstd_compress_superblock.c \
+    $(MY_ZSTD_DIR)/compress/zstd_double_fast.c \
+    $(MY_ZSTD_DIR)/compress/zstd_fast.c \
+    $(MY_ZSTD_DIR)/compress/zstd_lazy.c \
+    $(MY_ZSTD_DIR)/compress/zstd_ldm.c \
+    $(MY_ZSTD_DIR)/compress/zstd_opt.c \
+    $(MY_ZSTD_DIR)/compress/zstd_preSplit.c \
+    $(MY_ZSTD_DIR)/compress/zstdmt_compress.c \
+    $(MY_ZSTD_DIR)/decompress/huf_decompress.c \
+    $(MY_ZSTD_DIR)/decompress/zstd_ddict.c \
+    $(MY_ZSTD_DIR)/decompress/zstd_decompress.c \
+    $(MY_ZSTD_DIR)/decompress/zstd_decompress_block.c
+
 LOCAL_SRC_FILES := \
     AcceptorBase.cpp \
     SocketBase.cpp \
@@ -46,6 +76,7 @@ LOCAL_SRC_FILES := \
     http/HttpRequestImpl.cpp \
     http/Http1xRequest.cpp \
     http/HttpResponseImpl.cpp \
+    http/StaticResourceCache.cpp \
     http/Http1xResponse.cpp \
     http/HttpCache.cpp \
     http/httputils.cpp \
@@ -61,11 +92,16 @@ LOCAL_SRC_FILES := \
     http/v2/H2ConnectionMgr.cpp \
     http/v2/h2utils.cpp \
     http/v2/PushClient.cpp \
+    http/v2/PushServer.cpp \
     http/v2/hpack/HPackTable.cpp \
     http/v2/hpack/HPacker.cpp \
     compr/compr.cpp \
     compr/compr_zlib.cpp \
+    compr/compr_policy.cpp \
+    compr/compr_brotli.cpp \
+    compr/compr_zstd.cpp \
     ws/WSHandler.cpp \
+    ws/WSMask.cpp \
     ws/WebSocketImpl.cpp \
     ws/WSConnection.cpp \
     ws/WSConnection_v1.cpp \
@@ -77,6 +113,7 @@ LOCAL_SRC_FILES := \
     util/util.cpp \
     util/base64.cpp \
     ssl/SslHandler.cpp \
+    ssl/SslSessionCache.cpp \
     ssl/BioHandler.cpp \
     ssl/SioHandler.cpp \
     ssl/OpenSslLib.cpp \
@@ -87,16 +124,30 @@ LOCAL_SRC_FILES := \
     kmapi.cpp
 
 LOCAL_SRC_FILES += $(MY_ZLIB_SRC_FILES)
+LOCAL_SRC_FILES += $(MY_ZSTD_SRC_FILES)
 
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH) \
     $(MY_ROOT)/include \
 	$(MY_ROOT)/third_party \
+	$(MY_ROOT)/third_party/zstd/lib \
 	$(OPENSSL_PATH)/include
 
 LOCAL_LDLIBS := -ldl -llog -l$(LIBKEV_LIB_PATH)/libkev.a -l$(OPENSSL_LIB_PATH)/libssl.1.1.so -l$(OPENSSL_LIB_PATH)/libcrypto.1.1.so
-LOCAL_CFLAGS := -w -O2 -D__ANDROID__ -DKUMA_HAS_OPENSSL
+LOCAL_CFLAGS := -w -O2 -D__ANDROID__ -DKUMA_HAS_OPENSSL -DKUMA_HAS_ZSTD -DZSTD_DISABLE_ASM
 LOCAL_CPPFLAGS := -std=c++14
 LOCAL_CPP_FEATURES := rtti exceptions
 
+# brotli is built if its sources are provided in third_party/brotli
+MY_BROTLI_DIR := ../third_party/brotli/c
+ifneq ($(wildcard $(LOCAL_PATH)/$(MY_BROTLI_DIR)/include/brotli/encode.h),)
+MY_BROTLI_SRC_FILES := $(patsubst $(LOCAL_PATH)/%,%,$(wildcard \
+    $(LOCAL_PATH)/$(MY_BROTLI_DIR)/common/*.c \
+    $(LOCAL_PATH)/$(MY_BROTLI_DIR)/dec/*.c \
+    $(LOCAL_PATH)/$(MY_BROTLI_DIR)/enc/*.c))
+LOCAL_SRC_FILES += $(MY_BROTLI_SRC_FILES)
+LOCAL_C_INCLUDES += $(MY_ROOT)/third_party/brotli/c/include
+LOCAL_CFLAGS += -DKUMA_HAS_BROTLI
+endif
+
 include $(BUILD_SHARED_LIBRARY)
@@ -30,8 +30,11 @@
 #include "http/HttpResponseImpl.h"
 #include "ws/WebSocketImpl.h"
 #include "http/v2/H2ConnectionImpl.h"
+#include "http/v2/H2ConnectionMgr.h"
 #include "http/v2/Http2Request.h"
 #include "http/v2/Http2Response.h"
+#include "http/v2/PushServer.h"
+#include "http/StaticResourceCache.h"
 #include "proxy/ProxyConnectionImpl.h"
 #include "libkev/src/util/kmtrace.h"
 #include "util/ImplHelper.h"
@@ -39,6 +42,7 @@
 
 #ifdef KUMA_HAS_OPENSSL
 #include "ssl/OpenSslLib.h"
+#include "ssl/SslSessionCache.h"
 #endif
 #include "DnsResolver.h"
 
@@ -1008,6 +1012,64 @@ void HttpResponse::reset()
     pimpl_->reset();
 }
 
+KMError HttpResponse::pushResource(const char *path)
+{
+    if (!path || path[0] != '/') {
+        return KMError::INVALID_PARAM;
+    }
+    return pimpl_->pushResource(path);
+}
+
+KMError HttpResponse::addPushResource(const char *path, int status_code, const char *content_type, const KMBuffer &body)
+{
+    return addPushResource("", path, status_code, content_type, body);
+}
+
+KMError HttpResponse::addPushResource(const char *authority, const char *path, int status_code, const char *content_type, const KMBuffer &body)
+{
+    if (!authority || !path || path[0] != '/') {
+        return KMError::INVALID_PARAM;
+    }
+    PushCache::instance().setResource(authority, path, status_code, content_type ? content_type : "", body);
+    return KMError::NOERR;
+}
+
+void HttpResponse::removePushResource(const char *path)
+{
+    removePushResource("", path);
+}
+
+void HttpResponse::removePushResource(const char *authority, const char *path)
+{
+    if (authority && path) {
+        PushCache::instance().removeResource(authority, path);
+    }
+}
+
+KMError HttpResponse::sendStaticResource(const char *path, int status_code)
+{
+    if (!path) {
+        return KMError::INVALID_PARAM;
+    }
+    return pimpl_->sendStaticResource(path, status_code);
+}
+
+KMError HttpResponse::addStaticResource(const char *path, const char *content_type, const KMBuffer &body, bool async)
+{
+    if (!path) {
+        return KMError::INVALID_PARAM;
+    }
+    StaticResourceCache::instance().setResource(path, content_type ? content_type : "", body, async);
+    return KMError::NOERR;
+}
+
+void HttpResponse::removeStaticResource(const char *path)
+{
+    if (path) {
+        StaticResourceCache::instance().removeResource(path);
+    }
+}
+
 KMError HttpResponse::close()
 {
     return pimpl_->close();
@@ -1087,6 +1149,63 @@ HttpResponse::Impl* HttpResponse::pimpl()
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+WebSocket::PreparedMessage::PreparedMessage(const void *data, size_t len, bool is_text)
+: pimpl_(new Impl(KMBuffer(data, len, len), is_text))
+{
+    
+}
+
+WebSocket::PreparedMessage::PreparedMessage(const KMBuffer &buf, bool is_text)
+: pimpl_(new Impl(buf, is_text))
+{
+    
+}
+
+WebSocket::PreparedMessage::PreparedMessage(const PreparedMessage &other)
+: pimpl_(new Impl(*other.pimpl_))
+{
+    
+}
+
+WebSocket::PreparedMessage::PreparedMessage(PreparedMessage &&other)
+: pimpl_(std::exchange(other.pimpl_, nullptr))
+{
+    
+}
+
+WebSocket::PreparedMessage::~PreparedMessage()
+{
+    delete pimpl_;
+}
+
+WebSocket::PreparedMessage& WebSocket::PreparedMessage::operator=(const PreparedMessage &other)
+{
+    if (this != &other) {
+        delete pimpl_;
+        pimpl_ = new Impl(*other.pimpl_);
+    }
+    return *this;
+}
+
+WebSocket::PreparedMessage& WebSocket::PreparedMessage::operator=(PreparedMessage &&other)
+{
+    if (this != &other) {
+        delete pimpl_;
+        pimpl_ = std::exchange(other.pimpl_, nullptr);
+    }
+    return *this;
+}
+
+size_t WebSocket::PreparedMessage::size() const
+{
+    return pimpl_->payloadSize();
+}
+
+WebSocket::PreparedMessage::Impl* WebSocket::PreparedMessage::pimpl() const
+{
+    return pimpl_;
+}
+
 WebSocket::WebSocket(EventLoop* loop, const char *http_ver)
 : pimpl_(new Impl(EventLoopHelper::implPtr(loop->pimpl()), http_ver))
 {
@@ -1211,6 +1330,16 @@ int WebSocket::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32_t fla
     return pimpl_->send(buf, is_text, is_fin, flags);
 }
 
+int WebSocket::send(const PreparedMessage &msg)
+{
+    return pimpl_->send(*msg.pimpl());
+}
+
+int WebSocket::sendBatch(const iovec *msgs, int count, bool is_text, uint32_t flags)
+{
+    return pimpl_->sendBatch(msgs, count, is_text, flags);
+}
+
 KMError WebSocket::close()
 {
     return pimpl_->close();
@@ -1253,6 +1382,26 @@ void WebSocket::setErrorCallback(EventCallback cb)
     pimpl_->setErrorCallback(std::move(cb));
 }
 
+void WebSocket::setMessageAggregation(bool enable)
+{
+    pimpl_->setMessageAggregation(enable);
+}
+
+void WebSocket::setMaxMessageSize(size_t max_size)
+{
+    pimpl_->setMaxMessageSize(max_size);
+}
+
+KMError WebSocket::setDeflatePolicy(int max_window_bits, bool no_context_takeover)
+{
+    return Impl::setDeflatePolicy(max_window_bits, no_context_takeover);
+}
+
+KMError WebSocket::setDeflateDictionary(const void *dict, size_t len)
+{
+    return Impl::setDeflateDictionary(dict, len);
+}
+
 WebSocket::Impl* WebSocket::pimpl()
 {
     return pimpl_;
@@ -1439,6 +1588,11 @@ KMError H2Connection::close()
     return pimpl_->close();
 }
 
+void H2Connection::setMaxLocalWindowSize(uint32_t max_window_size)
+{
+    pimpl_->setMaxLocalWindowSize(max_window_size);
+}
+
 void H2Connection::setAcceptCallback(AcceptCallback cb)
 {
     pimpl_->setAcceptCallback(std::move(cb));
@@ -1468,11 +1622,55 @@ void init(const char* path)
 void fini()
 {
 #ifdef KUMA_HAS_OPENSSL
+    SslSessionCache::get().clear();
     OpenSslLib::fini();
 #endif
     DnsResolver::get().stop();
 }
 
+void setSslSessionCache(size_t max_sessions, uint32_t timeout_secs)
+{
+#ifdef KUMA_HAS_OPENSSL
+    SslSessionCache::get().setPolicy(max_sessions, timeout_secs);
+#endif
+}
+
+void getSslSessionStats(SslSessionStats &stats)
+{
+#ifdef KUMA_HAS_OPENSSL
+    auto s = SslSessionCache::get().getStats();
+    stats.hits = s.hits;
+    stats.misses = s.misses;
+    stats.stores = s.stores;
+    stats.resumed = s.resumed;
+#else
+    stats = SslSessionStats();
+#endif
+}
+
+void setH2PingPolicy(uint32_t interval_ms, uint32_t timeout_ms)
+{
+    H2ConnectionMgr::setPingPolicy(interval_ms, timeout_ms);
+}
+
+bool getH2RttStats(const char *host, uint16_t port, bool secure, H2RttStats &stats)
+{
+    if (!host) {
+        return false;
+    }
+    return H2ConnectionMgr::getRequestConnMgr(secure).getRttStats(host, port, stats);
+}
+
+void setH2WindowBudget(size_t limit)
+{
+    WindowBudget::get().setLimit(limit);
+}
+
+void setH2MaxWindowSize(uint32_t max_window_size)
+{
+    H2ConnectionMgr::setMaxWindowSize(max_window_size);
+}
+
 void setLogCallback(LogCallback cb)
 {
     if (cb) {
@@ -25,6 +25,7 @@
 #include "libkev/src/util/kmtrace.h"
 #include "libkev/src/util/util.h"
 #include "SslHandler.h"
+#include "SslSessionCache.h"
 
 #include <string>
 #include <thread>
@@ -246,6 +247,11 @@ SSL_CTX* OpenSslLib::createSSLContext(const SSL_METHOD *method, const std::strin
             //app_verify_arg arg1;
             //SSL_CTX_set_cert_verify_callback(ssl_ctx, appVerifyCallback, &arg1);
         }
+        if (clientMode) {
+            // sessions are cached by SslSessionCache with host:port/SNI as key
+            SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ssl_ctx, newSessionCallback);
+        }
         if (!clientMode) {
 #if OPENSSL_VERSION_NUMBER >= 0x1000200fL && !defined(OPENSSL_NO_TLSEXT)
             SSL_CTX_set_alpn_select_cb(ssl_ctx, alpnCallback, (void*)&alpnProtos);
@@ -307,6 +313,20 @@ void* OpenSslLib::getSSLData(SSL* ssl)
     return SSL_get_ex_data(ssl, ssl_index_);
 }
 
+int OpenSslLib::newSessionCallback(SSL *ssl, SSL_SESSION *session)
+{
+    auto ssl_data = getSSLData(ssl);
+    if (!ssl_data) {
+        return 0;
+    }
+    auto handler = reinterpret_cast<SslHandler*>(ssl_data);
+    if (handler->getSessionKey().empty()) {
+        return 0;
+    }
+    SslSessionCache::get().store(handler->getSessionKey(), session);
+    return 1; // the session is owned by cache
+}
+
 struct app_verify_arg
 {
     char *string;
@@ -66,6 +66,7 @@ public:
 #endif
     
     static int passwdCallback(char *buf, int size, int rwflag, void *userdata);
+    static int newSessionCallback(SSL *ssl, SSL_SESSION *session);
     
     static SSL_CTX* defaultClientContext();
     static SSL_CTX* defaultServerContext();
@@ -22,6 +22,7 @@
 #ifdef KUMA_HAS_OPENSSL
 
 #include "SslHandler.h"
+#include "SslSessionCache.h"
 #include "libkev/src/util/kmtrace.h"
 
 #include <openssl/x509v3.h>
@@ -36,6 +37,21 @@ void SslHandler::cleanup()
         ssl_ = NULL;
     }
     setState(SslState::SSL_NONE);
+    session_key_.clear();
+}
+
+void SslHandler::setState(SslState state)
+{
+    state_ = state;
+    if (session_key_.empty() || !ssl_) {
+        return;
+    }
+    if (state == SslState::SSL_SUCCESS) {
+        SslSessionCache::get().onHandshakeComplete(SSL_session_reused(ssl_) == 1);
+    } else if (state == SslState::SSL_ERROR) {
+        // don't offer the session again if it caused the failure
+        SslSessionCache::get().remove(session_key_);
+    }
 }
 
 KMError SslHandler::init(SslRole ssl_role, SOCKET_FD fd, uint32_t ssl_flags)
@@ -114,6 +130,16 @@ KMError SslHandler::setServerName(const std::string &serverName)
 #endif
 }
 
+KMError SslHandler::setSessionKey(const std::string &key)
+{
+    if (!ssl_ || is_server_) {
+        return KMError::INVALID_STATE;
+    }
+    session_key_ = key;
+    SslSessionCache::get().resume(ssl_, session_key_);
+    return KMError::NOERR;
+}
+
 KMError SslHandler::setHostName(const std::string &hostName)
 {
     if (ssl_) {
@@ -50,6 +50,11 @@ public:
     virtual KMError getAlpnSelected(std::string &protocol);
     virtual KMError setServerName(const std::string &serverName);
     virtual KMError setHostName(const std::string &hostName);
+    /*
+     * client only, resume the cached session of key and cache the new session under key
+     */
+    KMError setSessionKey(const std::string &key);
+    const std::string& getSessionKey() const { return session_key_; }
     
     virtual SslState handshake() = 0;
     virtual int send(const void* data, size_t size) = 0;
@@ -64,7 +69,7 @@ public:
     uint32_t getSslFlags() const { return ssl_flags_; }
     
 protected:
-    void setState(SslState state) { state_ = state; }
+    void setState(SslState state);
     const std::string& getObjKey() const { return obj_key_; }
     virtual void cleanup();
     
@@ -74,6 +79,7 @@ protected:
     SslState    state_ = SslState::SSL_NONE;
     bool        is_server_ = false;
     uint32_t    ssl_flags_ = 0;
+    std::string session_key_;
     std::string obj_key_{ "SslHandler" };
 };
 
@@ -0,0 +1,163 @@
+/* Copyright (c) 2014-2017, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef KUMA_HAS_OPENSSL
+
+#include "SslSessionCache.h"
+#include "libkev/src/util/kmtrace.h"
+
+#include <ctime>
+
+using namespace kuma;
+
+SslSessionCache& SslSessionCache::get()
+{
+    static SslSessionCache s_cache;
+    return s_cache;
+}
+
+SslSessionCache::~SslSessionCache()
+{
+    clear();
+}
+
+void SslSessionCache::setPolicy(size_t max_sessions, uint32_t timeout_secs)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    max_sessions_ = max_sessions;
+    timeout_secs_ = timeout_secs;
+    while (entries_.size() > max_sessions_) {
+        removeEntry(std::prev(entries_.end()));
+    }
+}
+
+bool SslSessionCache::resume(SSL *ssl, const std::string &key)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        ++misses_;
+        return false;
+    }
+    auto eit = it->second;
+    if (isExpired(*eit, Clock::now())) {
+        removeEntry(eit);
+        ++misses_;
+        return false;
+    }
+    // SSL_set_session increments the reference count of session
+    if (SSL_set_session(ssl, eit->session) != 1) {
+        KM_WARNTRACE("SslSessionCache::resume, SSL_set_session failed, key=" << key);
+        removeEntry(eit);
+        ++misses_;
+        return false;
+    }
+    ++hits_;
+#ifdef TLS1_3_VERSION
+    if (SSL_SESSION_get_protocol_version(eit->session) >= TLS1_3_VERSION) {
+        // RFC 8446, C.4, the ticket is not reused, a new one will be stored
+        removeEntry(eit);
+        return true;
+    }
+#endif
+    entries_.splice(entries_.begin(), entries_, eit);
+    return true;
+}
+
+void SslSessionCache::store(const std::string &key, SSL_SESSION *session)
+{
+    std::unique_lock<std::mutex> ul(mutex_);
+    if (max_sessions_ == 0 || timeout_secs_ == 0) {
+        ul.unlock();
+        SSL_SESSION_free(session);
+        return;
+    }
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        removeEntry(it->second);
+    }
+    while (entries_.size() >= max_sessions_) {
+        removeEntry(std::prev(entries_.end()));
+    }
+    Entry entry;
+    entry.key = key;
+    entry.session = session;
+    entry.expire_time = Clock::now() + std::chrono::seconds(timeout_secs_);
+    entries_.emplace_front(std::move(entry));
+    index_[key] = entries_.begin();
+    ++stores_;
+}
+
+void SslSessionCache::remove(const std::string &key)
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        removeEntry(it->second);
+    }
+}
+
+void SslSessionCache::clear()
+{
+    std::lock_guard<std::mutex> g(mutex_);
+    for (auto &entry : entries_) {
+        SSL_SESSION_free(entry.session);
+    }
+    entries_.clear();
+    index_.clear();
+}
+
+SslSessionCache::Stats SslSessionCache::getStats() const
+{
+    Stats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.stores = stores_;
+    stats.resumed = resumed_;
+    return stats;
+}
+
+bool SslSessionCache::isExpired(const Entry &entry, Clock::time_point now) const
+{
+    if (now >= entry.expire_time) {
+        return true;
+    }
+    // the lifetime of session, or ticket lifetime hint of TLS 1.3
+    auto session_expire = SSL_SESSION_get_time(entry.session) + SSL_SESSION_get_timeout(entry.session);
+    if (static_cast<long>(::time(nullptr)) >= session_expire) {
+        return true;
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    if (!SSL_SESSION_is_resumable(entry.session)) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+void SslSessionCache::removeEntry(EntryList::iterator it)
+{
+    SSL_SESSION_free(it->session);
+    index_.erase(it->key);
+    entries_.erase(it);
+}
+
+#endif // KUMA_HAS_OPENSSL
@@ -0,0 +1,107 @@
+/* Copyright (c) 2014-2017, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SslSessionCache_H__
+#define __SslSessionCache_H__
+
+#ifdef KUMA_HAS_OPENSSL
+
+#include "kmdefs.h"
+#include "OpenSslLib.h"
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+KUMA_NS_BEGIN
+
+/*
+ * client side TLS session cache, the sessions (TLS 1.2 session id or TLS 1.3 ticket)
+ * are keyed by host:port/SNI and resumed on the next connection to the same peer
+ */
+class SslSessionCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;      // a cached session is set to the connection
+        uint64_t misses = 0;    // no valid session is cached for the connection
+        uint64_t stores = 0;    // a new session or ticket is cached
+        uint64_t resumed = 0;   // the handshake resumed the session
+    };
+    
+    static SslSessionCache& get();
+    
+    ~SslSessionCache();
+    
+    /*
+     * max_sessions 0 disables the cache, the session is expired after
+     * timeout_secs or its own lifetime, whichever comes first
+     */
+    void setPolicy(size_t max_sessions, uint32_t timeout_secs);
+    
+    /*
+     * set the cached session of key to ssl, return true if the session is set.
+     * TLS 1.3 ticket is removed from cache since it should be used only once
+     */
+    bool resume(SSL *ssl, const std::string &key);
+    /*
+     * take the ownership of session
+     */
+    void store(const std::string &key, SSL_SESSION *session);
+    void remove(const std::string &key);
+    void clear();
+    
+    void onHandshakeComplete(bool resumed) { if (resumed) ++resumed_; }
+    Stats getStats() const;
+    
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry
+    {
+        std::string key;
+        SSL_SESSION *session = nullptr;
+        Clock::time_point expire_time;
+    };
+    using EntryList = std::list<Entry>;
+    
+    bool isExpired(const Entry &entry, Clock::time_point now) const;
+    void removeEntry(EntryList::iterator it);
+    
+private:
+    mutable std::mutex mutex_;
+    size_t max_sessions_ = 1024;
+    uint32_t timeout_secs_ = 3600;
+    EntryList entries_; // most recently used first
+    std::unordered_map<std::string, EntryList::iterator> index_;
+    
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> stores_{0};
+    std::atomic<uint64_t> resumed_{0};
+};
+
+KUMA_NS_END
+#endif // KUMA_HAS_OPENSSL
+#endif // __SslSessionCache_H__
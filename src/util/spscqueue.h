@@ -0,0 +1,147 @@
+/* Copyright (c) 2016, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SpscQueue_H__
+#define __SpscQueue_H__
+
+#include "kmdefs.h"
+
+#include <atomic>
+#include <utility>
+
+KUMA_NS_BEGIN
+
+/*
+ * unbounded lock-free queue for single producer and single consumer.
+ * the consumed nodes are recycled by producer, so there is no allocation
+ * in steady state.
+ * enqueue is called on producer thread, the others are called on consumer thread
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+    SpscQueue()
+    {
+        auto *n = new Node;
+        head_ = n;
+        tail_ = first_ = head_copy_ = n;
+    }
+    
+    ~SpscQueue()
+    {
+        auto *n = first_;
+        while (n) {
+            auto *next = n->next.load(std::memory_order_relaxed);
+            delete n;
+            n = next;
+        }
+    }
+    
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue& operator=(const SpscQueue &) = delete;
+    
+    void enqueue(T &&value)
+    {
+        auto *n = allocNode();
+        n->value = std::move(value);
+        n->next.store(nullptr, std::memory_order_relaxed);
+        tail_->next.store(n, std::memory_order_release);
+        tail_ = n;
+    }
+    
+    bool dequeue(T &value)
+    {
+        auto *next = head_.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        value = std::move(next->value);
+        next->value = T();
+        head_.store(next, std::memory_order_release);
+        return true;
+    }
+    
+    /*
+     * return nullptr if queue is empty
+     */
+    T* front()
+    {
+        auto *next = head_.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+        return next ? &next->value : nullptr;
+    }
+    
+    void pop_front()
+    {
+        auto *next = head_.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+        if (next) {
+            next->value = T();
+            head_.store(next, std::memory_order_release);
+        }
+    }
+    
+    bool empty() const
+    {
+        return !head_.load(std::memory_order_relaxed)->next.load(std::memory_order_acquire);
+    }
+    
+    void clear()
+    {
+        while (!empty()) {
+            pop_front();
+        }
+    }
+    
+private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        T value{};
+    };
+    
+    Node* allocNode()
+    {// on producer thread
+        if (first_ != head_copy_) {
+            auto *n = first_;
+            first_ = first_->next.load(std::memory_order_relaxed);
+            return n;
+        }
+        head_copy_ = head_.load(std::memory_order_acquire);
+        if (first_ != head_copy_) {
+            auto *n = first_;
+            first_ = first_->next.load(std::memory_order_relaxed);
+            return n;
+        }
+        return new Node;
+    }
+    
+    // consumer
+    std::atomic<Node*> head_; // dummy node, the first element is head_->next
+    
+    // producer
+    Node* tail_;
+    Node* first_; // the nodes from first_ to head_copy_ are consumed and can be recycled
+    Node* head_copy_;
+};
+
+KUMA_NS_END
+
+#endif
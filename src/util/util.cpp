@@ -21,6 +21,8 @@
 
 #include "util.h"
 
+#include <algorithm>
+
 KUMA_NS_BEGIN
 
 KMError toKMError(kev::Result result)
@@ -76,6 +78,33 @@ KMError toKMError(kev::Result result)
     }
 }
 
+KMBuffer* sliceBuffer(const KMBuffer &buf, size_t offset, size_t len)
+{
+    KMBuffer *slice = nullptr;
+    for (auto it = buf.begin(); it != buf.end() && len > 0; ++it) {
+        auto kmb_len = it->length();
+        if (offset >= kmb_len) {
+            offset -= kmb_len;
+            continue;
+        }
+        auto n = std::min<size_t>(kmb_len - offset, len);
+        KMBuffer *kmb = nullptr;
+        if (it->isShared()) {
+            kmb = it->subbuffer(offset, n);
+        } else {
+            kmb = new KMBuffer(static_cast<char*>(it->readPtr()) + offset, n, n, KMBuffer::StorageType::OTHER);
+        }
+        offset = 0;
+        len -= n;
+        if (slice) {
+            slice->append(kmb);
+        } else {
+            slice = kmb;
+        }
+    }
+    return slice;
+}
+
 KUMA_NS_END
 
 
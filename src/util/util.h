@@ -23,6 +23,7 @@
 #define __kuma_util_h__
 
 #include "kmdefs.h"
+#include "kmbuffer.h"
 #include "libkev/src/util/util.h"
 
 #include <string>
@@ -72,6 +73,13 @@ inline bool is_fatal_error(KMError err)
 
 KMError toKMError(kev::Result result);
 
+/*
+ * link [offset, offset + len) of buf into a new chain without copying, shared blocks
+ * are referenced and the others are viewed in place. buf is not modified, the data
+ * of non-shared blocks should be valid until the returned chain is destroyed
+ */
+KMBuffer* sliceBuffer(const KMBuffer &buf, size_t offset, size_t len);
+
 KUMA_NS_END
 
 
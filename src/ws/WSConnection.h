@@ -55,6 +55,7 @@ public:
     virtual KMError setSslFlags(uint32_t ssl_flags) = 0;
     virtual KMError connect(const std::string& ws_url) = 0;
     virtual int send(const iovec* iovs, int count) = 0;
+    virtual int send(const KMBuffer &buf) = 0;
     virtual KMError close() = 0;
     virtual bool canSendData() const = 0;
     virtual const std::string& getPath() const = 0;
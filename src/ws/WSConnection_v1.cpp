@@ -178,6 +178,11 @@ int WSConnection_V1::send(const iovec* iovs, int count)
     return ret;
 }
 
+int WSConnection_V1::send(const KMBuffer &buf)
+{
+    return stream_->sendData(buf);
+}
+
 KMError WSConnection_V1::close()
 {
     cleanup();
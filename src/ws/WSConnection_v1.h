@@ -50,6 +50,7 @@ public:
                          const KMBuffer *init_buf,
                          HandshakeCallback cb);
     int send(const iovec* iovs, int count) override;
+    int send(const KMBuffer &buf) override;
     KMError close() override;
     bool canSendData() const override;
     const std::string& getPath() const override
@@ -55,6 +55,8 @@ WSConnection_V2::WSConnection_V2(const EventLoopPtr &loop)
     stream_->setOutgoingCompleteCallback([this] {
         onError(KMError::PROTO_ERROR);
     });
+    // a WebSocket frame is never partially sent under flow control
+    stream_->setSendAll(true);
     KM_SetObjKey("WSConnection_V2");
 }
 
@@ -163,6 +165,11 @@ int WSConnection_V2::send(const iovec* iovs, int count)
     return ret;
 }
 
+int WSConnection_V2::send(const KMBuffer &buf)
+{
+    return stream_->sendData(buf);
+}
+
 KMError WSConnection_V2::close()
 {
     stream_->close();
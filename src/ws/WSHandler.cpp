@@ -20,9 +20,12 @@
  */
 
 #include "WSHandler.h"
+#include "WSMask.h"
+#include "compr/compr.h"
 #include "libkev/src/util/kmtrace.h"
 #include "libkev/src/util/util.h"
 
+#include <algorithm>
 
 using namespace kuma;
 using namespace kuma::ws;
@@ -43,6 +46,30 @@ WSError WSHandler::handleData(uint8_t* data, size_t len)
     return decodeFrame(data, len);
 }
 
+WSError WSHandler::handleData(KMBuffer &buf)
+{
+    WSError err = WSError::NOERR;
+    for (auto it = buf.begin(); it != buf.end(); ++it) {
+        if (ctx_.state == DecodeState::CLOSED) {
+            return WSError::CLOSED;
+        } else if (ctx_.state == DecodeState::IN_ERROR) {
+            // the frame receiver is no longer in open state
+            return WSError::INVALID_STATE;
+        }
+        if (it->length() == 0) {
+            continue;
+        }
+        auto *data = static_cast<uint8_t*>(it->readPtr());
+        DESTROY_DETECTOR_SETUP();
+        err = decodeFrame(data, it->length(), &(*it));
+        DESTROY_DETECTOR_CHECK(WSError::DESTROYED);
+        if (err != WSError::NOERR && err != WSError::NEED_MORE_DATA) {
+            return err;
+        }
+    }
+    return err;
+}
+
 int WSHandler::encodeFrameHeader(FrameHeader hdr, uint8_t hdr_buf[WS_MAX_HEADER_SIZE])
 {
     uint8_t first_byte = 0x00;
@@ -105,7 +132,7 @@ int WSHandler::encodeFrameHeader(FrameHeader hdr, uint8_t hdr_buf[WS_MAX_HEADER_
     return hdr_len;
 }
 
-WSError WSHandler::decodeFrame(uint8_t* data, size_t len)
+WSError WSHandler::decodeFrame(uint8_t* data, size_t len, const KMBuffer *seg)
 {
 #define WS_MAX_FRAME_DATA_LENGTH	10*1024*1024
     
@@ -141,7 +168,7 @@ WSError WSHandler::decodeFrame(uint8_t* data, size_t len)
                     ctx_.hdr.plen = b & 0x7F;
                     ctx_.hdr.xpl.xpl64 = 0;
                     ctx_.pos = 0;
-                    ctx_.buf.clear();
+                    ctx_.resetBuffer();
                     if (isControlFrame(ctx_.hdr.opcode) && ctx_.hdr.plen > 125) {
                         // the payload length of control frames MUST <= 125
                         ctx_.state = DecodeState::IN_ERROR;
@@ -232,38 +259,50 @@ WSError WSHandler::decodeFrame(uint8_t* data, size_t len)
                     ctx_.state = DecodeState::IN_ERROR;
                     return WSError::PROTOCOL_ERROR;
                 }
-                ctx_.buf.clear();
+                if (checkMessageSize(ctx_.hdr) != WSError::NOERR) {
+                    // reject it before any payload is buffered
+                    ctx_.state = DecodeState::IN_ERROR;
+                    return WSError::MESSAGE_TOO_BIG;
+                }
+                ctx_.resetBuffer();
                 ctx_.state = DecodeState::DATA;
                 
                 FALLTHROUGH;
             }
             case DecodeState::DATA:
             {
-                if (len-pos+ctx_.buf.size() < ctx_.hdr.length) {
-                    auto buf_size = ctx_.buf.size();
-                    auto read_len = len - pos;
-                    ctx_.buf.reserve(buf_size + read_len);
-                    ctx_.buf.insert(ctx_.buf.end(), data + pos, data + len);
+                if (len-pos+ctx_.buf_len < ctx_.hdr.length) {
+                    // only the frame that spans reads is copied. the chain grows with the
+                    // data received, so a frame header alone cannot make it allocate the
+                    // whole payload length
+                    appendFrameData(data + pos, len - pos);
                     return WSError::NEED_MORE_DATA;
                 }
 
-                uint8_t* notify_data = nullptr;
-                uint32_t notify_len = 0;
-                if (ctx_.buf.empty()) {
-                    notify_data = data + pos;
-                    notify_len = ctx_.hdr.length;
+                WSError err = WSError::NOERR;
+                if (ctx_.buf_len == 0) {
+                    // the whole payload is in this read, unmask in place
+                    auto *notify_data = data + pos;
+                    uint32_t notify_len = ctx_.hdr.length;
                     pos += notify_len;
+                    handleDataMask(ctx_.hdr, notify_data, notify_len);
+                    if (seg && seg->isShared() && notify_len > 0) {
+                        // slice of the receive buffer, the receiver can retain it without copy
+                        auto offset = notify_data - static_cast<uint8_t*>(seg->readPtr());
+                        std::unique_ptr<KMBuffer> payload(seg->subbuffer(offset, notify_len));
+                        err = handleFrame(ctx_.hdr, *payload);
+                    } else {
+                        KMBuffer payload(notify_data, notify_len, notify_len);
+                        err = handleFrame(ctx_.hdr, payload);
+                    }
                 } else {
-                    auto buf_size = ctx_.buf.size();
-                    auto read_len = ctx_.hdr.length - buf_size;
-                    ctx_.buf.reserve(ctx_.hdr.length);
-                    ctx_.buf.insert(ctx_.buf.end(), data + pos, data + pos + read_len);
-                    notify_data = &ctx_.buf[0];
-                    notify_len = ctx_.hdr.length;
+                    auto read_len = ctx_.hdr.length - ctx_.buf_len;
+                    appendFrameData(data + pos, read_len);
                     pos += read_len;
+                    handleDataMask(ctx_.hdr, *ctx_.buf);
+                    // the blocks are reference counted, the receiver can retain them without copy
+                    err = handleFrame(ctx_.hdr, *ctx_.buf);
                 }
-                handleDataMask(ctx_.hdr, notify_data, notify_len);
-                auto err = handleFrame(ctx_.hdr, notify_data, notify_len);
                 if (err != WSError::NOERR) {
                     return err;
                 }
@@ -284,12 +323,29 @@ WSError WSHandler::decodeFrame(uint8_t* data, size_t len)
     return ctx_.state == DecodeState::HDR1 ? WSError::NOERR : WSError::NEED_MORE_DATA;
 }
 
-WSError WSHandler::handleFrame(const FrameHeader &hdr, void* payload, size_t len)
+void WSHandler::appendFrameData(const uint8_t* data, size_t len)
+{
+    while (len > 0) {
+        auto *block = getCompressionBlock(ctx_.buf, ctx_.buf_tail);
+        auto copy_len = std::min(len, block->space());
+        memcpy(block->writePtr(), data, copy_len);
+        block->bytesWritten(copy_len);
+        data += copy_len;
+        len -= copy_len;
+        ctx_.buf_len += copy_len;
+    }
+}
+
+WSError WSHandler::handleFrame(const FrameHeader &hdr, KMBuffer &payload)
 {
     DESTROY_DETECTOR_SETUP();
-    KMBuffer buf(payload, len, len);
-    if(frame_cb_) frame_cb_(hdr, buf);
+    auto ret = frame_cb_ ? frame_cb_(hdr, payload) : KMError::NOERR;
     DESTROY_DETECTOR_CHECK(WSError::DESTROYED);
+    if (ret != KMError::NOERR) {
+        // receiver is closed or in error, stop decoding the rest frames
+        ctx_.state = DecodeState::IN_ERROR;
+        return WSError::INVALID_STATE;
+    }
     return WSError::NOERR;
 }
 
@@ -307,26 +363,37 @@ void WSHandler::handleDataMask(const FrameHeader& hdr, KMBuffer &buf)
 
 void WSHandler::handleDataMask(const uint8_t mask_key[WS_MASK_KEY_SIZE], uint8_t* data, size_t len)
 {
-    if(nullptr == data || 0 == len) return ;
-    
-    for(size_t i=0; i < len; ++i) {
-        data[i] = data[i] ^ mask_key[i%WS_MASK_KEY_SIZE];
-    }
+    maskData(mask_key, 0, data, len);
 }
 
 void WSHandler::handleDataMask(const uint8_t mask_key[WS_MASK_KEY_SIZE], KMBuffer &buf)
 {
-    size_t pos = 0;
+    size_t phase = 0;
     for (auto it = buf.begin(); it != buf.end(); ++it) {
-        auto *data = static_cast<uint8_t*>(it->readPtr());
-        auto len = it->length();
-        for (size_t i = 0; i < len; ++i, ++pos) {
-            data[i] = data[i] ^ mask_key[pos%WS_MASK_KEY_SIZE];
-        }
+        phase = maskData(mask_key, phase, static_cast<uint8_t*>(it->readPtr()), it->length());
     }
 }
 
+WSError WSHandler::checkMessageSize(const FrameHeader &hdr)
+{
+    if (isControlFrame(hdr.opcode)) {
+        return WSError::NOERR;
+    }
+    if (hdr.opcode != uint8_t(WSOpcode::CONTINUE)) {
+        message_size_ = 0;
+        message_compressed_ = hdr.rsv1 != 0;
+    }
+    message_size_ += hdr.length;
+    if (max_message_size_ > 0 && !message_compressed_ && message_size_ > max_message_size_) {
+        KM_WARNTRACE("WSHandler::checkMessageSize, message too big, size="<<message_size_<<", max_size="<<max_message_size_);
+        return WSError::MESSAGE_TOO_BIG;
+    }
+    return WSError::NOERR;
+}
+
 void WSHandler::reset()
 {
     ctx_.reset();
+    message_size_ = 0;
+    message_compressed_ = false;
 }
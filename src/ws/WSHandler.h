@@ -25,7 +25,6 @@
 #include "wsdefs.h"
 #include "http/HttpParserImpl.h"
 #include "libkev/src/util/DestroyDetector.h"
-#include <vector>
 
 WS_NS_BEGIN
 
@@ -41,9 +40,13 @@ public:
     WSMode getMode() const { return mode_; }
     
     WSError handleData(uint8_t* data, size_t len);
+    WSError handleData(KMBuffer &buf);
     static int encodeFrameHeader(FrameHeader hdr, uint8_t hdr_buf[WS_MAX_HEADER_SIZE]);
     
     void setFrameCallback(FrameCallback cb) { frame_cb_ = std::move(cb); }
+    // the limit applies to uncompressed messages only, the size of compressed
+    // messages is checked after inflating
+    void setMaxMessageSize(size_t max_size) { max_message_size_ = max_size; }
     
     void reset();
     
@@ -68,25 +71,42 @@ private:
         {
             memset(&hdr, 0, sizeof(hdr));
             state = DecodeState::HDR1;
-            buf.clear();
+            resetBuffer();
             pos = 0;
         }
+        void resetBuffer()
+        {
+            buf.reset();
+            buf_tail = nullptr;
+            buf_len = 0;
+        }
         FrameHeader hdr;
         DecodeState state{ DecodeState::HDR1 };
-        std::vector<uint8_t> buf;
+        // reassembly chain of pooled blocks for the frame that spans reads,
+        // the blocks return to the pool when the last reference is dropped
+        KMBuffer::Ptr buf;
+        KMBuffer* buf_tail = nullptr;
+        size_t buf_len = 0;
         uint8_t pos = 0;
     } DecodeContext;
     void cleanup();
     
     void handleDataMask(const FrameHeader& hdr, uint8_t* data, size_t len);
     void handleDataMask(const FrameHeader& hdr, KMBuffer &buf);
-    WSError decodeFrame(uint8_t* data, size_t len);
-    WSError handleFrame(const FrameHeader &hdr, void* payload, size_t len);
+    WSError decodeFrame(uint8_t* data, size_t len, const KMBuffer *seg = nullptr);
+    void appendFrameData(const uint8_t* data, size_t len);
+    WSError handleFrame(const FrameHeader &hdr, KMBuffer &payload);
+    WSError checkMessageSize(const FrameHeader &hdr);
     
 private:
     WSMode                  mode_ = WSMode::CLIENT;
     DecodeContext           ctx_;
     
+    size_t                  max_message_size_ = 0;
+    // payload length of the data frames received for current message
+    size_t                  message_size_ = 0;
+    bool                    message_compressed_ = false;
+    
     FrameCallback           frame_cb_;
 };
 
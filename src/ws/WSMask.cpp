@@ -0,0 +1,82 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "WSMask.h"
+
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <immintrin.h>
+# define WS_MASK_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define WS_MASK_NEON
+#endif
+
+WS_NS_BEGIN
+
+size_t maskData(const uint8_t mask_key[WS_MASK_KEY_SIZE], size_t phase, uint8_t *data, size_t len)
+{
+    if (nullptr == data || 0 == len) {
+        return phase;
+    }
+    // rotate the key so that data[i] is masked by key[i%4]
+    uint8_t key[WS_MASK_KEY_SIZE];
+    for (size_t i = 0; i < WS_MASK_KEY_SIZE; ++i) {
+        key[i] = mask_key[(phase + i) % WS_MASK_KEY_SIZE];
+    }
+    uint32_t key32 = 0;
+    memcpy(&key32, key, sizeof(key32));
+    
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i k256 = _mm256_set1_epi32(int(key32));
+    for (; i + 32 <= len; i += 32) {
+        auto *p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k256));
+    }
+#endif
+#if defined(WS_MASK_SSE2)
+    const __m128i k128 = _mm_set1_epi32(int(key32));
+    for (; i + 16 <= len; i += 16) {
+        auto *p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k128));
+    }
+#elif defined(WS_MASK_NEON)
+    const uint8x16_t k128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+    for (; i + 16 <= len; i += 16) {
+        vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i), k128));
+    }
+#endif
+    const uint64_t key64 = (uint64_t(key32) << 32) | key32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t u64;
+        memcpy(&u64, data + i, sizeof(u64));
+        u64 ^= key64;
+        memcpy(data + i, &u64, sizeof(u64));
+    }
+    for (; i < len; ++i) {
+        data[i] ^= key[i % WS_MASK_KEY_SIZE];
+    }
+    return (phase + len) % WS_MASK_KEY_SIZE;
+}
+
+WS_NS_END
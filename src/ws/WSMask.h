@@ -0,0 +1,41 @@
+/* Copyright (c) 2014, Fengping Bao <jamol@live.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __WSMask_H__
+#define __WSMask_H__
+
+#include "wsdefs.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+WS_NS_BEGIN
+
+/*
+ * XOR data with the masking key, the first byte is masked by mask_key[phase].
+ * return the phase of the byte following data, so that a payload split into
+ * several buffers can be masked piece by piece
+ */
+size_t maskData(const uint8_t mask_key[WS_MASK_KEY_SIZE], size_t phase, uint8_t *data, size_t len);
+
+WS_NS_END
+
+#endif
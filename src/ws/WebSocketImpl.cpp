@@ -23,6 +23,9 @@
 #include "libkev/src/util/kmtrace.h"
 #include "libkev/src/util/util.h"
 #include "exts/ExtensionHandler.h"
+#include "exts/PMCE_Deflate.h"
+#include "compr/compr_policy.h"
+#include "compr/compr.h"
 #include "WSConnection_v1.h"
 #include "WSConnection_v2.h"
 
@@ -31,11 +34,42 @@
 using namespace kuma;
 using namespace kuma::ws;
 
+namespace {
+    // the payload not larger than this is copied next to its frame header, so
+    // that small messages of a batch are sent in one piece, e.g. one TLS record
+    const size_t kBatchCopyThreshold = 512;
+    // no more prepared message is accepted once the queued frames exceed this size
+    const size_t kMaxPreparedQueueBytes = 4*1024*1024;
+}
+
 #define WS_FLAG_NO_COMPRESS(flags) (flags & 0x01)
 
+//////////////////////////////////////////////////////////////////////////
+WebSocket::PreparedMessage::Impl::Impl(const KMBuffer &payload, bool is_text)
+: payload_size_(payload.chainLength()), is_text_(is_text)
+{
+    ws::FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.fin = 1;
+    hdr.opcode = uint8_t(is_text ? WSOpcode::TEXT : WSOpcode::BINARY);
+    hdr.length = uint32_t(payload_size_);
+    uint8_t hdr_buf[WS_MAX_HEADER_SIZE];
+    header_size_ = WSHandler::encodeFrameHeader(hdr, hdr_buf);
+    
+    frame_.allocBuffer(header_size_ + payload_size_);
+    frame_.write(hdr_buf, header_size_);
+    for (auto it = payload.begin(); it != payload.end(); ++it) {
+        if (it->length() > 0) {
+            frame_.write(it->readPtr(), it->length());
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////////
 WebSocket::Impl::Impl(const EventLoopPtr &loop, const std::string &http_ver)
+: loop_(loop)
 {
+    loop_token_.eventLoop(loop);
     if (kev::is_equal(http_ver, "HTTP/2.0")) {
         ws_conn_.reset(new WSConnection_V2(loop));
     } else {
@@ -63,7 +97,7 @@ WebSocket::Impl::Impl(const EventLoopPtr &loop, const std::string &http_ver)
 
 WebSocket::Impl::~Impl()
 {
-    
+    loop_token_.reset();
 }
 
 void WebSocket::Impl::cleanup()
@@ -73,9 +107,33 @@ void WebSocket::Impl::cleanup()
     ws_handler_.reset();
     body_bytes_sent_ = 0;
     fragmented_ = false;
+    prepared_queue_.clear();
+    prepared_queue_bytes_ = 0;
+    message_size_ = 0;
+    message_buf_.reset();
+    message_block_ = nullptr;
     extension_handler_.reset();
 }
 
+KMError WebSocket::Impl::setDeflatePolicy(int max_window_bits, bool no_context_takeover)
+{
+    return PMCE_Deflate::setPolicy(max_window_bits, no_context_takeover);
+}
+
+KMError WebSocket::Impl::setDeflateDictionary(const void *dict, size_t len)
+{
+    return PMCE_Deflate::setDictionary(dict, len);
+}
+
+void WebSocket::Impl::setMaxMessageSize(size_t max_size)
+{
+    max_message_size_ = max_size;
+    ws_handler_.setMaxMessageSize(max_size);
+    if (extension_handler_) {
+        extension_handler_->setMaxMessageSize(max_size);
+    }
+}
+
 bool WebSocket::Impl::isServer() const
 {
     return ws_handler_.getMode() == WSMode::SERVER;
@@ -153,7 +211,7 @@ int WebSocket::Impl::send(const void* data, size_t len, bool is_text, bool is_fi
     if(getState() != State::OPEN) {
         return -1;
     }
-    if(!ws_conn_->canSendData()) {
+    if(!ws_conn_->canSendData() || !prepared_queue_.empty()) {
         return 0;
     }
     auto opcode = WSOpcode::BINARY;
@@ -171,6 +229,9 @@ int WebSocket::Impl::send(const void* data, size_t len, bool is_text, bool is_fi
     hdr.fin = is_fin ? 1 : 0;
     hdr.opcode = uint8_t(opcode);
     if (extension_handler_ && !WS_FLAG_NO_COMPRESS(flags)) {
+        if (opcode != WSOpcode::CONTINUE) {
+            extension_handler_->setCompressionLevel(getAdaptiveLevel(loop_.lock()));
+        }
         KMBuffer buf(data, len, len);
         ret = extension_handler_->handleOutgoingFrame(hdr, buf);
     } else {
@@ -184,7 +245,7 @@ int WebSocket::Impl::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32
     if(getState() != State::OPEN) {
         return -1;
     }
-    if(!ws_conn_->canSendData()) {
+    if(!ws_conn_->canSendData() || !prepared_queue_.empty()) {
         return 0;
     }
     auto opcode = WSOpcode::BINARY;
@@ -203,6 +264,9 @@ int WebSocket::Impl::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32
     hdr.opcode = uint8_t(opcode);
     KMError ret = KMError::FAILED;
     if (extension_handler_ && !WS_FLAG_NO_COMPRESS(flags)) {
+        if (opcode != WSOpcode::CONTINUE) {
+            extension_handler_->setCompressionLevel(getAdaptiveLevel(loop_.lock()));
+        }
         ret = extension_handler_->handleOutgoingFrame(hdr, const_cast<KMBuffer&>(buf));
     } else {
         ret = sendWsFrame(hdr, buf);
@@ -210,6 +274,189 @@ int WebSocket::Impl::send(const KMBuffer &buf, bool is_text, bool is_fin, uint32
     return ret == KMError::NOERR ? static_cast<int>(chainSize) : -1;
 }
 
+int WebSocket::Impl::send(const PreparedMessage::Impl &msg)
+{
+    auto loop = loop_.lock();
+    if (loop && !loop->inSameThread()) {
+        // the posted messages are counted until they are queued on loop thread
+        auto size = msg.frame().chainLength();
+        auto pending = prepared_posted_bytes_.fetch_add(size) + prepared_queue_bytes_;
+        if (pending > 0 && pending + size > kMaxPreparedQueueBytes) {
+            prepared_posted_bytes_ -= size;
+            return 0;
+        }
+        auto ret = loop->post([this, msg, size] {
+            prepared_posted_bytes_ -= size;
+            sendPreparedMessage(msg, true);
+        }, &loop_token_);
+        if (ret != kev::Result::OK) {
+            prepared_posted_bytes_ -= size;
+            return -1;
+        }
+        return static_cast<int>(msg.payloadSize());
+    }
+    return sendPreparedMessage(msg);
+}
+
+int WebSocket::Impl::sendBatch(const iovec *msgs, int count, bool is_text, uint32_t flags)
+{
+    if(getState() != State::OPEN || count < 0 || (count > 0 && !msgs)) {
+        return -1;
+    }
+    if (fragmented_) {
+        KM_WARNXTRACE("sendBatch, fragmented message is not completed");
+        return -1;
+    }
+    if(!ws_conn_->canSendData() || !prepared_queue_.empty()) {
+        return 0;
+    }
+    bool compress = extension_handler_ && !WS_FLAG_NO_COMPRESS(flags);
+    if (compress) {
+        extension_handler_->setCompressionLevel(getAdaptiveLevel(loop_.lock()));
+    }
+    ws::FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.fin = 1;
+    hdr.opcode = uint8_t(is_text ? WSOpcode::TEXT : WSOpcode::BINARY);
+    
+    size_t total_len = 0;
+    KMError ret = KMError::NOERR;
+    batching_ = true;
+    for (int i = 0; i < count && ret == KMError::NOERR; ++i) {
+        KMBuffer buf(msgs[i].iov_base, msgs[i].iov_len, msgs[i].iov_len);
+        if (compress) {
+            ret = extension_handler_->handleOutgoingFrame(hdr, buf);
+        } else {
+            ret = appendBatchFrame(hdr, buf);
+        }
+        total_len += msgs[i].iov_len;
+    }
+    batching_ = false;
+    auto batch = std::move(batch_buf_);
+    batch_block_ = nullptr;
+    if (ret != KMError::NOERR) {
+        return -1;
+    }
+    if (batch && ws_conn_->send(*batch) < 0) {
+        return -1;
+    }
+    return static_cast<int>(total_len);
+}
+
+KMError WebSocket::Impl::appendBatchFrame(ws::FrameHeader hdr, const KMBuffer &payload)
+{
+    size_t plen = payload.chainLength();
+    if (ws_handler_.getMode() == WSMode::CLIENT && plen > 0) {
+        hdr.mask = 1;
+        *(uint32_t*)hdr.maskey = generateMaskKey();
+    }
+    hdr.length = uint32_t(plen);
+    bool copy_payload = plen <= kBatchCopyThreshold;
+    auto *block = getBatchBlock(WS_MAX_HEADER_SIZE + (copy_payload ? plen : 0));
+    auto hdr_len = ws_handler_.encodeFrameHeader(hdr, static_cast<uint8_t*>(block->writePtr()));
+    block->bytesWritten(hdr_len);
+    if (copy_payload) {
+        auto *ptr = static_cast<uint8_t*>(block->writePtr());
+        payload.readChained(ptr, plen);
+        if (hdr.mask) {
+            WSHandler::handleDataMask(hdr.maskey, ptr, plen);
+        }
+        block->bytesWritten(plen);
+        return KMError::NOERR;
+    }
+    
+    if (hdr.mask) {
+        WSHandler::handleDataMask(hdr.maskey, const_cast<KMBuffer&>(payload));
+    }
+    // the shared payload, e.g. the output of compressor, is retained by reference,
+    // the other payload is the data of caller, it is valid until the batch is sent
+    for (auto it = payload.begin(); it != payload.end(); ++it) {
+        auto len = it->length();
+        if (len == 0) {
+            continue;
+        }
+        KMBuffer *kmb = nullptr;
+        if (it->isShared()) {
+            kmb = it->subbuffer(0, len);
+        } else {
+            kmb = new KMBuffer(it->readPtr(), len, len, KMBuffer::StorageType::OTHER);
+        }
+        batch_buf_->append(kmb);
+    }
+    // next header is encoded into a new block after this payload
+    batch_block_ = nullptr;
+    return KMError::NOERR;
+}
+
+KMBuffer* WebSocket::Impl::getBatchBlock(size_t size)
+{
+    if (batch_block_ && batch_block_->space() >= size) {
+        return batch_block_;
+    }
+    // size is less than a block, the header and payload are never split
+    KMBuffer::Ptr block;
+    batch_block_ = nullptr;
+    getCompressionBlock(block, batch_block_);
+    if (batch_buf_) {
+        batch_buf_->append(block.release());
+    } else {
+        batch_buf_ = std::move(block);
+    }
+    return batch_block_;
+}
+
+int WebSocket::Impl::sendPreparedMessage(const PreparedMessage::Impl &msg, bool accepted)
+{
+    if(getState() != State::OPEN) {
+        return -1;
+    }
+    if (fragmented_) {
+        KM_WARNXTRACE("sendPreparedMessage, fragmented message is not completed");
+        return -1;
+    }
+    if (!prepared_queue_.empty() || !ws_conn_->canSendData()) {
+        if (!accepted && prepared_queue_bytes_ >= kMaxPreparedQueueBytes) {
+            return 0;
+        }
+        // only the reference of the frame is queued
+        prepared_queue_.emplace_back(msg);
+        prepared_queue_bytes_ += msg.frame().chainLength();
+        return static_cast<int>(msg.payloadSize());
+    }
+    auto ret = sendPreparedFrame(msg);
+    return ret == KMError::NOERR ? static_cast<int>(msg.payloadSize()) : -1;
+}
+
+KMError WebSocket::Impl::sendPreparedFrame(const PreparedMessage::Impl &msg)
+{
+    if (ws_handler_.getMode() == WSMode::CLIENT && msg.payloadSize() > 0) {
+        // client frame is masked with its own key, the payload cannot be shared
+        ws::FrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.fin = 1;
+        hdr.opcode = uint8_t(msg.isText() ? WSOpcode::TEXT : WSOpcode::BINARY);
+        KMBuffer payload(msg.payloadSize());
+        payload.write(msg.payload(), msg.payloadSize());
+        return sendWsFrame(hdr, payload);
+    }
+    auto ret = ws_conn_->send(msg.frame());
+    return ret < 0 ? KMError::SOCK_ERROR : KMError::NOERR;
+}
+
+bool WebSocket::Impl::sendPreparedQueue()
+{
+    while (!prepared_queue_.empty() && ws_conn_->canSendData()) {
+        auto err = sendPreparedFrame(prepared_queue_.front());
+        if (err != KMError::NOERR) {
+            onError(err);
+            return false;
+        }
+        prepared_queue_bytes_ -= prepared_queue_.front().frame().chainLength();
+        prepared_queue_.pop_front();
+    }
+    return prepared_queue_.empty();
+}
+
 KMError WebSocket::Impl::close()
 {
     KM_INFOXTRACE("close");
@@ -224,20 +471,20 @@ KMError WebSocket::Impl::close()
 void WebSocket::Impl::onWsData(KMBuffer &buf)
 {
     if (getState() == State::OPEN) {
-        for (auto it = buf.begin(); it != buf.end(); ++it) {
-            auto *data = static_cast<uint8_t*>(it->readPtr());
-            auto len = it->length();
-            DESTROY_DETECTOR_SETUP();
-            WSError err = ws_handler_.handleData(data, len);
-            DESTROY_DETECTOR_CHECK_VOID();
-            if(getState() == State::IN_ERROR || getState() == State::CLOSED) {
-                return ;
-            }
-            if(err != WSError::NOERR &&
-               err != WSError::NEED_MORE_DATA) {
-                onError(KMError::FAILED);
-                return ;
-            }
+        DESTROY_DETECTOR_SETUP();
+        WSError err = ws_handler_.handleData(buf);
+        DESTROY_DETECTOR_CHECK_VOID();
+        if(getState() == State::IN_ERROR || getState() == State::CLOSED) {
+            return ;
+        }
+        if (err == WSError::MESSAGE_TOO_BIG) {
+            onMessageTooBig();
+            return ;
+        }
+        if(err != WSError::NOERR &&
+           err != WSError::NEED_MORE_DATA) {
+            onError(KMError::FAILED);
+            return ;
         }
     } else {
         KM_WARNXTRACE("onWsData, invalid state: "<<getState());
@@ -246,6 +493,9 @@ void WebSocket::Impl::onWsData(KMBuffer &buf)
 
 void WebSocket::Impl::onWsWrite()
 {
+    if (!sendPreparedQueue()) {
+        return;
+    }
     if (write_cb_) write_cb_(KMError::NOERR);
 }
 
@@ -266,6 +516,10 @@ void WebSocket::Impl::onStateOpen()
 
 KMError WebSocket::Impl::onWsFrame(ws::FrameHeader hdr, KMBuffer &buf)
 {
+    if (getState() != State::OPEN) {
+        // the rest frames of the read after close or error
+        return KMError::INVALID_STATE;
+    }
     if (hdr.rsv1 != 0 || hdr.rsv2 != 0 || hdr.rsv3 != 0) {
         setState(State::IN_ERROR);
         if(error_cb_) error_cb_(KMError::PROTO_ERROR);
@@ -292,13 +546,96 @@ KMError WebSocket::Impl::onWsFrame(ws::FrameHeader hdr, KMBuffer &buf)
             sendPongFrame(buf);
         }
     } else {
-        bool is_text = (uint8_t)WSOpcode::TEXT == hdr.opcode;
-        if(data_cb_) data_cb_(buf, is_text, hdr.fin);
+        return onDataFrame(hdr, buf);
     }
     
     return KMError::NOERR;
 }
 
+KMError WebSocket::Impl::onDataFrame(ws::FrameHeader hdr, KMBuffer &buf)
+{
+    if (getState() != State::OPEN) {
+        // the rest frames of the read after error
+        return KMError::INVALID_STATE;
+    }
+    if (hdr.opcode != uint8_t(WSOpcode::CONTINUE)) {
+        message_is_text_ = (uint8_t)WSOpcode::TEXT == hdr.opcode;
+        message_size_ = 0;
+        message_buf_.reset();
+        message_block_ = nullptr;
+    }
+    message_size_ += buf.chainLength();
+    if (max_message_size_ > 0 && message_size_ > max_message_size_) {
+        onMessageTooBig();
+        return KMError::BUFFER_TOO_LONG;
+    }
+    if (!aggregate_messages_) {
+        if(data_cb_) data_cb_(buf, message_is_text_, hdr.fin);
+        return KMError::NOERR;
+    }
+    
+    appendMessageData(buf);
+    if (hdr.fin) {
+        auto msg = std::move(message_buf_);
+        message_block_ = nullptr;
+        if (msg) {
+            if(data_cb_) data_cb_(*msg, message_is_text_, true);
+        } else {
+            KMBuffer empty_buf(KMBuffer::StorageType::AUTO);
+            if(data_cb_) data_cb_(empty_buf, message_is_text_, true);
+        }
+    }
+    return KMError::NOERR;
+}
+
+void WebSocket::Impl::appendMessageData(const KMBuffer &buf)
+{
+    for (auto it = buf.begin(); it != buf.end(); ++it) {
+        auto len = it->length();
+        if (len == 0) {
+            continue;
+        }
+        if (it->isShared()) {
+            // the blocks of receive buffer or decompressor are retained without copy
+            auto *kmb = it->subbuffer(0, len);
+            if (message_buf_) {
+                message_buf_->append(kmb);
+            } else {
+                message_buf_.reset(kmb);
+            }
+            message_block_ = nullptr;
+            continue;
+        }
+        // the payload reassembled by frame decoder is copied into pooled blocks
+        auto *ptr = static_cast<const uint8_t*>(it->readPtr());
+        while (len > 0) {
+            if (!message_block_ || message_block_->space() == 0) {
+                KMBuffer::Ptr block;
+                getCompressionBlock(block, message_block_);
+                if (message_buf_) {
+                    message_buf_->append(block.release());
+                } else {
+                    message_buf_ = std::move(block);
+                }
+            }
+            auto copy_len = std::min(len, message_block_->space());
+            message_block_->write(ptr, copy_len);
+            ptr += copy_len;
+            len -= copy_len;
+        }
+    }
+}
+
+void WebSocket::Impl::onMessageTooBig()
+{
+    KM_WARNXTRACE("onMessageTooBig, size="<<message_size_<<", max_size="<<max_message_size_);
+    message_buf_.reset();
+    message_block_ = nullptr;
+    sendCloseFrame(ws::kWSCloseMessageTooBig);
+    setState(State::IN_ERROR);
+    if(error_cb_) error_cb_(KMError::BUFFER_TOO_LONG);
+}
+
 bool WebSocket::Impl::onWsHandshake(KMError err)
 {
     if(handshake_cb_ && KMError::NOERR == err) {
@@ -347,6 +684,7 @@ KMError WebSocket::Impl::negotiateExtensions()
         }
         if (ext_handler->hasExtension()) {
             extension_handler_ = std::move(ext_handler);
+            extension_handler_->setMaxMessageSize(max_message_size_);
             extension_handler_->setIncomingCallback([this] (ws::FrameHeader hdr, KMBuffer &buf) {
                 return onExtensionIncomingFrame(hdr, buf);
             });
@@ -357,9 +695,16 @@ KMError WebSocket::Impl::negotiateExtensions()
             ws_handler_.setFrameCallback([this] (ws::FrameHeader hdr, KMBuffer &buf) {
                 if (WSHandler::isControlFrame(hdr.opcode)) {
                     return onWsFrame(hdr, buf);
-                } else {
-                    return extension_handler_->handleIncomingFrame(hdr, buf);
                 }
+                if (getState() != State::OPEN) {
+                    return KMError::INVALID_STATE;
+                }
+                auto err = extension_handler_->handleIncomingFrame(hdr, buf);
+                if (err == KMError::BUFFER_TOO_LONG && getState() == State::OPEN) {
+                    // the decompressed message exceeds the limit
+                    onMessageTooBig();
+                }
+                return err;
             });
         }
     }
@@ -374,6 +719,9 @@ KMError WebSocket::Impl::onExtensionIncomingFrame(ws::FrameHeader hdr, KMBuffer
 
 KMError WebSocket::Impl::onExtensionOutgoingFrame(ws::FrameHeader hdr, KMBuffer &buf)
 {
+    if (batching_) {
+        return appendBatchFrame(hdr, buf);
+    }
     return sendWsFrame(hdr, buf);
 }
 
@@ -415,22 +763,12 @@ KMError WebSocket::Impl::sendWsFrame(ws::FrameHeader hdr, const KMBuffer &buf)
     hdr.length = uint32_t(plen);
     hdr_len = ws_handler_.encodeFrameHeader(hdr, hdr_buf);
     
-    iovec iovs[129];
-    int count = 0;
-    iovs[count].iov_base = (char*)hdr_buf;
-    iovs[count++].iov_len = hdr_len;
-    for (auto it = buf.begin(); it != buf.end(); ++it) {
-        if (it->length() > 0) {
-            if (count < 129) {
-                iovs[count].iov_base = static_cast<char*>(it->readPtr());
-                iovs[count++].iov_len = static_cast<decltype(iovs[0].iov_len)>(it->length());
-            } else {
-                return KMError::BUFFER_TOO_LONG;
-            }
-        }
-    }
-    
-    auto ret = ws_conn_->send(iovs, count);
+    // link the header in front of the payload chain, so the payload
+    // of any number of blocks is sent without copy
+    KMBuffer hdr_kmb(hdr_buf, hdr_len, hdr_len);
+    hdr_kmb.append(const_cast<KMBuffer*>(&buf));
+    auto ret = ws_conn_->send(hdr_kmb);
+    hdr_kmb.unlink();
     return ret < 0 ? KMError::SOCK_ERROR : KMError::NOERR;
 }
 
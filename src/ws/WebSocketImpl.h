@@ -31,6 +31,8 @@
 #include "libkev/src/util/DestroyDetector.h"
 
 #include <random>
+#include <deque>
+#include <atomic>
 
 WS_NS_BEGIN
 
@@ -41,6 +43,30 @@ WS_NS_END
 
 KUMA_NS_BEGIN
 
+class WebSocket::PreparedMessage::Impl
+{
+public:
+    Impl(const KMBuffer &payload, bool is_text);
+    Impl(const Impl &other) = default;
+    
+    /**
+     * the unmasked frame of header and payload, it is shared by all copies
+     */
+    const KMBuffer& frame() const { return frame_; }
+    const uint8_t* payload() const
+    {
+        return static_cast<const uint8_t*>(frame_.readPtr()) + header_size_;
+    }
+    size_t payloadSize() const { return payload_size_; }
+    bool isText() const { return is_text_; }
+    
+private:
+    KMBuffer                frame_;
+    size_t                  header_size_ = 0;
+    size_t                  payload_size_ = 0;
+    bool                    is_text_ = false;
+};
+
 class WebSocket::Impl : public kev::KMObject, public kev::DestroyDetector
 {
 public:
@@ -74,6 +100,8 @@ public:
     KMError attachStream(uint32_t stream_id, H2Connection::Impl* conn, HandshakeCallback cb);
     int send(const void* data, size_t len, bool is_text, bool is_fin, uint32_t flags);
     int send(const KMBuffer &buf, bool is_text, bool is_fin, uint32_t flags);
+    int send(const PreparedMessage::Impl &msg);
+    int sendBatch(const iovec *msgs, int count, bool is_text, uint32_t flags);
     KMError close();
     
     const std::string& getPath() const
@@ -99,6 +127,12 @@ public:
     void setWriteCallback(EventCallback cb) { write_cb_ = std::move(cb); }
     void setErrorCallback(EventCallback cb) { error_cb_ = std::move(cb); }
     
+    void setMessageAggregation(bool enable) { aggregate_messages_ = enable; }
+    void setMaxMessageSize(size_t max_size);
+    
+    static KMError setDeflatePolicy(int max_window_bits, bool no_context_takeover);
+    static KMError setDeflateDictionary(const void *dict, size_t len);
+    
 private:
     enum State {
         IDLE,
@@ -114,6 +148,9 @@ private:
     
     KMError negotiateExtensions();
     KMError onWsFrame(ws::FrameHeader hdr, KMBuffer &buf);
+    KMError onDataFrame(ws::FrameHeader hdr, KMBuffer &buf);
+    void appendMessageData(const KMBuffer &buf);
+    void onMessageTooBig();
     bool onWsHandshake(KMError err);
     void onWsOpen(KMError err);
     void onWsData(KMBuffer &buf);
@@ -125,6 +162,15 @@ private:
     KMError sendCloseFrame(uint16_t statusCode);
     KMError sendPingFrame(const KMBuffer &buf);
     KMError sendPongFrame(const KMBuffer &buf);
+    /*
+     * accepted is true if the message is accepted already on other thread, it is
+     * queued even if the queue is full
+     */
+    int sendPreparedMessage(const PreparedMessage::Impl &msg, bool accepted = false);
+    KMError sendPreparedFrame(const PreparedMessage::Impl &msg);
+    bool sendPreparedQueue();
+    KMError appendBatchFrame(ws::FrameHeader hdr, const KMBuffer &payload);
+    KMBuffer* getBatchBlock(size_t size);
     
     void onError(KMError err);
     
@@ -139,6 +185,24 @@ private:
     bool                    fragmented_ = false;
     
     size_t                  body_bytes_sent_ = 0;
+    // prepared messages waiting for the connection to be writable
+    std::deque<PreparedMessage::Impl> prepared_queue_;
+    std::atomic<size_t>     prepared_queue_bytes_{0};
+    // prepared messages posted from other threads and not queued yet
+    std::atomic<size_t>     prepared_posted_bytes_{0};
+    
+    // the message being received
+    bool                    aggregate_messages_ = false;
+    size_t                  max_message_size_ = 0;
+    size_t                  message_size_ = 0;
+    bool                    message_is_text_ = false;
+    KMBuffer::Ptr           message_buf_;
+    KMBuffer*               message_block_ = nullptr; // pooled block of message_buf_ to copy into
+    
+    // the frames of sendBatch, they are sent by one vectored send
+    bool                    batching_ = false;
+    KMBuffer::Ptr           batch_buf_;
+    KMBuffer*               batch_block_ = nullptr;
     
     HandshakeCallback       handshake_cb_;
     EventCallback           open_cb_;
@@ -150,6 +214,9 @@ private:
     
     std::unique_ptr<ws::WSConnection>       ws_conn_;
     std::unique_ptr<ws::ExtensionHandler>   extension_handler_;
+    
+    EventLoopWeakPtr        loop_;
+    EventLoopToken          loop_token_;
 };
 
 KUMA_NS_END
@@ -45,6 +45,20 @@ KMError ExtensionHandler::handleOutgoingFrame(FrameHeader hdr, KMBuffer &payload
     }
 }
 
+void ExtensionHandler::setCompressionLevel(CompressionLevel level)
+{
+    for (auto &ext : ws_extensions_) {
+        ext->setCompressionLevel(level);
+    }
+}
+
+void ExtensionHandler::setMaxMessageSize(size_t max_size)
+{
+    for (auto &ext : ws_extensions_) {
+        ext->setMaxMessageSize(max_size);
+    }
+}
+
 KMError ExtensionHandler::negotiateExtensions(const std::string &extensions, bool is_answer)
 {
     bool pmce_done = false;
@@ -103,5 +117,5 @@ KMError ExtensionHandler::negotiateExtensions(const std::string &extensions, boo
 
 std::string ExtensionHandler::getExtensionOffer()
 {
-    return "permessage-deflate; client_max_window_bits";
+    return PMCE_Deflate::buildOffer();
 }
@@ -40,6 +40,8 @@ public:
     
     virtual KMError handleIncomingFrame(FrameHeader hdr, KMBuffer &payload);
     virtual KMError handleOutgoingFrame(FrameHeader hdr, KMBuffer &payload);
+    void setCompressionLevel(CompressionLevel level);
+    void setMaxMessageSize(size_t max_size);
     
     void setIncomingCallback(FrameCallback cb) { incoming_cb_ = std::move(cb); }
     void setOutgoingCallback(FrameCallback cb) { outgoing_cb_ = std::move(cb); }
@@ -21,11 +21,42 @@
 
 #include "PMCE_Deflate.h"
 #include "compr/compr_zlib.h"
+#include "compr/compr_policy.h"
 #include "libkev/src/util/util.h"
 
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+
 using namespace kuma;
 using namespace kuma::ws;
 
+namespace {
+    // zlib rejects 8 bits window for raw deflate
+    const int kMinWindowBits = 9;
+    const int kMaxWindowBits = 15;
+    // deflate expands 1 byte up to 1032 bytes, the input is inflated by slices
+    // to bound the overrun of the message size limit
+    const size_t kInflateSliceSize = 1024;
+    
+    std::atomic<int> g_max_window_bits{kMaxWindowBits};
+    std::atomic<bool> g_no_context_takeover{false};
+    
+    // extension parameter of the preset dictionary, not defined by RFC 7692
+    const std::string kDictionaryId = "x_dictionary_id";
+    
+    std::mutex g_dictionary_mutex;
+    CompressionDictionary g_dictionary;
+    std::string g_dictionary_id;
+    
+    void getDictionary(CompressionDictionary &dict, std::string &dict_id)
+    {
+        std::lock_guard<std::mutex> g(g_dictionary_mutex);
+        dict = g_dictionary;
+        dict_id = g_dictionary_id;
+    }
+}
+
 
 PMCE_Deflate::PMCE_Deflate()
 {
@@ -37,6 +68,53 @@ PMCE_Deflate::~PMCE_Deflate()
     
 }
 
+KMError PMCE_Deflate::setPolicy(int max_window_bits, bool no_context_takeover)
+{
+    if (max_window_bits < kMinWindowBits || max_window_bits > kMaxWindowBits) {
+        return KMError::INVALID_PARAM;
+    }
+    g_max_window_bits = max_window_bits;
+    g_no_context_takeover = no_context_takeover;
+    return KMError::NOERR;
+}
+
+KMError PMCE_Deflate::setDictionary(const void *dict, size_t len)
+{
+    CompressionDictionary dictionary;
+    std::string dictionary_id;
+    if (dict && len > 0) {
+        dictionary = std::make_shared<const std::string>(static_cast<const char*>(dict), len);
+        auto adler = adler32(0L, Z_NULL, 0);
+        adler = adler32(adler, static_cast<const Bytef*>(dict), static_cast<uInt>(len));
+        dictionary_id = std::to_string(adler);
+    }
+    std::lock_guard<std::mutex> g(g_dictionary_mutex);
+    g_dictionary = std::move(dictionary);
+    g_dictionary_id = std::move(dictionary_id);
+    return KMError::NOERR;
+}
+
+std::string PMCE_Deflate::buildOffer()
+{
+    std::string offer = kPerMessageDeflate + "; client_max_window_bits";
+    int max_window_bits = g_max_window_bits;
+    if (max_window_bits < kMaxWindowBits) {
+        auto bits = std::to_string(max_window_bits);
+        offer += "=" + bits + "; server_max_window_bits=" + bits;
+    }
+    if (g_no_context_takeover) {
+        offer += "; client_no_context_takeover; server_no_context_takeover";
+    }
+    CompressionDictionary dict;
+    std::string dict_id;
+    getDictionary(dict, dict_id);
+    if (dict) {
+        // the server without the dictionary accepts the second offer
+        offer = offer + "; " + kDictionaryId + "=" + dict_id + ", " + offer;
+    }
+    return offer;
+}
+
 KMError PMCE_Deflate::init()
 {
     if (!negotiated_) {
@@ -53,6 +131,16 @@ KMError PMCE_Deflate::init()
         } else {
             compr->setFlushFlag(Z_FULL_FLUSH);
         }
+        if (dictionary_) {
+            ret = compr->setDictionary(dictionary_);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+        if (c_no_context_takeover) {
+            // the stream is acquired by the first compressed message
+            compr->releaseContext();
+        }
         compressor_ = std::move(compr);
     }
     {
@@ -62,6 +150,15 @@ KMError PMCE_Deflate::init()
             return ret;
         }
         decompr->setFlushFlag(Z_SYNC_FLUSH);
+        if (dictionary_) {
+            ret = decompr->setDictionary(dictionary_);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+        }
+        if (d_no_context_takeover) {
+            decompr->releaseContext();
+        }
         decompressor_ = std::move(decompr);
     }
     return KMError::NOERR;
@@ -69,9 +166,17 @@ KMError PMCE_Deflate::init()
 
 KMError PMCE_Deflate::handleIncomingFrame(FrameHeader hdr, KMBuffer &payload)
 {
-    if (hdr.rsv1 && hdr.opcode < 8) {
-        d_payload.clear();
-        auto ret = decompressor_->decompress(payload, d_payload);
+    if (hdr.opcode >= uint8_t(WSOpcode::CLOSE)) {
+        return onIncomingFrame(hdr, payload);
+    }
+    if (hdr.opcode != uint8_t(WSOpcode::CONTINUE)) {
+        // RSV1 of the first frame applies to the whole message
+        d_compress_message = hdr.rsv1 != 0;
+        d_message_size = 0;
+    }
+    if (d_compress_message) {
+        KMBuffer::Ptr d_payload;
+        auto ret = decompressFrame(payload, d_payload);
         if (ret != KMError::NOERR) {
             return ret;
         }
@@ -81,26 +186,83 @@ KMError PMCE_Deflate::handleIncomingFrame(FrameHeader hdr, KMBuffer &payload)
             if (ret != KMError::NOERR) {
                 return ret;
             }
+            if (d_no_context_takeover) {
+                decompressor_->releaseContext();
+            }
         }
         hdr.rsv1 = 0;
         
-        KMBuffer i_payload(&d_payload[0], d_payload.size(), d_payload.size());
+        if (d_payload) {
+            return onIncomingFrame(hdr, *d_payload);
+        }
+        KMBuffer i_payload(KMBuffer::StorageType::AUTO);
         return onIncomingFrame(hdr, i_payload);
     } else {
         return onIncomingFrame(hdr, payload);
     }
 }
 
+KMError PMCE_Deflate::decompressFrame(const KMBuffer &payload, KMBuffer::Ptr &d_payload)
+{
+    if (d_max_message_size == 0) {
+        return decompressor_->decompress(payload, d_payload);
+    }
+    size_t d_len = 0;
+    for (auto it = payload.begin(); it != payload.end(); ++it) {
+        auto *ptr = static_cast<const uint8_t*>(it->readPtr());
+        auto len = it->length();
+        while (len > 0) {
+            auto slice_len = std::min(len, kInflateSliceSize);
+            auto ret = decompressor_->decompress(ptr, slice_len, d_payload);
+            if (ret != KMError::NOERR) {
+                return ret;
+            }
+            ptr += slice_len;
+            len -= slice_len;
+            d_len = d_payload ? d_payload->chainLength() : 0;
+            if (d_message_size + d_len > d_max_message_size) {
+                return KMError::BUFFER_TOO_LONG;
+            }
+        }
+    }
+    d_message_size += d_len;
+    return KMError::NOERR;
+}
+
 KMError PMCE_Deflate::handleOutgoingFrame(FrameHeader hdr, KMBuffer &payload)
 {
-    c_payload.clear();
+    if (hdr.opcode >= uint8_t(WSOpcode::CLOSE)) {
+        return onOutgoingFrame(hdr, payload);
+    }
+    bool first_frame = hdr.opcode != uint8_t(WSOpcode::CONTINUE);
+    if (first_frame) {
+        // skip the message that is incompressible or sent while the loop is busy
+        c_compress_message = c_level != CompressionLevel::NONE && isCompressible(payload);
+        if (c_compress_message) {
+            compressor_->setLevel(c_level);
+        }
+    }
+    if (!c_compress_message) {
+        return onOutgoingFrame(hdr, payload);
+    }
+    
+    KMBuffer::Ptr c_payload;
     auto ret = compressor_->compress(payload, c_payload);
-    if (ret == KMError::NOERR && c_payload.size() >= 4) {
+    if (hdr.fin && c_no_context_takeover) {
+        compressor_->releaseContext();
+    }
+    auto c_len = c_payload ? c_payload->chainLength() : 0;
+    if (ret == KMError::NOERR && c_len >= 4) {
         if (hdr.fin) {
-            c_payload.resize(c_payload.size()-4);
+            // strip the 0x00 0x00 0xff 0xff tail of sync flush, the blocks are shared
+            c_payload.reset(c_payload->subbuffer(0, c_len - 4));
+        }
+        // RSV1 is set on the first frame of a compressed message only
+        hdr.rsv1 = first_frame ? 1 : 0;
+        if (c_payload) {
+            return onOutgoingFrame(hdr, *c_payload);
         }
-        hdr.rsv1 = 1;
-        KMBuffer o_payload(&c_payload[0], c_payload.size(), c_payload.size());
+        KMBuffer o_payload(KMBuffer::StorageType::AUTO);
         return onOutgoingFrame(hdr, o_payload);
     } else { // else send as uncompressed
         return onOutgoingFrame(hdr, payload);
@@ -109,8 +271,7 @@ KMError PMCE_Deflate::handleOutgoingFrame(FrameHeader hdr, KMBuffer &payload)
 
 KMError PMCE_Deflate::getOffer(std::string &offer)
 {
-    c_max_window_bits = 15;
-    offer = getExtensionName() + "; client_max_window_bits";
+    offer = buildOffer();
     return KMError::NOERR;
 }
 
@@ -124,6 +285,10 @@ KMError PMCE_Deflate::negotiateAnswer(const std::string &answer)
     if (param_list[0].first != getExtensionName()) {
         return KMError::INVALID_PARAM;
     }
+    // the offer limits our compressor to the local policy
+    c_max_window_bits = g_max_window_bits;
+    c_no_context_takeover = g_no_context_takeover;
+    d_max_window_bits = kMaxWindowBits;
     auto it = param_list.begin() + 1;
     for (; it != param_list.end(); ++it) {
         if (it->first == "client_max_window_bits") {
@@ -132,7 +297,7 @@ KMError PMCE_Deflate::negotiateAnswer(const std::string &answer)
                 if (client_max_window_bits < 8 || client_max_window_bits > 15) {
                     return KMError::INVALID_PARAM;
                 }
-                c_max_window_bits = client_max_window_bits;
+                c_max_window_bits = std::min(c_max_window_bits, client_max_window_bits);
             }
         } else if (it->first == "server_max_window_bits") {
             if (it->second.empty()) {
@@ -144,9 +309,15 @@ KMError PMCE_Deflate::negotiateAnswer(const std::string &answer)
             }
             d_max_window_bits = server_max_window_bits;
         } else if (it->first == "server_no_context_takeover") {
-            
+            d_no_context_takeover = true;
         } else if (it->first == "client_no_context_takeover") {
             c_no_context_takeover = true;
+        } else if (it->first == kDictionaryId) {
+            std::string dict_id;
+            getDictionary(dictionary_, dict_id);
+            if (!dictionary_ || it->second != dict_id) {
+                return KMError::INVALID_PARAM;
+            }
         } else {
             return KMError::INVALID_PARAM;
         }
@@ -165,16 +336,23 @@ KMError PMCE_Deflate::negotiateOffer(const std::string &offer, std::string &answ
     if (param_list[0].first != getExtensionName()) {
         return KMError::INVALID_PARAM;
     }
-    answer = getExtensionName();
+    int max_window_bits = g_max_window_bits;
+    c_max_window_bits = max_window_bits;
+    c_no_context_takeover = g_no_context_takeover;
+    d_max_window_bits = kMaxWindowBits;
+    bool client_window_offered = false;
+    int client_max_window_bits = kMaxWindowBits;
+    bool server_window_offered = false;
+    std::string dictionary_id;
     auto it = param_list.begin() + 1;
     for (; it != param_list.end(); ++it) {
         if (it->first == "client_max_window_bits") {
+            client_window_offered = true;
             if (!it->second.empty()) {
-                auto client_max_window_bits = std::stoi(it->second);
+                client_max_window_bits = std::stoi(it->second);
                 if (client_max_window_bits < 8 || client_max_window_bits > 15) {
                     return KMError::INVALID_PARAM;
                 }
-                d_max_window_bits = client_max_window_bits;
             }
         } else if (it->first == "server_max_window_bits") {
             if (it->second.empty()) {
@@ -184,17 +362,42 @@ KMError PMCE_Deflate::negotiateOffer(const std::string &offer, std::string &answ
             if (server_max_window_bits < 8 || server_max_window_bits > 15) {
                 return KMError::INVALID_PARAM;
             }
-            c_max_window_bits = server_max_window_bits;
-            answer += "; server_max_window_bits=" + it->second;
+            server_window_offered = true;
+            c_max_window_bits = std::min(c_max_window_bits, server_max_window_bits);
         } else if (it->first == "server_no_context_takeover") {
             c_no_context_takeover = true;
-            answer += "; server_no_context_takeover";
         } else if (it->first == "client_no_context_takeover") {
-            // do nothing
+            d_no_context_takeover = true;
+        } else if (it->first == kDictionaryId) {
+            // decline this offer if the dictionary is not the same
+            getDictionary(dictionary_, dictionary_id);
+            if (!dictionary_ || it->second != dictionary_id) {
+                return KMError::INVALID_PARAM;
+            }
         } else {
             return KMError::INVALID_PARAM;
         }
     }
+    answer = getExtensionName();
+    if (server_window_offered || c_max_window_bits < kMaxWindowBits) {
+        answer += "; server_max_window_bits=" + std::to_string(c_max_window_bits);
+    }
+    if (client_window_offered) {
+        // the client can only be limited if it supports client_max_window_bits
+        d_max_window_bits = std::min(client_max_window_bits, max_window_bits);
+        if (d_max_window_bits < kMaxWindowBits) {
+            answer += "; client_max_window_bits=" + std::to_string(d_max_window_bits);
+        }
+    }
+    if (c_no_context_takeover) {
+        answer += "; server_no_context_takeover";
+    }
+    if (d_no_context_takeover) {
+        answer += "; client_no_context_takeover";
+    }
+    if (dictionary_) {
+        answer += "; " + kDictionaryId + "=" + dictionary_id;
+    }
     negotiated_ = true;
     return KMError::NOERR;
 }
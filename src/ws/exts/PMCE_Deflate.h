@@ -31,28 +31,50 @@ const std::string kPerMessageDeflate = "permessage-deflate";
 class PMCE_Deflate : public PMCE_Base
 {
 public:
-    using DataBuffer = std::vector<uint8_t>;
     PMCE_Deflate();
     ~PMCE_Deflate();
     
+    /**
+     * local policy applied to the negotiation of new connections, smaller window
+     * and no context takeover reduce the memory held by each connection
+     */
+    static KMError setPolicy(int max_window_bits, bool no_context_takeover);
+    /**
+     * preset dictionary of both directions, it is used only if the peer has
+     * the same one, which is checked by its adler32 in the x_dictionary_id
+     * parameter. the offer falls back to no dictionary for other peers
+     */
+    static KMError setDictionary(const void *dict, size_t len);
+    static std::string buildOffer();
+    
     KMError init();
     KMError handleIncomingFrame(FrameHeader hdr, KMBuffer &payload) override;
     KMError handleOutgoingFrame(FrameHeader hdr, KMBuffer &payload) override;
     KMError getOffer(std::string &offer) override;
     KMError negotiateAnswer(const std::string &answer) override;
     KMError negotiateOffer(const std::string &offer, std::string &answer) override;
+    void setCompressionLevel(CompressionLevel level) override { c_level = level; }
+    void setMaxMessageSize(size_t max_size) override { d_max_message_size = max_size; }
     
     std::string getExtensionName() const override { return kPerMessageDeflate; }
     
+protected:
+    KMError decompressFrame(const KMBuffer &payload, KMBuffer::Ptr &d_payload);
+    
 protected:
     bool        negotiated_ = false;
+    CompressionDictionary dictionary_;
     
     int         c_max_window_bits = 15;
     bool        c_no_context_takeover = false;
-    DataBuffer  c_payload;
+    CompressionLevel c_level = CompressionLevel::DEFAULT;
+    bool        c_compress_message = true; // the choice made on the first frame of a message
     
     int         d_max_window_bits = 15;
-    DataBuffer  d_payload;
+    bool        d_no_context_takeover = false;
+    bool        d_compress_message = false;
+    size_t      d_max_message_size = 0;
+    size_t      d_message_size = 0;
     
     std::unique_ptr<kuma::Compressor> compressor_;
     std::unique_ptr<kuma::Decompressor> decompressor_;
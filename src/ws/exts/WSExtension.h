@@ -25,6 +25,7 @@
 #include "kmbuffer.h"
 #include "ws/wsdefs.h"
 #include "http/httpdefs.h"
+#include "compr/compr.h"
 
 #include <functional>
 #include <string>
@@ -44,6 +45,15 @@ public:
     virtual KMError getOffer(std::string &offer) = 0;
     virtual KMError negotiateAnswer(const std::string &answer) = 0;
     virtual KMError negotiateOffer(const std::string &offer, std::string &answer) = 0;
+    /**
+     * compression level of the outgoing messages, applied from the next message
+     */
+    virtual void setCompressionLevel(CompressionLevel level) {}
+    /**
+     * the extension that expands incoming messages stops with BUFFER_TOO_LONG
+     * once the message exceeds max_size, 0 means no limit
+     */
+    virtual void setMaxMessageSize(size_t max_size) {}
     
     void setIncomingCallback(FrameCallback cb) { incoming_cb_ = std::move(cb); }
     void setOutgoingCallback(FrameCallback cb) { outgoing_cb_ = std::move(cb); }
@@ -44,6 +44,9 @@ const std::string kSecWebSocketExtensions { "Sec-WebSocket-Extensions" };
 
 const std::string kWebSocketVersion { "13" };
 
+// status code of close frame, the message is too big to process
+const uint16_t kWSCloseMessageTooBig = 1009;
+
 enum class WSOpcode : uint8_t {
     CONTINUE  = 0,
     TEXT      = 1,
@@ -62,6 +65,7 @@ enum class WSError : int {
     INVALID_FRAME,
     INVALID_LENGTH,
     PROTOCOL_ERROR,
+    MESSAGE_TOO_BIG,
     CLOSED,
     DESTROYED
 };
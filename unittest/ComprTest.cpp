@@ -0,0 +1,271 @@
+
+#include <gtest/gtest.h>
+#include "compr/compr.h"
+#include "compr/compr_policy.h"
+#include "compr/compr_zlib.h"
+
+#ifdef KUMA_HAS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef KUMA_HAS_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <string>
+
+using namespace kuma;
+
+namespace {
+    std::string toString(const KMBuffer::Ptr &buf)
+    {
+        std::string str;
+        if (buf) {
+            str.resize(buf->chainLength());
+            buf->readChained(&str[0], str.size());
+        }
+        return str;
+    }
+    
+    std::string makeJson(int count)
+    {
+        std::string data;
+        for (int i = 0; i < count; ++i) {
+            data += "{\"id\":" + std::to_string(i % 997) + ",\"name\":\"kuma\"},";
+        }
+        return data;
+    }
+    
+    std::string decompress(const std::string &encoding, const std::string &cdata)
+    {
+        auto decompr = createDecompressor(encoding);
+        EXPECT_TRUE(decompr != nullptr);
+        if (!decompr) {
+            return "";
+        }
+        KMBuffer::Ptr dbuf;
+        // feed the decompressor with small pieces
+        for (size_t pos = 0; pos < cdata.size(); pos += 777) {
+            auto len = std::min<size_t>(777, cdata.size() - pos);
+            EXPECT_EQ(KMError::NOERR, decompr->decompress(cdata.data() + pos, len, dbuf));
+        }
+        return toString(dbuf);
+    }
+    
+    void roundTrip(const std::string &encoding, const std::string &data,
+                   CompressionLevel level = CompressionLevel::DEFAULT)
+    {
+        auto compr = createCompressor(encoding, level);
+        ASSERT_TRUE(compr != nullptr);
+        KMBuffer::Ptr cbuf;
+        for (size_t pos = 0; pos < data.size(); pos += 10000) {
+            auto len = std::min<size_t>(10000, data.size() - pos);
+            EXPECT_EQ(KMError::NOERR, compr->compress(data.data() + pos, len, cbuf));
+        }
+        EXPECT_EQ(KMError::NOERR, compr->compress(nullptr, 0, cbuf));
+        auto cdata = toString(cbuf);
+        if (level != CompressionLevel::NONE) {
+            EXPECT_LT(cdata.size(), data.size());
+        }
+        EXPECT_EQ(data, decompress(encoding, cdata));
+    }
+}
+
+TEST(ComprTest, NegotiateEncoding)
+{
+    EXPECT_EQ("gzip", negotiateEncoding("gzip"));
+    EXPECT_EQ("deflate", negotiateEncoding("deflate;q=0.9, gzip;q=0.8"));
+    EXPECT_EQ("gzip", negotiateEncoding("GZIP , deflate"));
+    EXPECT_EQ("", negotiateEncoding("identity"));
+    EXPECT_EQ("", negotiateEncoding("gzip;q=0, deflate;q=0"));
+    EXPECT_EQ("", negotiateEncoding("*;q=0"));
+    auto best = negotiateEncoding("gzip;q=0, *");
+    EXPECT_FALSE(best.empty());
+    EXPECT_NE("gzip", best);
+#if defined(KUMA_HAS_ZSTD)
+    EXPECT_EQ("zstd", negotiateEncoding("gzip, deflate, br, zstd"));
+    EXPECT_EQ("gzip", negotiateEncoding("gzip, zstd;q=0.5"));
+#elif defined(KUMA_HAS_BROTLI)
+    EXPECT_EQ("br", negotiateEncoding("gzip, deflate, br, zstd"));
+#else
+    EXPECT_EQ("gzip", negotiateEncoding("gzip, deflate, br, zstd"));
+#endif
+    // TE only accepts transfer codings
+    EXPECT_EQ("gzip", negotiateEncoding("zstd, br, gzip;q=0.5", getSupportedTransferCodings()));
+    EXPECT_EQ("", negotiateEncoding("zstd, br, trailers", getSupportedTransferCodings()));
+}
+
+TEST(ComprTest, RoundTrip)
+{
+    auto data = makeJson(20000);
+    roundTrip("gzip", data);
+    roundTrip("deflate", data);
+#ifdef KUMA_HAS_ZSTD
+    roundTrip("zstd", data);
+#endif
+#ifdef KUMA_HAS_BROTLI
+    roundTrip("br", data);
+#endif
+    EXPECT_TRUE(createCompressor("compress") == nullptr);
+    EXPECT_FALSE(isEncodingSupported("identity"));
+}
+
+TEST(ComprTest, Flush)
+{
+    // a streamed response, every event is decodable once it is flushed
+    for (auto &encoding : getSupportedEncodings()) {
+        auto compr = createCompressor(encoding);
+        ASSERT_TRUE(compr != nullptr);
+        auto decompr = createDecompressor(encoding);
+        ASSERT_TRUE(decompr != nullptr);
+        for (int i = 0; i < 3; ++i) {
+            auto event = "data: {\"id\":" + std::to_string(i) + ",\"name\":\"kuma\"}\n\n";
+            KMBuffer::Ptr cbuf;
+            EXPECT_EQ(KMError::NOERR, compr->compress(event.data(), event.size(), cbuf));
+            EXPECT_EQ(KMError::NOERR, compr->flush(cbuf));
+            ASSERT_TRUE(cbuf != nullptr);
+            KMBuffer::Ptr dbuf;
+            EXPECT_EQ(KMError::NOERR, decompr->decompress(*cbuf, dbuf));
+            EXPECT_EQ(event, toString(dbuf)) << encoding;
+        }
+    }
+}
+
+#ifdef KUMA_HAS_ZSTD
+TEST(ComprTest, ZStd)
+{
+    auto data = makeJson(50000);
+    for (auto level : {CompressionLevel::NONE, CompressionLevel::FAST,
+        CompressionLevel::DEFAULT, CompressionLevel::BEST}) {
+        roundTrip("zstd", data, level);
+    }
+    
+    // the frame of the library one-shot API is decoded by the streaming decompressor
+    std::string cdata(ZSTD_compressBound(data.size()), '\0');
+    auto clen = ZSTD_compress(&cdata[0], cdata.size(), data.data(), data.size(), 3);
+    ASSERT_FALSE(ZSTD_isError(clen));
+    cdata.resize(clen);
+    EXPECT_EQ(data, decompress("zstd", cdata));
+    
+    EXPECT_EQ("", decompress("zstd", ""));
+    
+    // the frame requires a window larger than 8 MB is rejected
+    auto cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, 25);
+    cdata.assign(ZSTD_compressBound(data.size()), '\0');
+    ZSTD_outBuffer output = { &cdata[0], cdata.size(), 0 };
+    ZSTD_inBuffer input = { data.data(), data.size(), 0 };
+    // content size is unknown to the frame since it is streamed
+    ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_continue);
+    ASSERT_EQ(0u, ZSTD_compressStream2(cctx, &output, &input, ZSTD_e_end));
+    ZSTD_freeCCtx(cctx);
+    cdata.resize(output.pos);
+    auto decompr = createDecompressor("zstd");
+    KMBuffer::Ptr dbuf;
+    EXPECT_NE(KMError::NOERR, decompr->decompress(cdata.data(), cdata.size(), dbuf));
+}
+#endif
+
+#ifdef KUMA_HAS_BROTLI
+TEST(ComprTest, Brotli)
+{
+    auto data = makeJson(50000);
+    for (auto level : {CompressionLevel::NONE, CompressionLevel::FAST,
+        CompressionLevel::DEFAULT, CompressionLevel::BEST}) {
+        roundTrip("br", data, level);
+    }
+    
+    // the stream of the library one-shot API is decoded by the streaming decompressor
+    std::string cdata(BrotliEncoderMaxCompressedSize(data.size()), '\0');
+    size_t clen = cdata.size();
+    ASSERT_EQ(BROTLI_TRUE, BrotliEncoderCompress(BROTLI_DEFAULT_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+        data.size(), (const uint8_t*)data.data(), &clen, (uint8_t*)&cdata[0]));
+    cdata.resize(clen);
+    EXPECT_EQ(data, decompress("br", cdata));
+}
+#endif
+
+TEST(ComprTest, Compressible)
+{
+    std::string text;
+    for (int i = 0; i < 1000; ++i) {
+        text += "{\"id\":" + std::to_string(i) + "},";
+    }
+    EXPECT_TRUE(isCompressible(text.data(), text.size()));
+    
+    // compressed data is not worth compressing again
+    auto compr = createCompressor("gzip", CompressionLevel::BEST);
+    ASSERT_TRUE(compr != nullptr);
+    std::string random;
+    uint32_t seed = 1;
+    for (int i = 0; i < 16*1024; ++i) {
+        seed = seed * 1103515245 + 12345;
+        random.push_back(char(seed >> 16));
+    }
+    EXPECT_FALSE(isCompressible(random.data(), random.size()));
+    KMBuffer::Ptr cbuf;
+    EXPECT_EQ(KMError::NOERR, compr->compress(random.data(), random.size(), cbuf));
+    EXPECT_EQ(KMError::NOERR, compr->compress(nullptr, 0, cbuf));
+    ASSERT_TRUE(cbuf != nullptr);
+    EXPECT_FALSE(isCompressible(*cbuf));
+}
+
+TEST(ComprTest, ChangeLevel)
+{
+    auto data = makeJson(20000);
+    for (auto &encoding : getSupportedEncodings()) {
+        auto compr = createCompressor(encoding, CompressionLevel::FAST);
+        ASSERT_TRUE(compr != nullptr);
+        KMBuffer::Ptr cbuf;
+        auto half = data.size() / 2;
+        EXPECT_EQ(KMError::NOERR, compr->compress(data.data(), half, cbuf));
+        // the level changed in the middle of a stream keeps the stream valid
+        compr->setLevel(CompressionLevel::NONE);
+        EXPECT_EQ(KMError::NOERR, compr->compress(data.data() + half, data.size() - half, cbuf));
+        EXPECT_EQ(KMError::NOERR, compr->compress(nullptr, 0, cbuf));
+        
+        auto decompr = createDecompressor(encoding);
+        ASSERT_TRUE(decompr != nullptr);
+        KMBuffer::Ptr dbuf;
+        EXPECT_EQ(KMError::NOERR, decompr->decompress(*cbuf, dbuf));
+        EXPECT_EQ(data, toString(dbuf));
+    }
+}
+
+TEST(ComprTest, Dictionary)
+{
+    auto dict = std::make_shared<const std::string>(
+        "{\"type\":\"presence\",\"user_id\":\"\",\"status\":\"online\",\"timestamp\":}");
+    std::string msg = "{\"type\":\"presence\",\"user_id\":\"u42\",\"status\":\"online\",\"timestamp\":1760774400}";
+    for (auto encoding : {"deflate", "raw-deflate"}) {
+        KMBuffer::Ptr plain_buf, dict_buf;
+        ZLibCompressor plain;
+        ASSERT_EQ(KMError::NOERR, plain.init(encoding, 15));
+        EXPECT_EQ(KMError::NOERR, plain.compress(msg.data(), msg.size(), plain_buf));
+        
+        ZLibCompressor compr;
+        ASSERT_EQ(KMError::NOERR, compr.init(encoding, 15));
+        ASSERT_EQ(KMError::NOERR, compr.setDictionary(dict));
+        EXPECT_EQ(KMError::NOERR, compr.compress(msg.data(), msg.size(), dict_buf));
+        ASSERT_TRUE(plain_buf && dict_buf);
+        EXPECT_LT(dict_buf->chainLength() * 2, plain_buf->chainLength());
+        
+        ZLibDecompressor decompr;
+        ASSERT_EQ(KMError::NOERR, decompr.init(encoding, 15));
+        ASSERT_EQ(KMError::NOERR, decompr.setDictionary(dict));
+        KMBuffer::Ptr dbuf;
+        EXPECT_EQ(KMError::NOERR, decompr.decompress(*dict_buf, dbuf));
+        EXPECT_EQ(msg, toString(dbuf));
+        
+        // the dictionary is loaded again after the context is released
+        compr.releaseContext();
+        decompr.releaseContext();
+        dict_buf.reset();
+        dbuf.reset();
+        EXPECT_EQ(KMError::NOERR, compr.compress(msg.data(), msg.size(), dict_buf));
+        EXPECT_EQ(KMError::NOERR, decompr.decompress(*dict_buf, dbuf));
+        EXPECT_EQ(msg, toString(dbuf));
+    }
+    ZLibCompressor gzip;
+    ASSERT_EQ(KMError::NOERR, gzip.init("gzip", 15));
+    EXPECT_EQ(KMError::NOT_SUPPORTED, gzip.setDictionary(dict));
+}
@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+#include "http/v2/FlowControl.h"
+
+#include <vector>
+
+using namespace kuma;
+
+TEST(FlowControlTest, RestoreOnConsume)
+{
+    WindowBudget budget;
+    std::vector<uint32_t> updates;
+    FlowControl fc(1, [&updates] (uint32_t delta) { updates.push_back(delta); });
+    fc.setBudget(&budget);
+    fc.initLocalWindowSize(H2_DEFAULT_WINDOW_SIZE);
+    fc.setLocalWindowStep(H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_EQ(size_t(H2_DEFAULT_WINDOW_SIZE), budget.used());
+
+    // the data not consumed keeps the budget and the window
+    fc.bytesReceived(H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_EQ(0u, fc.localWindowSize());
+    EXPECT_EQ(size_t(H2_DEFAULT_WINDOW_SIZE), fc.bytesUnconsumed());
+    EXPECT_EQ(size_t(H2_DEFAULT_WINDOW_SIZE), budget.used());
+    EXPECT_TRUE(updates.empty());
+
+    // the window is only restored for the consumed data
+    fc.bytesConsumed(40000);
+    ASSERT_EQ(1u, updates.size());
+    EXPECT_EQ(40000u, updates[0]);
+    EXPECT_EQ(40000u, fc.localWindowSize());
+    EXPECT_EQ(size_t(H2_DEFAULT_WINDOW_SIZE), budget.used());
+
+    // the window is above the threshold, only the budget is released
+    fc.bytesConsumed(H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_EQ(0u, fc.bytesUnconsumed());
+    EXPECT_EQ(1u, updates.size());
+    EXPECT_EQ(40000u, fc.localWindowSize());
+    EXPECT_EQ(40000u, budget.used());
+}
+
+TEST(FlowControlTest, BudgetBoundsBufferedData)
+{
+    WindowBudget budget;
+    budget.setLimit(2 * H2_DEFAULT_WINDOW_SIZE);
+    std::vector<uint32_t> updates;
+    FlowControl fc(1, [&updates] (uint32_t delta) { updates.push_back(delta); });
+    fc.setBudget(&budget);
+    fc.initLocalWindowSize(H2_DEFAULT_WINDOW_SIZE);
+    fc.setLocalWindowStep(H2_DEFAULT_WINDOW_SIZE);
+    fc.growLocalWindow(4 * H2_DEFAULT_WINDOW_SIZE, false);
+
+    // peer fills the whole window while the consumer is slow
+    fc.bytesReceived(4 * H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_TRUE(updates.empty());
+    EXPECT_EQ(size_t(4 * H2_DEFAULT_WINDOW_SIZE), budget.used());
+
+    // budget is exhausted by the buffered data, the window is not refilled
+    fc.bytesConsumed(H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_TRUE(updates.empty());
+    EXPECT_EQ(size_t(3 * H2_DEFAULT_WINDOW_SIZE), budget.used());
+
+    // all the data is consumed, the window is refilled within the budget
+    fc.bytesConsumed(3 * H2_DEFAULT_WINDOW_SIZE);
+    ASSERT_EQ(1u, updates.size());
+    EXPECT_EQ(uint32_t(2 * H2_DEFAULT_WINDOW_SIZE), updates[0]);
+    EXPECT_EQ(size_t(2 * H2_DEFAULT_WINDOW_SIZE), budget.used());
+
+    fc.reset(0);
+    EXPECT_EQ(0u, budget.used());
+}
+
+TEST(FlowControlTest, ShrinkReleasesBudget)
+{
+    WindowBudget budget;
+    FlowControl fc(1, nullptr);
+    fc.setBudget(&budget);
+    fc.initLocalWindowSize(4 * H2_DEFAULT_WINDOW_SIZE);
+    fc.setLocalWindowStep(4 * H2_DEFAULT_WINDOW_SIZE);
+    fc.bytesReceived(H2_DEFAULT_WINDOW_SIZE);
+    
+    // the budget of buffered data is kept until it is consumed
+    fc.shrinkLocalWindow(2 * H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_EQ(uint32_t(2 * H2_DEFAULT_WINDOW_SIZE), fc.localWindowStep());
+    EXPECT_EQ(uint32_t(H2_DEFAULT_WINDOW_SIZE), fc.localWindowSize());
+    EXPECT_EQ(size_t(2 * H2_DEFAULT_WINDOW_SIZE), budget.used());
+    
+    // the window in flight is not released twice
+    fc.shrinkLocalWindow(H2_DEFAULT_WINDOW_SIZE / 2);
+    EXPECT_EQ(0u, fc.localWindowSize());
+    EXPECT_EQ(size_t(H2_DEFAULT_WINDOW_SIZE), budget.used());
+    
+    fc.bytesConsumed(H2_DEFAULT_WINDOW_SIZE);
+    EXPECT_EQ(0u, fc.bytesUnconsumed());
+    fc.reset(0);
+    EXPECT_EQ(0u, budget.used());
+}
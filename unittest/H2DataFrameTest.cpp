@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include "http/v2/H2Frame.h"
+#include "http/v2/PushServer.h"
+#include "util/util.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace kuma;
+
+namespace {
+    // encode the DATA frames of body like H2Stream::sendData does, return the payload received
+    std::string encodeFrames(const KMBuffer &body, size_t max_frame_size)
+    {
+        std::string payload;
+        auto body_size = body.chainLength();
+        size_t offset = 0;
+        while (offset < body_size) {
+            auto frame_len = std::min(body_size - offset, max_frame_size);
+            DataFrame frame;
+            frame.setStreamId(2);
+            KMBuffer::Ptr slice;
+            if (frame_len < body_size) {
+                slice.reset(sliceBuffer(body, offset, frame_len));
+                frame.setData(*slice);
+            } else {
+                frame.setData(body);
+            }
+            uint8_t hdr_buf[H2_FRAME_HEADER_SIZE];
+            KMBuffer hdr(hdr_buf, sizeof(hdr_buf));
+            KMBuffer::Ptr data;
+            if (frame.encode(hdr, data) != int(H2_FRAME_HEADER_SIZE + frame_len)) {
+                return "";
+            }
+            std::string str(hdr.chainLength(), '\0');
+            hdr.readChained(&str[0], str.size());
+            hdr.unlink();
+            if (decode_u24((const uint8_t*)str.data()) != frame_len) {
+                return "";
+            }
+            payload.append(str, H2_FRAME_HEADER_SIZE, std::string::npos);
+            offset += frame_len;
+        }
+        return payload;
+    }
+}
+
+TEST(H2DataFrameTest, SharedBody)
+{
+    std::string str;
+    while (str.size() < 100*1024) {
+        str += std::to_string(str.size()) + ",";
+    }
+    KMBuffer body(str.size());
+    body.write(str.data(), str.size());
+    auto &cache = PushCache::instance();
+    cache.setResource("", "/shared.js", 200, "application/javascript", body);
+    auto res = cache.getResource("www.example.com", "/shared.js");
+    ASSERT_TRUE(res != nullptr);
+
+    // push the cached resource on two loops at the same time
+    auto push = [&res, &str] (size_t max_frame_size, int &failures) {
+        for (int i = 0; i < 200; ++i) {
+            if (encodeFrames(res->body, max_frame_size) != str) {
+                ++failures;
+            }
+        }
+    };
+    int failures1 = 0, failures2 = 0;
+    std::thread t1([&] { push(16384, failures1); });
+    std::thread t2([&] { push(str.size(), failures2); });
+    t1.join();
+    t2.join();
+    EXPECT_EQ(0, failures1);
+    EXPECT_EQ(0, failures2);
+
+    // the shared body is still a single block
+    EXPECT_EQ(str.size(), res->body.chainLength());
+    EXPECT_EQ(1, std::distance(res->body.begin(), res->body.end()));
+    cache.removeResource("", "/shared.js");
+}
+
+TEST(H2DataFrameTest, PushCacheAuthority)
+{
+    KMBuffer body1(1), body2(2);
+    body1.write("a", 1);
+    body2.write("bb", 2);
+    auto &cache = PushCache::instance();
+    cache.setResource("a.example.com", "/app.js", 200, "application/javascript", body1);
+    cache.setResource("b.example.com", "/app.js", 200, "application/javascript", body2);
+    auto res = cache.getResource("a.example.com", "/app.js");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_EQ(1, res->body.chainLength());
+    res = cache.getResource("b.example.com", "/app.js");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_EQ(2, res->body.chainLength());
+    EXPECT_TRUE(cache.getResource("c.example.com", "/app.js") == nullptr);
+    cache.removeResource("a.example.com", "/app.js");
+    cache.removeResource("b.example.com", "/app.js");
+}
@@ -0,0 +1,158 @@
+
+#include <gtest/gtest.h>
+#include "http/v2/hpack/HPacker.h"
+
+#include <string>
+#include <vector>
+
+using namespace hpack;
+
+namespace {
+    int encodeHeaders(HPacker &encoder, const HPacker::KeyValueVector &headers, std::vector<uint8_t> &block)
+    {
+        block.resize(4096);
+        auto ret = encoder.encode(headers, &block[0], block.size());
+        if (ret > 0) {
+            block.resize(ret);
+        }
+        return ret;
+    }
+}
+
+TEST(HPackTest, RoundTrip)
+{
+    HPacker encoder, decoder;
+    HPacker::KeyValueVector headers {
+        {":status", "200"},
+        {"content-type", "application/json"},
+        {"x-request-id", "6f1c2a9e"}
+    };
+    std::vector<uint8_t> block;
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+        HPacker::KeyValueVector decoded;
+        EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+        EXPECT_EQ(headers, decoded);
+    }
+}
+
+TEST(HPackTest, AdaptiveIndexing)
+{
+    HPacker encoder, decoder;
+    std::vector<uint8_t> block;
+    HPacker::KeyValueVector decoded;
+
+    HPacker::KeyValueVector headers { {"content-type", "application/json"} };
+    // first occurrence is not indexed
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    decoder.decode(&block[0], block.size(), decoded);
+    auto first_size = block.size();
+    // repeated value is added to dynamic table
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    decoder.decode(&block[0], block.size(), decoded);
+    // then it is encoded as a one byte index
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    EXPECT_EQ(1, block.size());
+    EXPECT_LT(block.size(), first_size);
+    EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+    EXPECT_EQ(headers, decoded);
+
+    // volatile header is never indexed
+    HPacker::KeyValueVector date { {"date", "Sun, 18 Oct 2026 08:00:00 GMT"} };
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_GT(encodeHeaders(encoder, date, block), 1);
+        EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+        EXPECT_EQ(date, decoded);
+    }
+}
+
+TEST(HPackTest, EncodeCache)
+{
+    HPacker encoder, decoder;
+    encoder.setEncodeCacheSize(4);
+    HPacker::KeyValueVector headers {
+        {":status", "200"},
+        {"server", "kuma"},
+        {"content-type", "text/html"}
+    };
+    std::vector<uint8_t> block;
+    HPacker::KeyValueVector decoded;
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+        EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+        EXPECT_EQ(headers, decoded);
+        // interleave other header sets that modify dynamic table
+        HPacker::KeyValueVector other { {"x-trace", std::to_string(i % 2)} };
+        EXPECT_GT(encodeHeaders(encoder, other, block), 0);
+        EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+        EXPECT_EQ(other, decoded);
+    }
+}
+
+TEST(HPackTest, TableSizeUpdate)
+{
+    HPacker encoder, decoder;
+    decoder.updateTableSize(16384);
+    encoder.updateTableSize(16384);
+    HPacker::KeyValueVector headers { {"cookie", std::string(6000, 'c')} };
+    std::vector<uint8_t> block;
+    HPacker::KeyValueVector decoded;
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+    // the entry fits in 16K table only
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    EXPECT_LT(block.size(), 4);
+    EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+    EXPECT_EQ(headers, decoded);
+}
+
+TEST(HPackTest, DecodeFragments)
+{
+    HPacker encoder, decoder;
+    HPacker::KeyValueVector headers {
+        {":method", "GET"},
+        {":path", "/index.html"},
+        {"user-agent", "kuma"},
+        {"cookie", std::string(300, 'c')}
+    };
+    std::vector<uint8_t> block;
+    HPacker::KeyValueVector decoded;
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+        // feed the block byte by byte
+        decoded.clear();
+        for (size_t j = 0; j < block.size(); ++j) {
+            bool end_block = j + 1 == block.size();
+            EXPECT_EQ(1, decoder.decode(&block[j], 1, end_block, decoded));
+        }
+        EXPECT_EQ(headers, decoded);
+    }
+    // truncated block
+    HPacker encoder2, decoder2;
+    EXPECT_GT(encodeHeaders(encoder2, headers, block), 0);
+    decoded.clear();
+    EXPECT_EQ(-1, decoder2.decode(&block[0], block.size() - 1, true, decoded));
+}
+
+TEST(HPackTest, MaxHeaderListSize)
+{
+    HPacker encoder, decoder;
+    decoder.setMaxHeaderListSize(256);
+    HPacker::KeyValueVector headers {
+        {"x-small", "1"},
+        {"x-large", std::string(300, 'l')}
+    };
+    std::vector<uint8_t> block;
+    HPacker::KeyValueVector decoded;
+    EXPECT_GT(encodeHeaders(encoder, headers, block), 0);
+    EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+    EXPECT_TRUE(decoder.isHeaderListTooLarge());
+    EXPECT_EQ(1, decoded.size());
+    
+    // the dynamic table is still in sync
+    HPacker::KeyValueVector small { {"x-small", "1"} };
+    EXPECT_GT(encodeHeaders(encoder, small, block), 0);
+    EXPECT_EQ(int(block.size()), decoder.decode(&block[0], block.size(), decoded));
+    EXPECT_FALSE(decoder.isHeaderListTooLarge());
+    EXPECT_EQ(small, decoded);
+}
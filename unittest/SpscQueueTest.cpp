@@ -0,0 +1,83 @@
+
+#include <gtest/gtest.h>
+#include "util/spscqueue.h"
+#include "kmbuffer.h"
+
+#include <thread>
+#include <memory>
+
+using namespace kuma;
+
+TEST(SpscQueueTest, Basic)
+{
+    SpscQueue<int> q;
+    EXPECT_TRUE(q.empty());
+    EXPECT_EQ(nullptr, q.front());
+    int v = 0;
+    EXPECT_FALSE(q.dequeue(v));
+    for (int i = 0; i < 10; ++i) {
+        q.enqueue(int(i));
+    }
+    EXPECT_FALSE(q.empty());
+    EXPECT_EQ(0, *q.front());
+    q.pop_front();
+    EXPECT_TRUE(q.dequeue(v));
+    EXPECT_EQ(1, v);
+    // recycled nodes
+    for (int i = 10; i < 20; ++i) {
+        q.enqueue(int(i));
+    }
+    for (int i = 2; i < 20; ++i) {
+        EXPECT_TRUE(q.dequeue(v));
+        EXPECT_EQ(i, v);
+    }
+    EXPECT_TRUE(q.empty());
+    q.enqueue(1);
+    q.clear();
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(SpscQueueTest, KMBuffer)
+{
+    SpscQueue<KMBuffer> q;
+    const char *str = "hello";
+    KMBuffer buf1(6);
+    buf1.write(str, 6);
+    q.enqueue(std::move(buf1));
+    KMBuffer buf2(str, 6, 6);
+    q.enqueue(KMBuffer(buf2));
+    for (int i = 0; i < 2; ++i) {
+        auto *kmb = q.front();
+        ASSERT_NE(nullptr, kmb);
+        EXPECT_EQ(6, kmb->chainLength());
+        EXPECT_STREQ(str, static_cast<const char*>(kmb->readPtr()));
+        q.pop_front();
+    }
+    EXPECT_TRUE(q.empty());
+}
+
+TEST(SpscQueueTest, ProducerConsumer)
+{
+    SpscQueue<std::unique_ptr<int>> q;
+    const int count = 100000;
+    std::thread producer([&q] {
+        for (int i = 0; i < count; ++i) {
+            q.enqueue(std::unique_ptr<int>(new int(i)));
+        }
+    });
+    int received = 0;
+    int out_of_order = 0;
+    std::unique_ptr<int> v;
+    while (received < count) {
+        if (q.dequeue(v)) {
+            // don't return before producer is joined
+            if (*v != received) {
+                ++out_of_order;
+            }
+            ++received;
+        }
+    }
+    producer.join();
+    EXPECT_EQ(0, out_of_order);
+    EXPECT_TRUE(q.empty());
+}
@@ -0,0 +1,151 @@
+#ifdef KUMA_HAS_OPENSSL
+
+#include <gtest/gtest.h>
+#include "ssl/SslSessionCache.h"
+
+#include <openssl/x509.h>
+
+#include <string>
+
+using namespace kuma;
+
+namespace {
+    const std::string kSessionKey = "127.0.0.1:443/localhost/1";
+
+    int newSessionCallback(SSL *ssl, SSL_SESSION *session)
+    {
+        SslSessionCache::get().store(kSessionKey, session);
+        return 1;
+    }
+
+    SSL_CTX* createServerContext()
+    {
+        EVP_PKEY *pkey = nullptr;
+        auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(pctx);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(pctx, &pkey);
+        EVP_PKEY_CTX_free(pctx);
+
+        auto x509 = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_get_notBefore(x509), 0);
+        X509_gmtime_adj(X509_get_notAfter(x509), 3600);
+        X509_set_pubkey(x509, pkey);
+        auto name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(x509, name);
+        X509_sign(x509, pkey, EVP_sha256());
+
+        auto ctx = SSL_CTX_new(SSLv23_server_method());
+        SSL_CTX_use_certificate(ctx, x509);
+        SSL_CTX_use_PrivateKey(ctx, pkey);
+        X509_free(x509);
+        EVP_PKEY_free(pkey);
+        return ctx;
+    }
+
+    SSL_CTX* createClientContext()
+    {
+        auto ctx = SSL_CTX_new(SSLv23_client_method());
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, newSessionCallback);
+        return ctx;
+    }
+
+    // handshake over memory BIO pair, return true if the session is resumed
+    bool connect(SSL_CTX *client_ctx, SSL_CTX *server_ctx, bool &success)
+    {
+        auto client = SSL_new(client_ctx);
+        auto server = SSL_new(server_ctx);
+        BIO *client_bio = nullptr, *server_bio = nullptr;
+        BIO_new_bio_pair(&client_bio, 0, &server_bio, 0);
+        SSL_set_bio(client, client_bio, client_bio);
+        SSL_set_bio(server, server_bio, server_bio);
+        SSL_set_connect_state(client);
+        SSL_set_accept_state(server);
+        SslSessionCache::get().resume(client, kSessionKey);
+
+        bool client_done = false, server_done = false;
+        for (int i = 0; i < 16 && !(client_done && server_done); ++i) {
+            if (!client_done) client_done = SSL_do_handshake(client) == 1;
+            if (!server_done) server_done = SSL_do_handshake(server) == 1;
+        }
+        success = client_done && server_done;
+        // TLS 1.3 tickets are received after handshake
+        char c;
+        SSL_read(client, &c, 1);
+        bool resumed = SSL_session_reused(client) == 1;
+        // session of a connection not shut down is not resumable
+        SSL_shutdown(client);
+        SSL_shutdown(server);
+        SSL_free(client);
+        SSL_free(server);
+        return resumed;
+    }
+}
+
+TEST(SslSessionCacheTest, Resume)
+{
+    auto &cache = SslSessionCache::get();
+    cache.clear();
+    cache.setPolicy(16, 3600);
+    auto client_ctx = createClientContext();
+    auto server_ctx = createServerContext();
+    auto stats0 = cache.getStats();
+
+    bool success = false;
+    EXPECT_FALSE(connect(client_ctx, server_ctx, success));
+    EXPECT_TRUE(success);
+    auto stats1 = cache.getStats();
+    EXPECT_EQ(stats0.misses + 1, stats1.misses);
+    EXPECT_GT(stats1.stores, stats0.stores);
+
+    // the cached session or ticket is resumed, and a new one is cached
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(connect(client_ctx, server_ctx, success));
+        EXPECT_TRUE(success);
+    }
+    auto stats2 = cache.getStats();
+    EXPECT_EQ(stats1.hits + 3, stats2.hits);
+    EXPECT_EQ(stats1.misses, stats2.misses);
+
+    // cache disabled
+    cache.setPolicy(0, 3600);
+    EXPECT_FALSE(connect(client_ctx, server_ctx, success));
+    EXPECT_TRUE(success);
+    EXPECT_EQ(stats2.misses + 1, cache.getStats().misses);
+
+    cache.setPolicy(1024, 3600);
+    cache.clear();
+    SSL_CTX_free(client_ctx);
+    SSL_CTX_free(server_ctx);
+}
+
+TEST(SslSessionCacheTest, Eviction)
+{
+    auto &cache = SslSessionCache::get();
+    cache.clear();
+    cache.setPolicy(1, 3600);
+    auto client_ctx = createClientContext();
+    auto server_ctx = createServerContext();
+
+    bool success = false;
+    connect(client_ctx, server_ctx, success);
+    EXPECT_TRUE(success);
+    // a session of other peer evicts the least recently used one
+    auto session = SSL_SESSION_new();
+    cache.store("127.0.0.1:8443/other/1", session);
+    EXPECT_FALSE(connect(client_ctx, server_ctx, success));
+    EXPECT_TRUE(success);
+
+    cache.remove(kSessionKey);
+    EXPECT_FALSE(connect(client_ctx, server_ctx, success));
+
+    cache.setPolicy(1024, 3600);
+    cache.clear();
+    SSL_CTX_free(client_ctx);
+    SSL_CTX_free(server_ctx);
+}
+
+#endif // KUMA_HAS_OPENSSL
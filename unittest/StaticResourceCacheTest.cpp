@@ -0,0 +1,84 @@
+
+#include <gtest/gtest.h>
+#include "http/StaticResourceCache.h"
+
+#include <string>
+#include <chrono>
+#include <thread>
+
+using namespace kuma;
+
+namespace {
+    KMBuffer makeBody(size_t size)
+    {
+        std::string str;
+        while (str.size() < size) {
+            str += "{\"id\":" + std::to_string(str.size() % 97) + ",\"name\":\"kuma\"},";
+        }
+        KMBuffer buf(size);
+        memcpy(buf.writePtr(), str.data(), size);
+        buf.bytesWritten(size);
+        return buf;
+    }
+}
+
+TEST(StaticResourceCacheTest, Variants)
+{
+    auto &cache = StaticResourceCache::instance();
+    auto body = makeBody(64*1024);
+    cache.setResource("/data.json", "application/json", body, false);
+    auto res = cache.getResource("/data.json");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_TRUE(res->vary);
+    EXPECT_GE(res->variants.size(), 3U);
+    
+    auto &identity = res->getVariant("");
+    EXPECT_TRUE(identity.encoding.empty());
+    EXPECT_EQ(body.chainLength(), identity.body.chainLength());
+    
+    auto &gzip = res->getVariant("gzip;q=1, deflate;q=0.5");
+    EXPECT_EQ("gzip", gzip.encoding);
+    EXPECT_LT(gzip.body.chainLength(), body.chainLength());
+    // the variant is shared by all the responses
+    KMBuffer::Ptr clone(gzip.body.clone());
+    EXPECT_EQ(gzip.body.readPtr(), clone->readPtr());
+    
+    EXPECT_TRUE(res->getVariant("gzip;q=0, deflate;q=0").encoding.empty());
+    
+    cache.removeResource("/data.json");
+    EXPECT_TRUE(cache.getResource("/data.json") == nullptr);
+}
+
+TEST(StaticResourceCacheTest, NoVary)
+{
+    auto &cache = StaticResourceCache::instance();
+    cache.setResource("/small.txt", "text/plain", makeBody(100), false);
+    auto res = cache.getResource("/small.txt");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_FALSE(res->vary);
+    EXPECT_EQ(1U, res->variants.size());
+    EXPECT_TRUE(res->getVariant("gzip").encoding.empty());
+    
+    cache.setResource("/image.png", "image/png", makeBody(4096), false);
+    res = cache.getResource("/image.png");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_FALSE(res->vary);
+    cache.removeResource("/small.txt");
+    cache.removeResource("/image.png");
+}
+
+TEST(StaticResourceCacheTest, Async)
+{
+    auto &cache = StaticResourceCache::instance();
+    cache.setResource("/async.json", "application/json", makeBody(32*1024), true);
+    auto res = cache.getResource("/async.json");
+    ASSERT_TRUE(res != nullptr);
+    EXPECT_TRUE(res->vary);
+    for (int i = 0; i < 500 && res->variants.size() == 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        res = cache.getResource("/async.json");
+    }
+    EXPECT_GT(res->variants.size(), 1U);
+    EXPECT_EQ("gzip", res->getVariant("gzip").encoding);
+    cache.removeResource("/async.json");
+}
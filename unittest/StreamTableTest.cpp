@@ -0,0 +1,87 @@
+
+#include <gtest/gtest.h>
+#include "http/v2/StreamTable.h"
+
+#include <memory>
+#include <vector>
+
+using namespace kuma;
+
+TEST(StreamTableTest, InsertFindErase)
+{
+    StreamTable<int> table;
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(nullptr, table.find(1));
+    for (uint32_t id = 1; id < 200; id += 2) {
+        table.insert(id, int(id));
+    }
+    // promised stream ids share the table
+    table.insert(2, 2);
+    EXPECT_EQ(101, table.size());
+    for (uint32_t id = 1; id < 200; id += 2) {
+        ASSERT_NE(nullptr, table.find(id));
+        EXPECT_EQ(int(id), *table.find(id));
+    }
+    EXPECT_EQ(2, *table.find(2));
+    EXPECT_EQ(nullptr, table.find(4));
+    
+    for (uint32_t id = 1; id < 150; id += 2) {
+        EXPECT_TRUE(table.erase(id));
+    }
+    EXPECT_FALSE(table.erase(1));
+    EXPECT_EQ(26, table.size());
+    for (uint32_t id = 151; id < 200; id += 2) {
+        ASSERT_NE(nullptr, table.find(id));
+        EXPECT_EQ(int(id), *table.find(id));
+    }
+    
+    size_t count = 0;
+    table.forEach([&count] (uint32_t id, int &v) {
+        EXPECT_EQ(int(id), v);
+        ++count;
+    });
+    EXPECT_EQ(table.size(), count);
+}
+
+TEST(StreamTableTest, Collision)
+{
+    StreamTable<std::shared_ptr<int>> table;
+    // ids with same slot
+    std::vector<uint32_t> ids { 1, 17, 33, 49, 3, 65 };
+    for (auto id : ids) {
+        table.insert(id, std::make_shared<int>(int(id)));
+    }
+    EXPECT_TRUE(table.erase(17));
+    EXPECT_TRUE(table.erase(1));
+    for (auto id : { 33, 49, 3, 65 }) {
+        ASSERT_NE(nullptr, table.find(id));
+        EXPECT_EQ(id, **table.find(id));
+    }
+}
+
+TEST(StreamTableTest, BlockedList)
+{
+    StreamTable<int> table;
+    for (uint32_t id = 1; id < 20; id += 2) {
+        table.insert(id, int(id));
+    }
+    EXPECT_FALSE(table.block(2));
+    EXPECT_TRUE(table.block(5));
+    EXPECT_TRUE(table.block(3));
+    EXPECT_TRUE(table.block(5));
+    EXPECT_TRUE(table.block(7));
+    EXPECT_EQ(3, table.blockedCount());
+    // erased stream is unlinked
+    table.erase(3);
+    EXPECT_EQ(2, table.blockedCount());
+    EXPECT_EQ(5, table.unblockFront());
+    EXPECT_TRUE(table.block(5));
+    EXPECT_EQ(7, table.unblockFront());
+    EXPECT_EQ(5, table.unblockFront());
+    EXPECT_EQ(0, table.unblockFront());
+    EXPECT_FALSE(table.hasBlocked());
+    
+    auto moved = std::move(table);
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(9, moved.size());
+}
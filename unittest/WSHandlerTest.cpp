@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include "ws/WSHandler.h"
+
+#include <string>
+#include <vector>
+
+using namespace kuma;
+using namespace kuma::ws;
+
+namespace {
+    // client frame, payload is masked
+    std::vector<uint8_t> encodeFrame(WSOpcode opcode, const std::string &payload)
+    {
+        FrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.fin = 1;
+        hdr.opcode = uint8_t(opcode);
+        hdr.mask = 1;
+        const uint8_t mask_key[WS_MASK_KEY_SIZE] = { 0x11, 0x22, 0x33, 0x44 };
+        memcpy(hdr.maskey, mask_key, WS_MASK_KEY_SIZE);
+        hdr.length = uint32_t(payload.size());
+        uint8_t hdr_buf[WS_MAX_HEADER_SIZE];
+        auto hdr_len = WSHandler::encodeFrameHeader(hdr, hdr_buf);
+        std::vector<uint8_t> frame(hdr_buf, hdr_buf + hdr_len);
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        WSHandler::handleDataMask(mask_key, &frame[hdr_len], payload.size());
+        return frame;
+    }
+}
+
+TEST(WSHandlerTest, SpanningFrame)
+{
+    WSHandler handler;
+    handler.setMode(WSMode::SERVER);
+    std::string payload;
+    while (payload.size() < 300*1024) {
+        payload += std::to_string(payload.size());
+    }
+    std::string received;
+    bool shared = true;
+    handler.setFrameCallback([&received, &shared] (FrameHeader hdr, KMBuffer &buf) {
+        // reassembled in pooled blocks, the receiver can retain them
+        shared = shared && buf.isShared();
+        std::string str(buf.chainLength(), '\0');
+        buf.readChained(&str[0], str.size());
+        received += str;
+        return KMError::NOERR;
+    });
+    auto frame = encodeFrame(WSOpcode::BINARY, payload);
+    // the frame arrives in many reads
+    size_t pos = 0;
+    while (pos < frame.size()) {
+        auto len = std::min<size_t>(1000, frame.size() - pos);
+        auto err = handler.handleData(&frame[pos], len);
+        pos += len;
+        EXPECT_EQ(pos < frame.size() ? WSError::NEED_MORE_DATA : WSError::NOERR, err);
+    }
+    EXPECT_EQ(payload, received);
+    EXPECT_TRUE(shared);
+}
+
+TEST(WSHandlerTest, StopOnReceiverError)
+{
+    WSHandler handler;
+    handler.setMode(WSMode::SERVER);
+    int frames = 0;
+    handler.setFrameCallback([&frames] (FrameHeader hdr, KMBuffer &buf) {
+        ++frames;
+        return KMError::INVALID_STATE; // e.g. closed by the frame handler
+    });
+    // two frames in the first segment and one in the second
+    auto frame1 = encodeFrame(WSOpcode::TEXT, "first");
+    auto frame2 = encodeFrame(WSOpcode::TEXT, "second");
+    auto frame3 = encodeFrame(WSOpcode::PING, "ping");
+    frame1.insert(frame1.end(), frame2.begin(), frame2.end());
+    KMBuffer seg1(&frame1[0], frame1.size(), frame1.size());
+    KMBuffer seg2(&frame3[0], frame3.size(), frame3.size());
+    seg1.append(&seg2);
+    EXPECT_EQ(WSError::INVALID_STATE, handler.handleData(seg1));
+    seg2.unlink();
+    EXPECT_EQ(1, frames);
+
+    // decoding is resumed after reset
+    handler.reset();
+    EXPECT_EQ(WSError::INVALID_STATE, handler.handleData(&frame3[0], frame3.size()));
+    EXPECT_EQ(2, frames);
+}
+
+TEST(WSHandlerTest, MessageTooBig)
+{
+    WSHandler handler;
+    handler.setMode(WSMode::SERVER);
+    handler.setMaxMessageSize(1024);
+    int frames = 0;
+    handler.setFrameCallback([&frames] (FrameHeader hdr, KMBuffer &buf) {
+        ++frames;
+        return KMError::NOERR;
+    });
+    auto frame1 = encodeFrame(WSOpcode::BINARY, std::string(1000, 'a'));
+    EXPECT_EQ(WSError::NOERR, handler.handleData(&frame1[0], frame1.size()));
+    EXPECT_EQ(1, frames);
+
+    // rejected on the frame header, no payload is received yet
+    auto frame2 = encodeFrame(WSOpcode::BINARY, std::string(64*1024, 'b'));
+    EXPECT_EQ(WSError::MESSAGE_TOO_BIG, handler.handleData(&frame2[0], 16));
+    EXPECT_EQ(1, frames);
+}
@@ -0,0 +1,82 @@
+
+#include <gtest/gtest.h>
+#include "ws/WSMask.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace kuma::ws;
+
+namespace {
+    const uint8_t kMaskKey[WS_MASK_KEY_SIZE] = { 0x37, 0xfa, 0x21, 0x3d };
+    
+    std::vector<uint8_t> makeData(size_t len)
+    {
+        std::vector<uint8_t> data(len);
+        for (size_t i = 0; i < len; ++i) {
+            data[i] = uint8_t(i * 31 + 7);
+        }
+        return data;
+    }
+    
+    std::vector<uint8_t> maskReference(std::vector<uint8_t> data, size_t phase)
+    {
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] ^= kMaskKey[(phase + i) % WS_MASK_KEY_SIZE];
+        }
+        return data;
+    }
+}
+
+TEST(WSMaskTest, MatchesScalar)
+{
+    for (size_t len = 0; len < 130; ++len) {
+        for (size_t phase = 0; phase < WS_MASK_KEY_SIZE; ++phase) {
+            auto data = makeData(len + 1);
+            auto expected = maskReference(std::vector<uint8_t>(data.begin() + 1, data.end()), phase);
+            // start from an odd offset to exercise unaligned access
+            auto *ptr = len > 0 ? &data[1] : nullptr;
+            EXPECT_EQ((phase + len) % WS_MASK_KEY_SIZE, maskData(kMaskKey, phase, ptr, len));
+            EXPECT_EQ(expected, std::vector<uint8_t>(data.begin() + 1, data.end()));
+        }
+    }
+}
+
+TEST(WSMaskTest, PhaseCarryOver)
+{
+    auto data = makeData(1000);
+    auto expected = maskReference(data, 0);
+    // mask in pieces as a KMBuffer chain does
+    const size_t pieces[] = { 1, 3, 17, 64, 5, 333, 2 };
+    size_t pos = 0, phase = 0, n = 0;
+    while (pos < data.size()) {
+        auto len = std::min(pieces[n++ % 7], data.size() - pos);
+        phase = maskData(kMaskKey, phase, &data[pos], len);
+        pos += len;
+    }
+    EXPECT_EQ(expected, data);
+    
+    // masking twice restores the data
+    maskData(kMaskKey, 0, &data[0], data.size());
+    EXPECT_EQ(makeData(1000), data);
+}
+
+// run with --gtest_also_run_disabled_tests
+TEST(WSMaskTest, DISABLED_Benchmark)
+{
+    const size_t kSizes[] = { 125, 4096, 65536, 1024*1024 };
+    const size_t kTotalBytes = 1024*1024*1024;
+    for (auto size : kSizes) {
+        auto data = makeData(size);
+        auto rounds = kTotalBytes / size;
+        auto start = std::chrono::steady_clock::now();
+        size_t phase = 0;
+        for (size_t i = 0; i < rounds; ++i) {
+            phase = maskData(kMaskKey, phase, &data[0], data.size());
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "maskData, size=" << size << ", " << (ms > 0 ? kTotalBytes / 1024 / 1024 * 1000 / ms : 0)
+                  << " MB/s, phase=" << phase << std::endl;
+    }
+}